@@ -10,8 +10,13 @@ set ProjectDir=F:/CODING/phragdat
 set VCVarsLocation="C:\Program Files (x86)\Microsoft Visual Studio\2019\Community\VC\Auxiliary\Build\vcvarsall.bat"
 
 if exist build\phragdat.exe del build\phragdat.exe
+if exist build\phragdat_bench.exe del build\phragdat_bench.exe
+if exist build\phragdat_reader.lib del build\phragdat_reader.lib
 call %VCVarsLocation% x64
 pushd build
-cl -nologo -MT -Gm- -GR- -EHa- -Oi -W4 -FC -std:c++17 -EHsc %ProjectDir%/src/phragdat.cpp /link -subsystem:console -opt:ref Shlwapi.lib Kernel32.lib
+cl -nologo -MT -Gm- -GR- -EHa- -Oi -W4 -FC -std:c++17 -EHsc %ProjectDir%/src/phragdat.cpp %ProjectDir%/src/phragdat_reader.cpp /link -subsystem:console -opt:ref Shlwapi.lib Kernel32.lib Psapi.lib
+cl -nologo -MT -Gm- -GR- -EHa- -Oi -W4 -FC -std:c++17 -EHsc %ProjectDir%/src/phragdat_bench.cpp %ProjectDir%/src/phragdat_reader.cpp /link -subsystem:console -opt:ref Shlwapi.lib Kernel32.lib Psapi.lib
+cl -nologo -MT -Gm- -GR- -EHa- -Oi -W4 -FC -std:c++17 -EHsc -c %ProjectDir%/src/phragdat_reader.cpp
+lib -nologo phragdat_reader.obj -out:phragdat_reader.lib
 popd
 exit
\ No newline at end of file
@@ -6,8 +6,8 @@
 // (c) Phragware 2020
 //====================================
 
-#define VER_MAJ 5
-#define VER_MIN 4
+#define VER_MAJ 6
+#define VER_MIN 0
 #define DEBUG_MODE 0
 
 // MSVCC likes to complain about safety and I don't care!
@@ -27,6 +27,11 @@
 #include <array>
 #include <vector>
 #include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <bitset>
+#include <deque>
+#include <algorithm>
 
 // C++ Streams
 #include <iostream>
@@ -36,15 +41,36 @@
 
 // C++ Other
 #include <string>
+#include <string_view>
 #include <memory>
 #include <iterator>
 #include <filesystem>
 #include <windows.h>
 #include <shlwapi.h>
+#include <psapi.h>
 #include <random>
 #include <fcntl.h>
 #include <io.h>
 
+// IoRing (Windows 11 SDK), see IoRing backend
+#if defined(__has_include)
+  #if __has_include(<ioringapi.h>)
+    #include <ioringapi.h>
+    #define PHD_IORING 1
+  #endif
+#endif
+
+// C++ Threading
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "phragdat_format.h"
+#include "phragdat_lz.h"
+#include "phragdat_crc.h"
+#include "phragdat_reader.h"
+
 // GLOBAL GENERATORS
 static std::string
 GETBASEPATH()
@@ -58,6 +84,7 @@ GETBASEPATH()
 
 // GLOBALS
 static std::string BASE_PATH = GETBASEPATH();
+static bool FILE_REPORT = 1; // one "Writing: " line per file, -q turns it off
 static uint64_t BUFFER_WRITE_SIZE = 0xffffffff; // 8-byte(64-bit) buffersize
 //#define BUFFER_WRITE_SIZE 4294967295U
 
@@ -69,31 +96,100 @@ static std::string PHD_UsageStr =
 
 static std::string PHD_HelpStr =
 "\n## Usage:\
-\n	phragdat -i\"input/dir\" -d\"dat/output/dir\" -c\"csv/output/dir\" -e\"exclusions.txt\"(optional)\
+\n	phragdat -i\"input/dir\" -d\"dat/output/dir\" -c\"csv/output/dir\" -g\"header/output/dir\"(optional) -e\"exclusions.txt\"(optional) -l\"startup.trace\"(optional) -p\"hot.trace\"(optional) -jN(optional) -z(optional) -s(optional) -aN(optional) -u(optional) -r(optional) -b\"backend\"(optional) -q(optional) --stats(optional) --stats-json\"stats.json\"(optional)\
+\n	phragdat -i\"input/dir\" -d- -c\"csv/output/dir\"(optional) -g\"header/output/dir\"(optional) -e\"exclusions.txt\"(optional) -z(optional) -aN(optional) -q(optional) --stats(optional) --stats-json\"stats.json\"(optional) > archive.dat\
+\n	phragdat -t\"archive.dat\" -jN(optional)\
+\n	phragdat -x\"archive.dat\" -o\"output/dir\" -f\"filter\"(optional, repeatable) -jN(optional)\
 \n\
 \n### Compilation:\
 \n    compiles all contents of \"path/to/input\" and exports single .dat file\
 \n    Output will be named [input].dat and [input].csv respectively\
 \n    optional exclusions text file: see below options for details\
+\n    optional -g: also write [input].h, a C++17 header with constexpr lookups (see below)\
+\n    optional -l: write the files listed in an access trace (see below) first, in the order\
+\n    they are listed, so a program's startup reads the front of the .dat sequentially\
+\n    optional -p: hot region, the files in a trace or list (same format as -l) go before all\
+\n    others (never in solid blocks) and their range is recorded in the table of contents so\
+\n    PHD_ArchivePreloadHot can load all of them at once\
+\n    optional -jN: copy files into the .dat with N threads (-j alone uses all cores),\
+\n    output is identical to the single threaded default\
+\n    optional -z: compress each file on its own (LZ), files that do not shrink are stored,\
+\n    the table of contents and .csv record both stored and original lengths\
+\n    optional -s: pack files under 4KB into solid blocks of up to 256KB (grouped by directory\
+\n    and extension) that are compressed together and read back with one read per block\
+\n    optional -aN: start entries on N byte boundaries (power of 2, e.g. -a16, -a4096) for\
+\n    unbuffered reads and mapping single entries, entries under 4*N bytes are not aligned\
+\n    optional -u: incremental rebuild, keeps [input].manifest beside the .dat and copies files\
+\n    whose size and modified time (or content, with -z) are unchanged from the previous .dat\
+\n    optional -r: store byte-identical files once, every copy's entry points at the same bytes\
+\n    optional -b: how stored files (no -z/-s) are copied, -b\"ioring\" batches their reads and\
+\n    writes through Windows 11 IoRing (64KB slots, 128 in flight per -j thread), -b\"blocking\"\
+\n    reads and writes each file in turn, -b\"auto\" (default) uses IoRing if the system has it,\
+\n    -d- always copies blocking and refuses -b\"ioring\"\
+\n    optional -q: no \"Writing: \" line per file, only the totals\
+\n    optional --stats: after compiling print the time of each phase, directories scanned, files excluded\
+\n    per kind of rule, bytes read and written, open/enumerate/read/write/submit calls, peak memory, heap\
+\n    blocks of the scan tree, file table and path arena, their sizes and the 10 slowest files\
+\n    optional --stats-json\"stats.json\": write the same as one JSON document\
+\n\
+\n### Streaming:\
+\n    -d- writes the .dat to stdout (a file or pipe) in one pass while the input is walked,\
+\n    each file as soon as its directory is read and the table of contents last, never seeking\
+\n    the .dat matches a -j1 build, progress goes to stderr and -c is optional\
+\n    -s, -u, -r, -l and -p need every file before the first is written and cannot be used,\
+\n    neither can -jN (more than 1): the walk and the writes run on one thread\
+\n\
+\n### Verification:\
+\n    -t checks the CRC32C checksums of the table of contents and of every entry and solid block\
+\n    of a v6.0+ .dat, with -jN threads, reports damaged entries and returns 1 if there are any\
+\n\
+\n### Extraction:\
+\n    -x writes the files of a v6.0+ .dat back out under -o\"output/dir\" (created if missing)\
+\n    optional -f: only extract matching files, same syntax as an exclusions file line:\
+\n    -f\"textures/\" -f\"*.json\" -f\"levels/1.map\" (several -f add up, \"!rule\" takes back out)\
+\n    optional -jN: write files with N threads, checksums are checked before each file is written\
 \n\
 \n#### Contents .csv:\
 \n    contains contents/address info to access files within the .dat file\
 \n    list of files (path from .dat as root) with their address and length within .dat file\
 \n\
+\n#### Contents .h (-g):\
+\n    constexpr table of every entry (hash, offset, length, stored length, method, block, path)\
+\n    in minimal perfect hash order: phd::find(\"ui/font.ttf\") is two hash mixes and one compare,\
+\n    nullptr if missing, with nothing to parse at startup. phd::at(\"path\") in a constant\
+\n    expression, PHD_ASSET(\"path\") or C++20 phd::require(\"path\") fail to compile if the path\
+\n    is not in the .dat\
+\n\
+\n#### Access Trace (-l):\
+\n    PHD_ArchiveTraceBegin/PHD_ArchiveTraceWrite (phragdat_reader.h) record the paths a program\
+\n    finds in the order it first finds them: a \"PHRDAT-TRACE\",1 line, then \"DatPath\",microseconds\
+\n    lines. Any list of DatPaths, one per line, works as well. Traced files go first in trace\
+\n    order (with -s the first solid blocks too), the rest follow as without -l, listed paths\
+\n    that are not in the input are counted and skipped\
+\n\
 \n#### Exclusions File:\
-\n    a simple text file with each new text line counting as an exclude.\
+\n    a simple text file with each new text line counting as an exclude, gitignore style.\
 \n    Possible Exclusions:\
 \n    Specific Files: \"filename.ext\"\
 \n    Files with specific extension: \"*.ext\"\
 \n    Directory and all sub-directories: \"Directory/\"\
 \n    (directories must end in '/' and ANY directory with that name will be excluded)\
+\n    rules match whole file/directory names, \"a.txt\" does not exclude \"data.txt\"\
+\n    Patterns:\
+\n    \"?\" any one character, \"*\" any characters except '/', \"[a-z]\" \"[!a-z]\" character classes\
+\n    a '/' at the start or in the middle anchors the rule to the input directory: \"/a.txt\" \"src/tmp\"\
+\n    \"**/\" any number of directories: \"**/cache/*.bin\" \"art/**/raw\" \"build/**\"\
+\n    \"!rule\" re-includes what an earlier rule excluded (the last matching rule wins),\
+\n    nothing inside an excluded directory can be re-included\
+\n    \"#\" starts a comment line, \"\\\" escapes the next character\
 \n    for example:\
 \n        File e.txt Contents:\
 \n            *.txt\
+\n            !readme.txt\
 \n            Thumbs.db\
 \n            TestDirectory/\
-\n    This will exclude all files ending in '.txt', all 'Thumbs.db' files, and all files\
-\n    and directories within 'TestDirectory/'.";
+\n    This will exclude all files ending in '.txt' except 'readme.txt', all 'Thumbs.db' files,\
+\n    and all files and directories within 'TestDirectory/'.";
 
 //============================
 // PHD_GetVersion
@@ -139,654 +235,4828 @@ PHD_EnsureSingleSlashes(std::string _Input)
   return Output;
 }
 
-//==================================
-// GetFileAndDirectoryList
-// get file and dir list from path
-//==================================
-static int
-PHD_GetFileAndDirectoryList(std::string _Input,
-                            std::vector<std::string> &_vecstrF,
-                            std::vector<std::string> &_vecstrD)
+//=====================================================
+// Statistics (--stats, --stats-json)
+// counters bumped where directories are enumerated and
+// files are opened, read and written. Relaxed atomics
+// cost nothing next to the calls they count, so they
+// are always on, only the slowest files list (which
+// takes a lock per file) waits for RecordFiles
+//=====================================================
+#define PHD_STATS_SLOWEST 10 // files listed by --stats
+
+// what kind of exclusion rule removed an entry, see PHD_RuleKind
+#define PHD_RULE_NAME 0 // "Thumbs.db"
+#define PHD_RULE_EXTENSION 1 // "*.ext"
+#define PHD_RULE_DIRECTORY 2 // "Directory/"
+#define PHD_RULE_PATH 3 // anchored or "**": "/a.txt" "src/tmp" "**/cache/*.bin"
+#define PHD_RULE_PATTERN 4 // any other wildcards: "f?o" "*_old*" "[a-z]*.txt"
+#define PHD_RULE_KINDS 5
+
+static const char *PHD_RuleKindNames[PHD_RULE_KINDS] = {"name", "extension", "directory", "path", "pattern"};
+
+struct PHDC_Stats
+{
+  std::atomic<uint64_t> DirectoriesScanned;
+  std::atomic<uint64_t> FilesExcluded[PHD_RULE_KINDS];
+  std::atomic<uint64_t> DirectoriesExcluded[PHD_RULE_KINDS];
+  std::atomic<uint64_t> BytesRead;
+  std::atomic<uint64_t> BytesWritten;
+  std::atomic<uint64_t> OpenCalls; // CreateFile
+  std::atomic<uint64_t> EnumerateCalls; // FindFirstFileEx + FindNextFile
+  std::atomic<uint64_t> ReadCalls; // ReadFile
+  std::atomic<uint64_t> WriteCalls; // WriteFile
+  std::atomic<uint64_t> SubmitCalls; // SubmitIoRing, see IoRing backend
+  std::atomic<uint64_t> Allocations; // blocks of the scan tree, file table and path arena, see PHD_StatsAllocation
+  std::atomic<uint64_t> BytesAllocated;
+  uint64_t FileTableBytes; // PHDC_File records of the compile
+  uint64_t PathArenaBytes; // their interned paths, see PHDC_PathArena
+
+  bool RecordFiles;
+  std::mutex SlowestMutex;
+  std::vector<std::pair<double, std::pair<std::string, uint64_t>>> Slowest; // min-heap of (seconds, (name, bytes))
+};
+
+static PHDC_Stats PHD_Stats;
+
+static inline void
+PHD_StatsAdd(std::atomic<uint64_t> &_Counter, uint64_t _Value)
+{
+  _Counter.fetch_add(_Value, std::memory_order_relaxed);
+}
+
+static inline void
+PHD_StatsRead(uint64_t _Bytes)
+{
+  PHD_StatsAdd(PHD_Stats.ReadCalls, 1);
+  PHD_StatsAdd(PHD_Stats.BytesRead, _Bytes);
+}
+
+// heap blocks of the structures a compile's memory goes to (scan tree,
+// file table, path arena), counted once per directory or chunk, never per
+// allocation, and only for --stats
+static inline void
+PHD_StatsAllocation(uint64_t _Count, uint64_t _Bytes)
+{
+  if(!PHD_Stats.RecordFiles) return;
+  PHD_StatsAdd(PHD_Stats.Allocations, _Count);
+  PHD_StatsAdd(PHD_Stats.BytesAllocated, _Bytes);
+}
+
+//================================
+// PeakMemory
+// peak working set of the process
+// so far, in bytes
+//================================
+static uint64_t
+PHD_PeakMemory()
+{
+  PROCESS_MEMORY_COUNTERS Counters = {};
+  Counters.cb = sizeof(Counters);
+  if(!GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters))) return 0;
+  return (uint64_t)Counters.PeakWorkingSetSize;
+}
+
+//==========================================
+// StatsFile
+// offers one file's read/copy/compress time
+// to the PHD_STATS_SLOWEST list
+//==========================================
+static void
+PHD_StatsFile(std::string_view _Name, uint64_t _Bytes, double _Seconds)
 {
-	if(!_Input.length())
-	{
-		std::cerr << "PhragDat error: GetFileAndDirectoryList: given string empty" << std::endl;
-		return 1;
-	}
+  if(!PHD_Stats.RecordFiles) return;
+
+  typedef std::pair<double, std::pair<std::string, uint64_t>> SlowFile;
+  std::lock_guard<std::mutex> Lock(PHD_Stats.SlowestMutex);
+  std::vector<SlowFile> &Slowest = PHD_Stats.Slowest;
 
-	if(GetFileAttributesA(_Input.c_str()) != (DWORD)FILE_ATTRIBUTE_DIRECTORY)
+  if(Slowest.size() == PHD_STATS_SLOWEST)
   {
-    std::cerr << "PhragDat error: " << _Input << " is not a valid directory, please see phragdat -h for help. Aborting." << std::endl;
-    return 1;
+    if(_Seconds <= Slowest.front().first) return;
+    std::pop_heap(Slowest.begin(), Slowest.end(), std::greater<SlowFile>());
+    Slowest.pop_back();
   }
 
-	if(!_vecstrF.empty()) _vecstrF.clear();
-	if(!_vecstrD.empty()) _vecstrD.clear();
+  Slowest.push_back(SlowFile(_Seconds, std::make_pair(std::string(_Name), _Bytes)));
+  std::push_heap(Slowest.begin(), Slowest.end(), std::greater<SlowFile>());
+}
 
-  std::stringstream ss;
-  for(auto &entry : std::filesystem::directory_iterator(_Input))
+//================================
+// PHDC_Entry (Directory Entry)
+//================================
+struct PHDC_Entry
+{
+  std::string Path; // full path (directory + '/' + name)
+  size_t NameOffset; // start of name within Path
+  uint64_t Size; // file size in bytes (0 for directories)
+  uint64_t WriteTime; // last write time (FILETIME, 100ns ticks)
+  bool IsDirectory;
+};
+
+//======================================================
+// WalkDirectory
+// calls _Callback(const PHDC_Entry&) once per entry in
+// _Directory. Type and size come from the directory
+// records themselves (FindExInfoBasic with
+// FIND_FIRST_EX_LARGE_FETCH reads them in large
+// batches), so no entry is stat'd or re-parsed
+//======================================================
+template<typename Callback> static int
+PHD_WalkDirectory(const std::string &_Directory, Callback &&_Callback)
+{
+  if(!_Directory.length())
   {
-    ss << entry.path();
+    std::cerr << "PhragDat error: WalkDirectory: given string empty" << std::endl;
+    return 1;
   }
 
-  std::map<uint64_t,std::string> Paths;
-  uint64_t PathCounter = 0;
-  std::string PathStr = ss.str();
-  PathStr = PHD_EnsureSingleSlashes(PathStr);
-  bool ReadEntry = 0;
+  PHDC_Entry Entry;
+  Entry.Path = _Directory;
+  if(Entry.Path.back() != '/') Entry.Path.push_back('/');
+  Entry.NameOffset = Entry.Path.length();
 
-  // make Paths[0] the root path of current
-  Paths[0] = _Input;
+  std::string Pattern = Entry.Path;
+  Pattern.push_back('*');
 
-  // paths are contained in ""
-  for(int iPathStr=0; iPathStr<PathStr.length(); ++iPathStr)
-  {
-    if(PathStr[iPathStr] == '\"')
-    {
-      if(!ReadEntry)
-      {
-        ReadEntry = 1;
-        PathCounter++;
-        continue;
-      }
-      else
-      {
-        ReadEntry = 0;
-        continue;
-      }
-    }
+  WIN32_FIND_DATAA FindData;
+  HANDLE Find = FindFirstFileExA(Pattern.c_str(), FindExInfoBasic, &FindData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+  uint64_t EnumerateCalls = 1; // + one FindNextFile per entry
 
-    else
-    {
-      Paths[PathCounter].push_back(PathStr[iPathStr]);
-    }
+  if(Find == INVALID_HANDLE_VALUE)
+  {
+    std::cerr << "PhragDat error: unable to read directory " << _Directory << ", skipping..." << std::endl;
+    PHD_StatsAdd(PHD_Stats.EnumerateCalls, EnumerateCalls);
+    return 1;
   }
 
-  for(int iPaths=0; iPaths<Paths.size(); ++iPaths)
+  do
   {
-    DWORD ftyp = GetFileAttributesA(Paths[iPaths].c_str());
+    EnumerateCalls++;
+    const char *Name = FindData.cFileName;
+    if(Name[0] == '.' && (!Name[1] || (Name[1] == '.' && !Name[2]))) continue;
 
-    if(ftyp == INVALID_FILE_ATTRIBUTES)
-    {
-      if(DEBUG_MODE)
-      {
-        std::cout << Paths[iPaths] << " invalid attributes, skipping..." << std::endl;
-      }
-    }
+    Entry.Path.resize(Entry.NameOffset);
+    Entry.Path.append(Name);
+    Entry.IsDirectory = (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    Entry.Size = Entry.IsDirectory ? 0 : (((uint64_t)FindData.nFileSizeHigh << 32) | (uint64_t)FindData.nFileSizeLow);
+    Entry.WriteTime = ((uint64_t)FindData.ftLastWriteTime.dwHighDateTime << 32) | (uint64_t)FindData.ftLastWriteTime.dwLowDateTime;
 
-    else if(ftyp & FILE_ATTRIBUTE_DIRECTORY)
+    if(DEBUG_MODE)
     {
-      if(DEBUG_MODE)
-      {
-        std::cout << "Found Directory: " << Paths[iPaths] << std::endl;
-      }
-
-      _vecstrD.push_back(Paths[iPaths]);
+      std::cout << (Entry.IsDirectory ? "Found Directory: " : "Found File: ") << Entry.Path << std::endl;
     }
 
-    else
-    {
-      if(DEBUG_MODE)
-      {
-        std::cout << "Found File: " << Paths[iPaths] << std::endl;
-      }
-
-      _vecstrF.push_back(Paths[iPaths]);
-    }
+    _Callback(Entry);
   }
+  while(FindNextFileA(Find, &FindData));
 
-	return 0;
+  FindClose(Find);
+  PHD_StatsAdd(PHD_Stats.EnumerateCalls, EnumerateCalls);
+  PHD_StatsAdd(PHD_Stats.DirectoriesScanned, 1);
+  return 0;
 }
 
-//=======================================
-//    RemoveParentsFromPath
-// takes path, removes any parent dirs
-//=======================================
-static std::string
-PHD_RemoveParentsFromPath(std::string _Input)
+//=======================================================================
+// Exclusion rules (gitignore style), all compiled into a single DFA
+//=======================================================================
+// One rule per line of the exclusions file:
+//   name         any file or directory called name, at any depth
+//   *.ext        * matches any run of characters except '/'
+//   ?            any single character except '/'
+//   [a-z] [!a]   character classes ([^a] also negates)
+//   Directory/   a trailing '/' only matches directories
+//   /a/b  a/b    a '/' at the start or in the middle anchors the rule
+//                to the input directory
+//   **/x  a/**   ** matches any number of directories, a/**/b matches
+//   a/**/b       a/b, a/x/b, a/x/y/b...
+//   !rule        re-includes what an earlier rule excluded
+//   #comment     ignored, \ escapes the next character
+// The last rule that matches an entry decides. An excluded directory is
+// never read, so nothing below it can be re-included.
+//
+// Every rule becomes a small NFA over the entry's path relative to the
+// input ("sub/dir/file.ext"), the NFAs are merged and turned into one
+// DFA up front. Each directory remembers the DFA state reached after its
+// path + '/', so checking an entry is one table step per character of
+// its name, however many rules there are.
+#define PHD_GLOB_MAX_STATES 0x100000 // refuse rule sets that blow up past 1M states
+
+struct PHDC_ExclusionMatcher
 {
-  if(!_Input.length())
+  uint32_t Start; // state for the input directory itself
+  uint32_t Columns; // byte equivalence classes
+  uint8_t ByteColumn[256];
+  std::vector<uint32_t> Next; // [State*Columns + Column], state 0 is dead, empty if no rules
+  std::vector<int32_t> FileRule; // last rule matching a file ending in State, or -1
+  std::vector<int32_t> DirRule; // last rule matching a directory ending in State, or -1
+  std::vector<std::string> Rules;
+  std::vector<uint8_t> RuleNegated;
+  std::vector<uint8_t> RuleKind; // PHD_RULE_*, for --stats
+
+  PHDC_ExclusionMatcher() : Start(0), Columns(0) {}
+};
+
+// the NFA is built as a trie: rules with the same prefix share nodes
+// (every unanchored rule shares one "any directories" hub, all "*.ext"
+// rules share one '*' loop), which keeps the DFA subsets small
+struct PHDC_GlobNfa
+{
+  struct Edge { uint32_t Class; uint32_t Target; };
+  std::vector<std::bitset<256>> Classes;
+  std::map<std::string,uint32_t> ClassIndex; // dedupe identical classes
+  std::vector<std::vector<Edge>> Edges;
+  std::vector<std::vector<uint32_t>> Epsilon;
+  std::vector<int32_t> AcceptFile; // last rule accepting files here, or -1
+  std::vector<int32_t> AcceptDir; // last rule accepting directories here, or -1
+  std::map<std::pair<uint32_t,std::string>,uint32_t> Steps; // (node, step) -> shared node
+
+  uint32_t NewNode()
   {
-    std::cerr << "PhragDat error: RemoveParentsFromPath: given string empty" << std::endl;
-    return "";
+    Edges.push_back(std::vector<Edge>());
+    Epsilon.push_back(std::vector<uint32_t>());
+    AcceptFile.push_back(-1);
+    AcceptDir.push_back(-1);
+    return (uint32_t)AcceptFile.size() - 1;
   }
 
-  std::string Input = "/";
-  Input += _Input;
-  std::string Path;
+  uint32_t GetClass(const std::bitset<256> &_Class)
+  {
+    std::string Key = _Class.to_string();
+    std::map<std::string,uint32_t>::iterator Found = ClassIndex.find(Key);
+    if(Found != ClassIndex.end()) return Found->second;
 
-  if(Input.back()=='/')
+    Classes.push_back(_Class);
+    ClassIndex[Key] = (uint32_t)Classes.size() - 1;
+    return (uint32_t)Classes.size() - 1;
+  }
+
+  void AddEdge(uint32_t _From, const std::bitset<256> &_Class, uint32_t _To)
   {
-    Input.pop_back();
+    Edges[_From].push_back(Edge{GetClass(_Class), _To});
   }
 
-  int CharCount = 0;
-  for(int iInputLength = (int)Input.length(); iInputLength > 0; --iInputLength)
+  // returns the node for _Step from _From, creating it with _Build if new
+  template<typename Build> uint32_t Step(uint32_t _From, const std::string &_Step, Build &&_Build)
   {
-    if(Input[iInputLength]=='/')
+    std::pair<uint32_t,std::string> Key(_From, _Step);
+    std::map<std::pair<uint32_t,std::string>,uint32_t>::iterator Found = Steps.find(Key);
+    if(Found != Steps.end()) return Found->second;
+
+    uint32_t Node = _Build();
+    Steps[Key] = Node;
+    return Node;
+  }
+};
+
+// glob token: one character position of a rule
+struct PHDC_GlobToken
+{
+  enum {LITERAL, ANY, STAR, CLASS, SLASH} Type;
+  std::bitset<256> Class; // LITERAL, ANY and CLASS
+};
+
+//=====================================================
+// ParseGlob
+// splits a rule into tokens, returns 1 if it is empty
+//=====================================================
+static int
+PHD_ParseGlob(const std::string &_Rule, std::vector<PHDC_GlobToken> &_Tokens)
+{
+  std::bitset<256> NotSlash;
+  NotSlash.set();
+  NotSlash.reset('/');
+
+  for(size_t iChar = 0; iChar < _Rule.length(); ++iChar)
+  {
+    PHDC_GlobToken Token;
+    char c = _Rule[iChar];
+
+    if(c == '\\' && iChar+1 < _Rule.length())
     {
-      break;
+      Token.Type = PHDC_GlobToken::LITERAL;
+      Token.Class.set((uint8_t)_Rule[++iChar]);
     }
 
-    else
+    else if(c == '/') Token.Type = PHDC_GlobToken::SLASH;
+    else if(c == '*') Token.Type = PHDC_GlobToken::STAR;
+
+    else if(c == '?')
     {
-      CharCount++;
+      Token.Type = PHDC_GlobToken::ANY;
+      Token.Class = NotSlash;
     }
-  }
 
-  for(int iPathChar = ( ((int)Input.length()) - CharCount ); iPathChar < (int)Input.length(); ++iPathChar)
-  {
-    if(Input[iPathChar]!='/')
+    else if(c == '[' && _Rule.find(']', iChar+2) != std::string::npos)
     {
-      Path.push_back(Input[iPathChar]);
-    }
-  }
+      size_t iClass = iChar+1;
+      bool Negate = (_Rule[iClass] == '!' || _Rule[iClass] == '^');
+      if(Negate) iClass++;
 
-  if(Path[0] == '/')
-  {
-    std::string Path2 = Path;
-    Path.clear();
+      // a ']' straight after the '[' is part of the class
+      bool First = 1;
+      while(iClass < _Rule.length() && (_Rule[iClass] != ']' || First))
+      {
+        uint8_t Low = (uint8_t)_Rule[iClass];
+        if(Low == '\\' && iClass+1 < _Rule.length()) Low = (uint8_t)_Rule[++iClass];
+        uint8_t High = Low;
 
-    for(int iPath2Char = 1; iPath2Char < (int)Path2.length(); iPath2Char++)
+        if(iClass+2 < _Rule.length() && _Rule[iClass+1] == '-' && _Rule[iClass+2] != ']')
+        {
+          High = (uint8_t)_Rule[iClass+2];
+          iClass += 2;
+        }
+
+        for(int iByte = Low; iByte <= High; ++iByte) Token.Class.set(iByte);
+        iClass++;
+        First = 0;
+      }
+
+      if(iClass >= _Rule.length())
+      {
+        // never closed, take the '[' literally
+        Token.Type = PHDC_GlobToken::LITERAL;
+        Token.Class.reset();
+        Token.Class.set('[');
+      }
+
+      else
+      {
+        Token.Type = PHDC_GlobToken::CLASS;
+        if(Negate) Token.Class.flip();
+        Token.Class.reset('/');
+        iChar = iClass;
+      }
+    }
+
+    else
     {
-      Path.push_back(Path2[iPath2Char]);
+      Token.Type = PHDC_GlobToken::LITERAL;
+      Token.Class.set((uint8_t)c);
     }
+
+    _Tokens.push_back(Token);
   }
 
-  return Path;
+  return _Tokens.empty() ? 1 : 0;
 }
 
-/* Function not currently being used
-//====================================
-//    RemovePathFromParents
-// takes path, returns only parents
-//====================================
-static std::string
-PHD_RemovePathFromParents(std::string _Input)
+//===============================================
+// AddGlobRule
+// builds the NFA for one rule from _Start
+// returns 1 if the rule has nothing to match
+//===============================================
+static int
+PHD_AddGlobRule(PHDC_GlobNfa &_Nfa, uint32_t _Start, std::string _Rule, int32_t _RuleIndex)
 {
-  if(!_Input.length())
+  std::vector<PHDC_GlobToken> Tokens;
+  if(PHD_ParseGlob(_Rule, Tokens)) return 1;
+
+  bool DirOnly = 0;
+  while(Tokens.size() && Tokens.back().Type == PHDC_GlobToken::SLASH)
   {
-    std::cerr << "PhragDat error: RemovePathFromParents: given string empty" << std::endl;
-    return "";
+    Tokens.pop_back();
+    DirOnly = 1;
   }
 
-  std::string Input = "/";
-  Input += _Input;
-  std::string Path;
-
-  if(Input.back()=='/')
+  bool Anchored = 0;
+  while(Tokens.size() && Tokens[0].Type == PHDC_GlobToken::SLASH)
   {
-    Input.pop_back();
+    Tokens.erase(Tokens.begin());
+    Anchored = 1;
   }
 
-  int CharCount = 0;
-  for(int iInputLen = (int)Input.length(); iInputLen > 0; --iInputLen)
-  {
-    if(Input[iInputLen]=='/')
-    {
-      break;
-    }
+  if(Tokens.empty()) return 1;
 
-    else
+  // split into path components
+  std::vector<std::vector<PHDC_GlobToken>> Components(1);
+  for(size_t iToken = 0; iToken < Tokens.size(); ++iToken)
+  {
+    if(Tokens[iToken].Type == PHDC_GlobToken::SLASH)
     {
-      CharCount++;
+      Anchored = 1;
+      if(Components.back().size()) Components.push_back(std::vector<PHDC_GlobToken>());
     }
+    else Components.back().push_back(Tokens[iToken]);
   }
 
-  for(int iInputChar = 0; iInputChar < (((int)Input.length()) - CharCount); ++iInputChar)
+  std::bitset<256> Any;
+  Any.set();
+  std::bitset<256> NotSlash = Any;
+  NotSlash.reset('/');
+  std::bitset<256> Slash;
+  Slash.set('/');
+
+  uint32_t Current = _Start;
+
+  // "(component/)*": zero or more whole directories
+  auto AddAnyDirectories = [&]()
   {
-    Path.push_back(Input[iInputChar]);
-  }
+    uint32_t From = Current;
+    Current = _Nfa.Step(From, "**/", [&]()
+    {
+      uint32_t Hub = _Nfa.NewNode();
+      uint32_t InName = _Nfa.NewNode();
+      _Nfa.Epsilon[From].push_back(Hub);
+      _Nfa.AddEdge(Hub, NotSlash, InName);
+      _Nfa.AddEdge(InName, NotSlash, InName);
+      _Nfa.AddEdge(InName, Slash, Hub);
+      return Hub;
+    });
+  };
+
+  auto AddLoop = [&](const char *_Key, const std::bitset<256> &_Class)
+  {
+    uint32_t From = Current;
+    Current = _Nfa.Step(From, _Key, [&]()
+    {
+      uint32_t Loop = _Nfa.NewNode();
+      _Nfa.Epsilon[From].push_back(Loop);
+      _Nfa.AddEdge(Loop, _Class, Loop);
+      return Loop;
+    });
+  };
+
+  auto AddClass = [&](const std::bitset<256> &_Class)
+  {
+    uint32_t From = Current;
+    Current = _Nfa.Step(From, _Class.to_string(), [&]()
+    {
+      uint32_t Next = _Nfa.NewNode();
+      _Nfa.AddEdge(From, _Class, Next);
+      return Next;
+    });
+  };
 
-  if(Path[0] == '/')
+  // unanchored rules match at any depth
+  if(!Anchored) AddAnyDirectories();
+
+  for(size_t iComponent = 0; iComponent < Components.size(); ++iComponent)
   {
-    std::string Path2 = Path;
-    Path.clear();
+    std::vector<PHDC_GlobToken> &Component = Components[iComponent];
+    bool Last = (iComponent+1 == Components.size());
 
-    for(int iPath2Char = 1; iPath2Char < (int)Path2.length(); ++iPath2Char)
+    if(Component.size() == 2 && Component[0].Type == PHDC_GlobToken::STAR && Component[1].Type == PHDC_GlobToken::STAR)
     {
-      Path.push_back(Path2[iPath2Char]);
+      // "**/" in front or in the middle, trailing "**" is everything inside
+      if(!Last) AddAnyDirectories();
+      else AddLoop("**", Any);
+      continue;
+    }
+
+    for(size_t iToken = 0; iToken < Component.size(); ++iToken)
+    {
+      if(Component[iToken].Type == PHDC_GlobToken::STAR)
+      {
+        // a run of '*' inside a name is one '*'
+        if(iToken && Component[iToken-1].Type == PHDC_GlobToken::STAR) continue;
+        AddLoop("*", NotSlash);
+      }
+
+      else AddClass(Component[iToken].Class);
     }
+
+    if(!Last) AddClass(Slash);
   }
 
-  return Path;
-}*/
+  // later rules win, so the highest index is kept
+  if(_RuleIndex > _Nfa.AcceptDir[Current]) _Nfa.AcceptDir[Current] = _RuleIndex;
+  if(!DirOnly && _RuleIndex > _Nfa.AcceptFile[Current]) _Nfa.AcceptFile[Current] = _RuleIndex;
+  return 0;
+}
 
-//================================
-// PHDC_File (Input File Info)
-//================================
-struct PHDC_File
+//=============================================
+// RuleKind
+// PHD_RULE_* of a rule without its leading '!'
+//=============================================
+static uint8_t
+PHD_RuleKind(const std::string &_Rule)
 {
-  std::string InputPath; // full file path for input
-  std::string DatPath; // path relative to .dat for contents
-  uint64_t Address; // address inside .dat
-  uint64_t Length; // file size in bytes
-};
+  size_t Slash = _Rule.find('/');
+  if(_Rule.find("**") != std::string::npos || (Slash != std::string::npos && Slash+1 < _Rule.length())) return PHD_RULE_PATH;
+  if(Slash != std::string::npos) return PHD_RULE_DIRECTORY;
+  if(_Rule.length() > 2 && _Rule[0] == '*' && _Rule[1] == '.' && _Rule.find_first_of("*?[\\", 1) == std::string::npos) return PHD_RULE_EXTENSION;
+  if(_Rule.find_first_of("*?[") == std::string::npos) return PHD_RULE_NAME;
+  return PHD_RULE_PATTERN;
+}
 
-//================================
-//    PHD_COMPILE
-//================================
+//================================================
+// CompileExclusions
+// builds the DFA for _Rules (in file order)
+// returns 0 on success
+//================================================
 static int
-PHD_COMPILE(std::string _Input,
-            std::string _DatPath,
-            std::string _CPath,
-            std::string _Exclusions)
+PHD_CompileExclusions(const std::vector<std::string> &_Rules, PHDC_ExclusionMatcher *_Matcher)
 {
-  // check input strings
-  if(!_Input.length() || !_DatPath.length() || !_CPath.length())
+  PHDC_GlobNfa Nfa;
+  uint32_t NfaStart = Nfa.NewNode();
+
+  for(size_t iRule = 0; iRule < _Rules.size(); ++iRule)
   {
-    std::cerr << "PhragDat Error: invalid input, see phragdat -h for help" << std::endl;
-    return 1;
+    std::string Rule = _Rules[iRule];
+    bool Negated = 0;
+
+    if(Rule.length() && Rule[0] == '#') continue;
+    if(Rule.length() && Rule[0] == '!')
+    {
+      Negated = 1;
+      Rule.erase(0, 1);
+    }
+
+    // trailing spaces are ignored unless escaped
+    while(Rule.length() && (Rule.back() == ' ' || Rule.back() == '\t') &&
+          !(Rule.length() > 1 && Rule[Rule.length()-2] == '\\')) Rule.pop_back();
+
+    if(PHD_AddGlobRule(Nfa, NfaStart, Rule, (int32_t)_Matcher->Rules.size())) continue;
+
+    _Matcher->Rules.push_back(_Rules[iRule]);
+    _Matcher->RuleNegated.push_back(Negated);
+    _Matcher->RuleKind.push_back(PHD_RuleKind(Rule));
   }
 
-  // check inputs are valid directories
+  if(_Matcher->Rules.empty()) return 0;
+
+  // bytes that no class tells apart share a column
   {
-    DWORD ftyp = GetFileAttributesA(_Input.c_str());
-    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    std::map<std::vector<bool>,uint8_t> Signatures;
+    for(int iByte = 0; iByte < 256; ++iByte)
     {
-      std::cerr << "PhragDat error: " << _Input << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
-      if(DEBUG_MODE) {std::cout << "ftyp reads: " << (int)ftyp << std::endl;}
-      return 1;
+      std::vector<bool> Signature(Nfa.Classes.size());
+      for(size_t iClass = 0; iClass < Nfa.Classes.size(); ++iClass) Signature[iClass] = Nfa.Classes[iClass][iByte];
+
+      std::map<std::vector<bool>,uint8_t>::iterator Found = Signatures.find(Signature);
+      if(Found == Signatures.end())
+      {
+        uint8_t Column = (uint8_t)Signatures.size();
+        Signatures[Signature] = Column;
+        _Matcher->ByteColumn[iByte] = Column;
+      }
+      else _Matcher->ByteColumn[iByte] = Found->second;
     }
+    _Matcher->Columns = (uint32_t)Signatures.size();
   }
 
+  std::vector<uint8_t> ColumnByte(_Matcher->Columns);
+  for(int iByte = 255; iByte >= 0; --iByte) ColumnByte[_Matcher->ByteColumn[iByte]] = (uint8_t)iByte;
+
+  std::vector<uint32_t> SeenMark(Nfa.AcceptFile.size(), 0);
+  uint32_t SeenGeneration = 0;
+
+  auto Closure = [&](std::vector<uint32_t> &_Set)
   {
-    DWORD ftyp = GetFileAttributesA(_DatPath.c_str());
-    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    SeenGeneration++;
+    std::vector<uint32_t> Stack = _Set;
+    for(size_t iNode = 0; iNode < _Set.size(); ++iNode) SeenMark[_Set[iNode]] = SeenGeneration;
+
+    while(Stack.size())
     {
-      std::cerr << "PhragDat error: " << _DatPath << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
-      if(DEBUG_MODE) {std::cout << "ftyp reads: " << (int)ftyp << std::endl;}
-      return 1;
+      uint32_t Node = Stack.back();
+      Stack.pop_back();
+      for(size_t iEpsilon = 0; iEpsilon < Nfa.Epsilon[Node].size(); ++iEpsilon)
+      {
+        uint32_t Target = Nfa.Epsilon[Node][iEpsilon];
+        if(SeenMark[Target] != SeenGeneration)
+        {
+          SeenMark[Target] = SeenGeneration;
+          _Set.push_back(Target);
+          Stack.push_back(Target);
+        }
+      }
     }
-  }
 
+    std::sort(_Set.begin(), _Set.end());
+  };
+
+  // columns each class accepts, so edges are visited once per state
+  std::vector<std::vector<uint32_t>> ClassColumns(Nfa.Classes.size());
+  for(size_t iClass = 0; iClass < Nfa.Classes.size(); ++iClass)
   {
-    DWORD ftyp = GetFileAttributesA(_CPath.c_str());
-    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    for(uint32_t iColumn = 0; iColumn < _Matcher->Columns; ++iColumn)
     {
-      std::cerr << "PhragDat error: " << _CPath << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
-      if(DEBUG_MODE) {std::cout << "ftyp reads: " << (int)ftyp << std::endl;}
-      return 1;
+      if(Nfa.Classes[iClass][ColumnByte[iColumn]]) ClassColumns[iClass].push_back(iColumn);
     }
   }
 
-  // output dat info
-  std::string Dat_OutputPath; // full path & name
-  std::string Dat_OutputName; // path minus parent dirs
-  std::string Dat_SimpleName; // name with no path or ext
-  std::string C_OutputPath; // full path & name
+  // subset construction, state 0 is the dead (empty) state
+  std::map<std::vector<uint32_t>,uint32_t> StateIds;
+  std::vector<std::vector<uint32_t>> States;
+  States.push_back(std::vector<uint32_t>());
+  StateIds[States[0]] = 0;
 
-  Dat_OutputPath = _DatPath;
-  std::filesystem::path p(_DatPath);
-  Dat_OutputName = p.filename().string();
+  std::vector<uint32_t> StartSet(1, NfaStart);
+  Closure(StartSet);
+  States.push_back(StartSet);
+  StateIds[StartSet] = 1;
+  _Matcher->Start = 1;
 
-  Dat_OutputName = _Input;
-  if(Dat_OutputName.back()=='/') {Dat_OutputName.pop_back();}
-  Dat_OutputName.append(".dat");
-  Dat_OutputName = PHD_RemoveParentsFromPath(Dat_OutputName);
+  for(size_t iState = 0; iState < States.size(); ++iState)
+  {
+    int32_t FileRule = -1;
+    int32_t DirRule = -1;
+    std::vector<std::vector<uint32_t>> NextSets(_Matcher->Columns);
 
-  Dat_OutputPath = _DatPath;
-  if(Dat_OutputPath.back()!='/') {Dat_OutputPath.push_back('/');}
-  Dat_OutputPath.append(Dat_OutputName);
+    for(size_t iNode = 0; iNode < States[iState].size(); ++iNode)
+    {
+      uint32_t Node = States[iState][iNode];
+      if(Nfa.AcceptFile[Node] > FileRule) FileRule = Nfa.AcceptFile[Node];
+      if(Nfa.AcceptDir[Node] > DirRule) DirRule = Nfa.AcceptDir[Node];
 
-  Dat_SimpleName = Dat_OutputName;
-  for(int i=0; i<4; i++) {Dat_SimpleName.pop_back();}
-  for(int i=0; i<Dat_SimpleName.length(); i++) { if(Dat_SimpleName[i]==' ') {Dat_SimpleName[i] = '_';} }
+      for(size_t iEdge = 0; iEdge < Nfa.Edges[Node].size(); ++iEdge)
+      {
+        const PHDC_GlobNfa::Edge &Edge = Nfa.Edges[Node][iEdge];
+        for(size_t iColumn = 0; iColumn < ClassColumns[Edge.Class].size(); ++iColumn)
+        {
+          NextSets[ClassColumns[Edge.Class][iColumn]].push_back(Edge.Target);
+        }
+      }
+    }
 
-  C_OutputPath = _CPath;
-  if(C_OutputPath.back() != '/') {C_OutputPath.push_back('/');}
-  C_OutputPath.append(Dat_SimpleName);
-  C_OutputPath.append(".csv");
+    _Matcher->FileRule.push_back(FileRule);
+    _Matcher->DirRule.push_back(DirRule);
 
-  // OutputDat DEBUG report
-  if(DEBUG_MODE) {std::cout << "Dat_OutputPath: " << Dat_OutputPath << "\nDat_OutputName: " << Dat_OutputName << std::endl;}
+    for(uint32_t iColumn = 0; iColumn < _Matcher->Columns; ++iColumn)
+    {
+      std::vector<uint32_t> &NextSet = NextSets[iColumn];
+      std::sort(NextSet.begin(), NextSet.end());
+      NextSet.erase(std::unique(NextSet.begin(), NextSet.end()), NextSet.end());
+      Closure(NextSet);
+
+      uint32_t NextState;
+      std::map<std::vector<uint32_t>,uint32_t>::iterator Found = StateIds.find(NextSet);
+      if(Found != StateIds.end()) NextState = Found->second;
+      else
+      {
+        if(States.size() >= PHD_GLOB_MAX_STATES)
+        {
+          std::cerr << "PhragDat error: exclusion rules are too complex to compile, aborting." << std::endl;
+          return 1;
+        }
+
+        NextState = (uint32_t)States.size();
+        StateIds[NextSet] = NextState;
+        States.push_back(NextSet);
+      }
+
+      _Matcher->Next.push_back(NextState);
+    }
+  }
+
+  if(DEBUG_MODE) {std::cout << "Exclusions compiled: " << _Matcher->Rules.size() << " rules, " << States.size() << " states, " << _Matcher->Columns << " columns" << std::endl;}
+
+  return 0;
+}
+
+//===================================
+// GlobStep
+// advances _State over _Text
+//===================================
+static uint32_t
+PHD_GlobStep(const PHDC_ExclusionMatcher &_Matcher, uint32_t _State, std::string_view _Text)
+{
+  const uint32_t *Next = _Matcher.Next.data();
+  uint32_t Columns = _Matcher.Columns;
+
+  for(size_t iChar = 0; _State && iChar < _Text.length(); ++iChar)
+  {
+    _State = Next[_State*Columns + _Matcher.ByteColumn[(uint8_t)_Text[iChar]]];
+  }
+
+  return _State;
+}
+
+static bool
+PHD_GlobExcludes(const PHDC_ExclusionMatcher &_Matcher, uint32_t _State, bool _IsDirectory)
+{
+  if(!_State) return 0;
+  int32_t Rule = _IsDirectory ? _Matcher.DirRule[_State] : _Matcher.FileRule[_State];
+  return Rule >= 0 && !_Matcher.RuleNegated[Rule];
+}
+
+//==================================================
+// PHDC_ScanFile (one file of a scanned directory)
+// the name is NameLength bytes at NameOffset in its
+// node's Names, so a directory costs the same two
+// allocations however many files it holds
+//==================================================
+struct PHDC_ScanFile
+{
+  uint32_t NameOffset;
+  uint32_t NameLength;
+  uint64_t Size; // file size in bytes
+  uint64_t WriteTime; // last write time (FILETIME, 100ns ticks)
+};
+
+//==================================================
+// PHDC_ScanNode (one scanned directory)
+// files and subdirectories are sorted by name so
+// the layout never depends on enumeration order
+// or on which thread scanned the directory
+//==================================================
+struct PHDC_ScanNode
+{
+  std::string Path;
+  uint32_t MatchState; // exclusion DFA state after "Path/"
+  std::string Names; // file names back to back
+  std::vector<PHDC_ScanFile> Files;
+  std::vector<std::unique_ptr<PHDC_ScanNode>> Children;
+};
+
+static inline std::string_view
+PHD_ScanFileName(const PHDC_ScanNode *_Node, const PHDC_ScanFile &_File)
+{
+  return std::string_view(_Node->Names).substr(_File.NameOffset, _File.NameLength);
+}
 
-  std::map<uint64_t, PHDC_File> MasterFileList;
-  std::vector<std::string> MasterDirectoryList;
-  uint64_t NewFileUID = 0;
-  uint64_t CurrentDirectory = 0;
+static bool
+PHD_NodeLess(const std::unique_ptr<PHDC_ScanNode> &_A, const std::unique_ptr<PHDC_ScanNode> &_B)
+{
+  return _A->Path < _B->Path;
+}
 
-  // Populate Exclusions lists
-  std::vector<std::string> FileExclusions;
-  std::vector<std::string> ExtExclusions;
-  std::vector<std::string> DirExclusions;
+//===============================================
+// ScanNode
+// enumerates _Node->Path, applies exclusions,
+// fills Files and creates (unscanned) Children
+//===============================================
+static void
+PHD_ScanNode(PHDC_ScanNode *_Node, const PHDC_ExclusionMatcher &_Exclusions)
+{
+  std::vector<PHDC_ScanFile> FileList;
+  std::string Names;
 
-  if(_Exclusions.length())
+  // excluded entries are dropped as they are enumerated, so excluded
+  // directories are never queued and their contents never read
+  PHD_WalkDirectory(_Node->Path, [&](const PHDC_Entry &_Entry)
   {
-    std::string ExcludeStr;
-    std::ifstream ExclusionFile;
+    std::string_view Name(&_Entry.Path[_Entry.NameOffset], _Entry.Path.length() - _Entry.NameOffset);
+    uint32_t State = PHD_GlobStep(_Exclusions, _Node->MatchState, Name);
 
-    ExclusionFile.open(_Exclusions, std::ios::in | std::ios::binary);
-    if(ExclusionFile.is_open())
+    if(PHD_GlobExcludes(_Exclusions, State, _Entry.IsDirectory))
     {
-      std::cout << "Found exclusion list, importing..." << std::endl;
-      char c;
-      while(ExclusionFile.get(c))
+      if(DEBUG_MODE) {std::cout << "Removing exception: " << _Entry.Path << std::endl;}
+      int32_t Rule = _Entry.IsDirectory ? _Exclusions.DirRule[State] : _Exclusions.FileRule[State];
+      PHD_StatsAdd((_Entry.IsDirectory ? PHD_Stats.DirectoriesExcluded : PHD_Stats.FilesExcluded)[_Exclusions.RuleKind[Rule]], 1);
+      return;
+    }
+
+    if(_Entry.IsDirectory)
+    {
+      _Node->Children.push_back(std::unique_ptr<PHDC_ScanNode>(new PHDC_ScanNode()));
+      _Node->Children.back()->Path = _Entry.Path;
+      _Node->Children.back()->MatchState = PHD_GlobStep(_Exclusions, State, "/");
+    }
+
+    else
+    {
+      PHDC_ScanFile File;
+      File.NameOffset = (uint32_t)Names.length();
+      File.NameLength = (uint32_t)Name.length();
+      File.Size = _Entry.Size;
+      File.WriteTime = _Entry.WriteTime;
+      FileList.push_back(File);
+      Names += Name;
+    }
+  });
+
+  // the directory is the same for every file, so names sort as the full paths did
+  std::string_view NamesView(Names);
+  std::sort(FileList.begin(), FileList.end(), [&](const PHDC_ScanFile &_A, const PHDC_ScanFile &_B)
+  {
+    return NamesView.substr(_A.NameOffset, _A.NameLength) < NamesView.substr(_B.NameOffset, _B.NameLength);
+  });
+  std::sort(_Node->Children.begin(), _Node->Children.end(), PHD_NodeLess);
+
+  _Node->Files = std::move(FileList);
+  _Node->Names = std::move(Names);
+
+  // the node itself and the three buffers it keeps
+  PHD_StatsAllocation(1 + !_Node->Files.empty() + !_Node->Names.empty() + !_Node->Children.empty(), sizeof(PHDC_ScanNode)
+  + _Node->Files.capacity() * sizeof(PHDC_ScanFile) + _Node->Names.capacity() + _Node->Children.capacity() * sizeof(_Node->Children[0]));
+}
+
+//================================
+// ScanTreeSerial
+// breadth first, one thread
+//================================
+static std::unique_ptr<PHDC_ScanNode>
+PHD_ScanTreeSerial(std::string _Input, const PHDC_ExclusionMatcher &_Exclusions)
+{
+  std::unique_ptr<PHDC_ScanNode> Root(new PHDC_ScanNode());
+  Root->Path = _Input;
+  Root->MatchState = _Exclusions.Start;
+
+  std::vector<PHDC_ScanNode*> Queue;
+  Queue.push_back(Root.get());
+
+  for(size_t iNode = 0; iNode < Queue.size(); ++iNode)
+  {
+    PHD_ScanNode(Queue[iNode], _Exclusions);
+    for(size_t iChild = 0; iChild < Queue[iNode]->Children.size(); ++iChild)
+    {
+      Queue.push_back(Queue[iNode]->Children[iChild].get());
+    }
+  }
+
+  return Root;
+}
+
+//======================================================
+// ScanTreeParallel
+// _Threads workers, each with its own deque of
+// directories: the owner pushes and pops at the back
+// (depth first, warm caches), idle workers steal from
+// the front of the others and sleep when every deque
+// is empty. The tree that comes out is identical to
+// ScanTreeSerial's.
+//======================================================
+struct PHDC_ScanDeque
+{
+  std::mutex Mutex;
+  std::deque<PHDC_ScanNode*> Nodes;
+};
+
+static std::unique_ptr<PHDC_ScanNode>
+PHD_ScanTreeParallel(std::string _Input, const PHDC_ExclusionMatcher &_Exclusions, int _Threads)
+{
+  std::unique_ptr<PHDC_ScanNode> Root(new PHDC_ScanNode());
+  Root->Path = _Input;
+  Root->MatchState = _Exclusions.Start;
+
+  std::vector<std::unique_ptr<PHDC_ScanDeque>> Deques;
+  for(int iThread = 0; iThread < _Threads; ++iThread)
+  {
+    Deques.push_back(std::unique_ptr<PHDC_ScanDeque>(new PHDC_ScanDeque()));
+  }
+
+  // directories queued or being scanned, workers exit when it hits 0
+  std::atomic<int64_t> Pending(1);
+  std::atomic<int64_t> Queued(1); // directories in the deques
+  Deques[0]->Nodes.push_back(Root.get());
+
+  // a worker that finds nothing to steal waits for a push (or the end) instead of spinning,
+  // Idle lets pushes skip the lock while every worker is busy: Queued is raised before Idle
+  // is read and Idle before Queued is checked, so one of the two always sees the other
+  std::mutex IdleMutex;
+  std::condition_variable WorkReady;
+  std::atomic<int> Idle(0);
+
+  auto Worker = [&](int _Thread)
+  {
+    PHDC_ScanDeque *Own = Deques[_Thread].get();
+
+    while(Pending > 0)
+    {
+      PHDC_ScanNode *Node = 0;
+
       {
-        if(c == '\n')
+        std::lock_guard<std::mutex> Lock(Own->Mutex);
+        if(!Own->Nodes.empty())
         {
-          if(ExcludeStr[0]=='*') ExtExclusions.push_back(ExcludeStr);
-          else if(ExcludeStr.back()=='/') DirExclusions.push_back(ExcludeStr);
-          else FileExclusions.push_back(ExcludeStr);
-          ExcludeStr.clear();
+          Node = Own->Nodes.back();
+          Own->Nodes.pop_back();
+          Queued--;
         }
-        else ExcludeStr.push_back(c);
       }
 
-      if(ExcludeStr.length())
+      for(int iVictim = 1; !Node && iVictim < _Threads; ++iVictim)
       {
-        if(ExcludeStr[0]=='*') ExtExclusions.push_back(ExcludeStr);
-        else if(ExcludeStr.back()=='/') DirExclusions.push_back(ExcludeStr);
-        else FileExclusions.push_back(ExcludeStr);
-        ExcludeStr.clear();
+        PHDC_ScanDeque *Victim = Deques[(_Thread + iVictim) % _Threads].get();
+        std::lock_guard<std::mutex> Lock(Victim->Mutex);
+        if(!Victim->Nodes.empty())
+        {
+          Node = Victim->Nodes.front();
+          Victim->Nodes.pop_front();
+          Queued--;
+        }
       }
 
-      ExclusionFile.close();
-
-      // report to user
-      for(int i=0; i<FileExclusions.size(); i++) {std::cout << "Adding File exclusion: " << FileExclusions[i] << std::endl;}
-      for(int i=0; i<ExtExclusions.size(); i++) {std::cout << "Adding Extension exclusion: " << ExtExclusions[i] << std::endl;}
-      for(int i=0; i<DirExclusions.size(); i++) {std::cout << "Adding Directory exclusion: " << DirExclusions[i] << std::endl;}
+      if(!Node)
+      {
+        std::unique_lock<std::mutex> Lock(IdleMutex);
+        Idle++;
+        WorkReady.wait(Lock, [&] {return Queued > 0 || Pending <= 0;});
+        Idle--;
+        continue;
+      }
 
-      // fix exclusion strings for string matching:
+      PHD_ScanNode(Node, _Exclusions);
 
-      // remove * from Ext (this is just for denoting exception type)
-      for(int iExclusion = 0; iExclusion < ExtExclusions.size(); ++iExclusion)
+      if(Node->Children.size())
       {
-        std::string Str;
-
-        for(int iChar = 0; iChar < ExtExclusions[iExclusion].length(); ++iChar)
+        Pending += (int64_t)Node->Children.size();
         {
-          if(ExtExclusions[iExclusion][iChar]!='*')
+          std::lock_guard<std::mutex> Lock(Own->Mutex);
+          for(size_t iChild = Node->Children.size(); iChild > 0; --iChild)
           {
-            Str.push_back(ExtExclusions[iExclusion][iChar]);
+            Own->Nodes.push_back(Node->Children[iChild-1].get());
           }
         }
 
-        ExtExclusions[iExclusion].clear();
-        ExtExclusions[iExclusion] = Str;
+        Queued += (int64_t)Node->Children.size();
+        if(Idle > 0)
+        {
+          std::lock_guard<std::mutex> Lock(IdleMutex);
+          WorkReady.notify_all();
+        }
       }
 
-      // remove '/' from directory end (this is just for denoting exception type)
-      for(int iChar = 0; iChar < DirExclusions.size(); ++iChar)
+      if(--Pending == 0)
       {
-        if(DirExclusions[iChar].back() == '/')
-        {
-          DirExclusions[iChar].pop_back();
-        }
+        std::lock_guard<std::mutex> Lock(IdleMutex);
+        WorkReady.notify_all();
       }
+    }
+  };
+
+  std::vector<std::thread> Workers;
+  for(int iThread = 0; iThread < _Threads; ++iThread)
+  {
+    Workers.push_back(std::thread(Worker, iThread));
+  }
+
+  for(int iThread = 0; iThread < _Threads; ++iThread)
+  {
+    Workers[iThread].join();
+  }
+
+  return Root;
+}
+
+//=======================================
+//    RemoveParentsFromPath
+// takes path, removes any parent dirs
+//=======================================
+static std::string
+PHD_RemoveParentsFromPath(std::string _Input)
+{
+  if(!_Input.length())
+  {
+    std::cerr << "PhragDat error: RemoveParentsFromPath: given string empty" << std::endl;
+    return "";
+  }
+
+  std::string Input = "/";
+  Input += _Input;
+  std::string Path;
+
+  if(Input.back()=='/')
+  {
+    Input.pop_back();
+  }
 
-      // remove pesky carriage returns from windows encoded text
-      for(int i=0; i<FileExclusions.size(); i++) if(FileExclusions[i].back()==0xd) FileExclusions[i].pop_back();
-      for(int i=0; i<ExtExclusions.size(); i++) if(ExtExclusions[i].back()==0xd) ExtExclusions[i].pop_back();
-      for(int i=0; i<DirExclusions.size(); i++) if(DirExclusions[i].back()==0xd) DirExclusions[i].pop_back();
+  int CharCount = 0;
+  for(int iInputLength = (int)Input.length(); iInputLength > 0; --iInputLength)
+  {
+    if(Input[iInputLength]=='/')
+    {
+      break;
     }
 
-    else //ExclusionFile didnt open
+    else
     {
-      std::cerr << "Unable to open Exclusions list, ignoring and continuing" << std::endl;
+      CharCount++;
     }
   }
 
-  // AddressCounter
-  uint64_t AddressCounter = 8;
+  for(int iPathChar = ( ((int)Input.length()) - CharCount ); iPathChar < (int)Input.length(); ++iPathChar)
+  {
+    if(Input[iPathChar]!='/')
+    {
+      Path.push_back(Input[iPathChar]);
+    }
+  }
 
-  // root directory
-  MasterDirectoryList.push_back(_Input);
+  if(Path[0] == '/')
+  {
+    std::string Path2 = Path;
+    Path.clear();
+
+    for(int iPath2Char = 1; iPath2Char < (int)Path2.length(); iPath2Char++)
+    {
+      Path.push_back(Path2[iPath2Char]);
+    }
+  }
+
+  return Path;
+}
 
-  // loop per directory
-  bool doGetDirList = 1;
-  while(doGetDirList)
+/* Function not currently being used
+//====================================
+//    RemovePathFromParents
+// takes path, returns only parents
+//====================================
+static std::string
+PHD_RemovePathFromParents(std::string _Input)
+{
+  if(!_Input.length())
   {
-    std::vector<std::string> FileList;
-    std::vector<std::string> DirectoryList;
+    std::cerr << "PhragDat error: RemovePathFromParents: given string empty" << std::endl;
+    return "";
+  }
 
-    PHD_GetFileAndDirectoryList(MasterDirectoryList[CurrentDirectory], FileList, DirectoryList);
+  std::string Input = "/";
+  Input += _Input;
+  std::string Path;
+
+  if(Input.back()=='/')
+  {
+    Input.pop_back();
+  }
 
-    // File Exclusions
-    for(int iExclusion = 0; iExclusion < FileExclusions.size(); ++iExclusion)
+  int CharCount = 0;
+  for(int iInputLen = (int)Input.length(); iInputLen > 0; --iInputLen)
+  {
+    if(Input[iInputLen]=='/')
     {
-      std::vector<std::string>::iterator iFileList = FileList.begin();
-      while(iFileList != FileList.end())
-      {
-        if((*iFileList).find(FileExclusions[iExclusion]) != std::string::npos)
-        {
-          if(DEBUG_MODE) {std::cout << "Removing exception: " << (*iFileList) << std::endl;}
+      break;
+    }
 
-          iFileList = FileList.erase(iFileList);
-        }
-        else iFileList++;
-      }
+    else
+    {
+      CharCount++;
     }
+  }
+
+  for(int iInputChar = 0; iInputChar < (((int)Input.length()) - CharCount); ++iInputChar)
+  {
+    Path.push_back(Input[iInputChar]);
+  }
+
+  if(Path[0] == '/')
+  {
+    std::string Path2 = Path;
+    Path.clear();
 
-    // Ext Exclusions
-    for(int iExclusion = 0; iExclusion < ExtExclusions.size(); ++iExclusion)
+    for(int iPath2Char = 1; iPath2Char < (int)Path2.length(); ++iPath2Char)
     {
-      std::vector<std::string>::iterator iFileList = FileList.begin();
-      while(iFileList != FileList.end())
-      {
-        bool erase = 0;
-        size_t pos = (*iFileList).find(ExtExclusions[iExclusion]);
+      Path.push_back(Path2[iPath2Char]);
+    }
+  }
 
-        if(pos != std::string::npos)
-        {
-          // make sure found .ext is at end of filename
-          if(pos == ((*iFileList).length()) - (ExtExclusions[iExclusion].length()))
-          {
-            erase = 1;
-          }
-        }
+  return Path;
+}*/
+
+//================================
+// GetSeconds
+// high resolution timer
+//================================
+static double
+PHD_GetSeconds()
+{
+  static LARGE_INTEGER Frequency = {};
+  if(!Frequency.QuadPart) QueryPerformanceFrequency(&Frequency);
+
+  LARGE_INTEGER Counter;
+  QueryPerformanceCounter(&Counter);
+  return (double)Counter.QuadPart / (double)Frequency.QuadPart;
+}
+
+//================================
+// GetMBPerSecond
+// throughput for reporting
+//================================
+static double
+PHD_GetMBPerSecond(uint64_t _Bytes, double _Seconds)
+{
+  if(_Seconds <= 0.0) return 0.0;
+  return ((double)_Bytes / (1024.0*1024.0)) / _Seconds;
+}
+
+// same for a count (files/s), 0 for an empty or untimed run so reports stay valid JSON
+static double
+PHD_GetPerSecond(uint64_t _Count, double _Seconds)
+{
+  if(_Seconds <= 0.0) return 0.0;
+  return (double)_Count / _Seconds;
+}
+
+//=============================================
+// WriteBlock
+// writes _Size bytes to _Output, at *_Address
+// (advanced past the block) or at the current
+// file pointer if _Address is NULL
+//=============================================
+static int
+PHD_WriteBlock(HANDLE _Output,
+               const void *_Data,
+               DWORD _Size,
+               uint64_t *_Address)
+{
+  OVERLAPPED Overlapped = {};
+  OVERLAPPED *Position = NULL;
+
+  if(_Address)
+  {
+    Overlapped.Offset = (DWORD)(*_Address & 0xffffffff);
+    Overlapped.OffsetHigh = (DWORD)(*_Address >> 32);
+    Position = &Overlapped;
+  }
+
+  DWORD BytesWritten = 0;
+  PHD_StatsAdd(PHD_Stats.WriteCalls, 1);
+  if(!WriteFile(_Output, _Data, _Size, &BytesWritten, Position) || BytesWritten != _Size)
+  {
+    return 1;
+  }
+
+  PHD_StatsAdd(PHD_Stats.BytesWritten, _Size);
+
+  if(_Address) *_Address += _Size;
+  return 0;
+}
+
+//==================================================
+// Content Hash
+// streaming 64-bit hash of file contents (XXH64),
+// recognises unchanged files across builds (-u)
+//==================================================
+#define PHD_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define PHD_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PHD_HASH_PRIME3 0x165667B19E3779F9ULL
+#define PHD_HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define PHD_HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+struct PHD_ContentHash
+{
+  uint64_t Lanes[4];
+  uint8_t Stripe[32]; // input waiting for a whole 32 byte stripe
+  uint32_t StripeSize;
+  uint64_t Length; // total bytes hashed
+};
+
+static inline uint64_t
+PHD_HashRotate(uint64_t _Value, int _Bits)
+{
+  return (_Value << _Bits) | (_Value >> (64 - _Bits));
+}
+
+static inline uint64_t
+PHD_HashRound(uint64_t _Lane, const uint8_t *_Data)
+{
+  uint64_t Input;
+  memcpy(&Input, _Data, 8);
+  _Lane += Input * PHD_HASH_PRIME2;
+  return PHD_HashRotate(_Lane, 31) * PHD_HASH_PRIME1;
+}
+
+static void
+PHD_ContentHashInit(PHD_ContentHash *_Hash)
+{
+  _Hash->Lanes[0] = PHD_HASH_PRIME1 + PHD_HASH_PRIME2;
+  _Hash->Lanes[1] = PHD_HASH_PRIME2;
+  _Hash->Lanes[2] = 0;
+  _Hash->Lanes[3] = 0 - PHD_HASH_PRIME1;
+  _Hash->StripeSize = 0;
+  _Hash->Length = 0;
+}
+
+static void
+PHD_ContentHashUpdate(PHD_ContentHash *_Hash, const void *_Data, uint64_t _Size)
+{
+  const uint8_t *Data = (const uint8_t*)_Data;
+  _Hash->Length += _Size;
+
+  if(_Hash->StripeSize)
+  {
+    uint64_t Fill = std::min<uint64_t>(_Size, 32 - _Hash->StripeSize);
+    memcpy(_Hash->Stripe + _Hash->StripeSize, Data, (size_t)Fill);
+    _Hash->StripeSize += (uint32_t)Fill;
+    Data += Fill;
+    _Size -= Fill;
+    if(_Hash->StripeSize < 32) return;
+
+    for(int iLane = 0; iLane < 4; ++iLane) _Hash->Lanes[iLane] = PHD_HashRound(_Hash->Lanes[iLane], _Hash->Stripe + iLane*8);
+    _Hash->StripeSize = 0;
+  }
+
+  for(; _Size >= 32; Data += 32, _Size -= 32)
+  {
+    _Hash->Lanes[0] = PHD_HashRound(_Hash->Lanes[0], Data);
+    _Hash->Lanes[1] = PHD_HashRound(_Hash->Lanes[1], Data + 8);
+    _Hash->Lanes[2] = PHD_HashRound(_Hash->Lanes[2], Data + 16);
+    _Hash->Lanes[3] = PHD_HashRound(_Hash->Lanes[3], Data + 24);
+  }
+
+  memcpy(_Hash->Stripe, Data, (size_t)_Size);
+  _Hash->StripeSize = (uint32_t)_Size;
+}
+
+static uint64_t
+PHD_ContentHashFinal(const PHD_ContentHash *_Hash)
+{
+  uint64_t Result;
+  if(_Hash->Length >= 32)
+  {
+    Result = PHD_HashRotate(_Hash->Lanes[0], 1) + PHD_HashRotate(_Hash->Lanes[1], 7) +
+             PHD_HashRotate(_Hash->Lanes[2], 12) + PHD_HashRotate(_Hash->Lanes[3], 18);
+
+    for(int iLane = 0; iLane < 4; ++iLane)
+    {
+      uint8_t Lane[8];
+      memcpy(Lane, &_Hash->Lanes[iLane], 8);
+      Result ^= PHD_HashRound(0, Lane);
+      Result = Result * PHD_HASH_PRIME1 + PHD_HASH_PRIME4;
+    }
+  }
+  else Result = PHD_HASH_PRIME5;
+
+  Result += _Hash->Length;
+
+  // tail: 8, then 4, then 1 byte at a time
+  const uint8_t *Tail = _Hash->Stripe;
+  uint32_t Remaining = _Hash->StripeSize;
+  for(; Remaining >= 8; Tail += 8, Remaining -= 8)
+  {
+    Result ^= PHD_HashRound(0, Tail);
+    Result = PHD_HashRotate(Result, 27) * PHD_HASH_PRIME1 + PHD_HASH_PRIME4;
+  }
+
+  if(Remaining >= 4)
+  {
+    uint32_t Word;
+    memcpy(&Word, Tail, 4);
+    Result ^= (uint64_t)Word * PHD_HASH_PRIME1;
+    Result = PHD_HashRotate(Result, 23) * PHD_HASH_PRIME2 + PHD_HASH_PRIME3;
+    Tail += 4;
+    Remaining -= 4;
+  }
+
+  for(; Remaining; ++Tail, --Remaining)
+  {
+    Result ^= (uint64_t)*Tail * PHD_HASH_PRIME5;
+    Result = PHD_HashRotate(Result, 11) * PHD_HASH_PRIME1;
+  }
+
+  Result ^= Result >> 33;
+  Result *= PHD_HASH_PRIME2;
+  Result ^= Result >> 29;
+  Result *= PHD_HASH_PRIME3;
+  Result ^= Result >> 32;
+  return Result;
+}
+
+//==================================================
+// Copy Engine
+// copies input files into the .dat in large blocks
+//==================================================
+// Pad policy: every entry in the .dat is followed by PHD_PAD_SIZE bytes of
+// PHD_PAD_BYTE. Up to v5.4 this byte was the EOF (0xff) that the fgetc/fputc
+// loop wrote after each file, the .csv addresses have always accounted for it
+// so it is kept as an explicit pad to leave the .dat layout unchanged.
+#define PHD_PAD_BYTE 0xff
+#define PHD_PAD_SIZE 1
+
+// Inputs of at least PHD_COPY_UNBUFFERED_MIN bytes are opened with
+// FILE_FLAG_NO_BUFFERING and read by DMA straight into the page aligned copy
+// buffer, skipping the extra copy through the system file cache. Smaller
+// inputs are read through the cache with FILE_FLAG_SEQUENTIAL_SCAN.
+#define PHD_COPY_BUFFER_SIZE 0x800000 // 8MB, multiple of any sector size
+#define PHD_COPY_UNBUFFERED_MIN 0x100000 // 1MB
+
+struct PHD_CopyEngine
+{
+  uint8_t *Buffer; // page aligned, PHD_COPY_BUFFER_SIZE + room for pad
+  uint64_t BytesCopied; // total input bytes copied
+  double Seconds; // total time spent copying
+  uint32_t Checksum; // CRC32C of the bytes (without pad) of the last copy
+};
+
+static int
+PHD_CopyEngineInit(PHD_CopyEngine *_Engine)
+{
+  // VirtualAlloc always returns page aligned memory
+  _Engine->Buffer = (uint8_t*)VirtualAlloc(NULL, PHD_COPY_BUFFER_SIZE + 0x1000, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  _Engine->BytesCopied = 0;
+  _Engine->Seconds = 0.0;
+
+  if(!_Engine->Buffer)
+  {
+    std::cerr << "PhragDat error: CopyEngine: failed to allocate copy buffer" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+static void
+PHD_CopyEngineFree(PHD_CopyEngine *_Engine)
+{
+  if(_Engine->Buffer) VirtualFree(_Engine->Buffer, 0, MEM_RELEASE);
+  _Engine->Buffer = 0;
+}
+
+//=======================================================
+// CopyEngineCopyFrom
+// writes _Length bytes of _Input from _InputAddress
+// + pad to _Output at _Address, or appends if _Address
+// is PHD_APPEND, hashes what it copies into _Hash if
+// not NULL, _Name is only used for errors
+// returns 0 on success, _Seconds receives copy time
+//=======================================================
+#define PHD_APPEND 0xffffffffffffffffULL
+
+static int
+PHD_CopyEngineCopyFrom(PHD_CopyEngine *_Engine,
+                       HANDLE _Input,
+                       uint64_t _InputAddress,
+                       bool _Unbuffered,
+                       uint64_t _Length,
+                       HANDLE _Output,
+                       uint64_t _Address,
+                       uint64_t *_Hash,
+                       std::string_view _Name,
+                       double *_Seconds)
+{
+  double StartTime = PHD_GetSeconds();
+
+  PHD_ContentHash Hash;
+  if(_Hash) PHD_ContentHashInit(&Hash);
+  uint32_t Checksum = 0;
+
+  // only the length found while scanning is copied, the addresses
+  // in the .csv depend on it even if the file changed since
+  uint64_t Remaining = _Length;
+  bool PadWritten = 0;
+  uint64_t *WriteAddress = (_Address == PHD_APPEND) ? NULL : &_Address;
+
+  while(Remaining)
+  {
+    // unbuffered reads must be whole sectors, so always ask for a full buffer
+    DWORD ToRead = (DWORD)PHD_COPY_BUFFER_SIZE;
+    if(!_Unbuffered && Remaining < PHD_COPY_BUFFER_SIZE) ToRead = (DWORD)Remaining;
+
+    OVERLAPPED Overlapped = {};
+    Overlapped.Offset = (DWORD)(_InputAddress & 0xffffffff);
+    Overlapped.OffsetHigh = (DWORD)(_InputAddress >> 32);
+
+    DWORD BytesRead = 0;
+    if(!ReadFile(_Input, _Engine->Buffer, ToRead, &BytesRead, &Overlapped) || !BytesRead)
+    {
+      std::cerr << "PhragDat error: failed reading " << _Name << " (file changed since scan?)" << std::endl;
+      return 1;
+    }
+
+    PHD_StatsRead(BytesRead);
+    if(BytesRead > Remaining) BytesRead = (DWORD)Remaining;
+    Remaining -= BytesRead;
+    _InputAddress += BytesRead;
+    if(_Hash) PHD_ContentHashUpdate(&Hash, _Engine->Buffer, BytesRead);
+    Checksum = PHD_Crc32c(Checksum, _Engine->Buffer, BytesRead);
+
+    // the pad rides along with the last block instead of costing its own write
+    DWORD ToWrite = BytesRead;
+    if(!Remaining)
+    {
+      memset(_Engine->Buffer + BytesRead, PHD_PAD_BYTE, PHD_PAD_SIZE);
+      ToWrite += PHD_PAD_SIZE;
+      PadWritten = 1;
+    }
+
+    if(PHD_WriteBlock(_Output, _Engine->Buffer, ToWrite, WriteAddress))
+    {
+      std::cerr << "PhragDat error: failed writing data from " << _Name << std::endl;
+      return 1;
+    }
+  }
+
+  if(!PadWritten)
+  {
+    uint8_t Pad[PHD_PAD_SIZE];
+    memset(Pad, PHD_PAD_BYTE, PHD_PAD_SIZE);
+    if(PHD_WriteBlock(_Output, Pad, PHD_PAD_SIZE, WriteAddress))
+    {
+      std::cerr << "PhragDat error: failed writing pad for " << _Name << std::endl;
+      return 1;
+    }
+  }
+
+  if(_Hash) *_Hash = PHD_ContentHashFinal(&Hash);
+  _Engine->Checksum = Checksum;
+
+  double Seconds = PHD_GetSeconds() - StartTime;
+  PHD_StatsFile(_Name, _Length, Seconds);
+  _Engine->BytesCopied += _Length;
+  _Engine->Seconds += Seconds;
+  if(_Seconds) *_Seconds = Seconds;
+
+  return 0;
+}
+
+//=====================================================
+// CopyEngineCopy
+// writes _Length bytes of _InputPath + pad to _Output
+// at _Address, or appends if _Address is PHD_APPEND
+// returns 0 on success, _Seconds receives copy time
+//=====================================================
+static int
+PHD_CopyEngineCopy(PHD_CopyEngine *_Engine,
+                   const char *_InputPath,
+                   uint64_t _Length,
+                   HANDLE _Output,
+                   uint64_t _Address,
+                   uint64_t *_Hash,
+                   double *_Seconds)
+{
+  bool Unbuffered = (_Length >= PHD_COPY_UNBUFFERED_MIN);
+
+  DWORD Flags = Unbuffered ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN;
+  HANDLE InputFile = CreateFileA(_InputPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, Flags, NULL);
+  PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+
+  if(InputFile == INVALID_HANDLE_VALUE)
+  {
+    std::cerr << "PhragDat error: failed reading " << _InputPath << std::endl;
+    return 1;
+  }
+
+  int Result = PHD_CopyEngineCopyFrom(_Engine, InputFile, 0, Unbuffered, _Length, _Output, _Address, _Hash, _InputPath, _Seconds);
+  CloseHandle(InputFile);
+  return Result;
+}
+
+//=========================================================
+// PHDC_PathArena (Interned Paths)
+// every input path of a compile is appended, NUL
+// terminated, to a few large chunks that never move, so
+// the views handed out stay valid (and usable as C
+// strings) until the arena is destroyed. A DatPath is a
+// suffix of its InputPath, not a second copy.
+//=========================================================
+#define PHD_ARENA_CHUNK_SIZE 0x100000
+
+struct PHDC_PathArena
+{
+  std::vector<std::unique_ptr<char[]>> Chunks;
+  size_t Used = 0; // bytes of the last chunk in use
+  size_t Capacity = 0; // size of the last chunk
+  size_t NextChunk = PHD_ARENA_CHUNK_SIZE; // size of the next chunk, see PHD_ArenaReserve
+  uint64_t Bytes = 0; // chunk bytes allocated
+  uint64_t Allocations = 0; // chunks
+};
+
+// the next chunk holds at least _Bytes, a compile that knows its total uses a single chunk
+static void
+PHD_ArenaReserve(PHDC_PathArena *_Arena, size_t _Bytes)
+{
+  if(_Arena->Capacity - _Arena->Used < _Bytes) _Arena->NextChunk = std::max(_Bytes, (size_t)PHD_ARENA_CHUNK_SIZE);
+}
+
+// _Directory + '/' (unless it ends in one) + _Name, as PHD_WalkDirectory builds entry paths
+static std::string_view
+PHD_ArenaJoin(PHDC_PathArena *_Arena, std::string_view _Directory, std::string_view _Name)
+{
+  bool Slash = !_Directory.length() || _Directory.back() != '/';
+  size_t Length = _Directory.length() + Slash + _Name.length();
+
+  if(_Arena->Capacity - _Arena->Used < Length + 1)
+  {
+    size_t ChunkSize = std::max(Length + 1, _Arena->NextChunk);
+    _Arena->Chunks.push_back(std::unique_ptr<char[]>(new char[ChunkSize]));
+    _Arena->Used = 0;
+    _Arena->Capacity = ChunkSize;
+    _Arena->NextChunk = PHD_ARENA_CHUNK_SIZE;
+    _Arena->Bytes += ChunkSize;
+    _Arena->Allocations++;
+  }
+
+  char *Path = _Arena->Chunks.back().get() + _Arena->Used;
+  memcpy(Path, _Directory.data(), _Directory.length());
+  if(Slash) Path[_Directory.length()] = '/';
+  memcpy(Path + _Directory.length() + Slash, _Name.data(), _Name.length());
+  Path[Length] = 0;
+  _Arena->Used += Length + 1;
+
+  return std::string_view(Path, Length);
+}
+
+//================================
+// PHDC_File (Input File Info)
+//================================
+struct PHDC_File
+{
+  std::string_view InputPath; // full file path for input (PHDC_PathArena, NUL terminated)
+  std::string_view DatPath; // path relative to .dat for contents, suffix of InputPath
+  uint64_t Address; // address inside .dat
+  uint64_t Length; // file size in bytes
+  uint64_t StoredLength; // bytes written at Address (Length unless compressed)
+  uint32_t Method; // PHD_METHOD_* (phragdat_format.h)
+  uint32_t Block; // solid block index or PHD_NO_BLOCK, Address is then the offset in the block
+  uint64_t WriteTime; // last write time from the scan
+  uint64_t Hash; // content hash (-u only)
+  const struct PHDC_ManifestEntry *Previous; // same path in the previous build (-u), NULL if none/unusable
+  bool Reused; // bytes are copied from the previous .dat at Previous->Address
+  bool Hot; // listed by -p, written in the hot region
+  PHDC_File *Duplicate; // earlier file with the same bytes (-r), this one is not written
+  uint32_t Checksum; // CRC32C of the stored bytes, set as they are written
+  uint32_t TraceOrder; // place in the -l trace, PHD_NOT_TRACED if it is not in it
+};
+
+//=====================================================
+// Incremental Builds
+// -u keeps a manifest next to the .dat, entries whose
+// size and write time (or content hash) match the
+// previous build are copied from the previous .dat
+// instead of being read and compressed again
+//=====================================================
+// Manifest ([input].manifest), text like the .csv:
+//   "PHRDAT-MANIFEST",major,minor,compressed(-z 0/1),previous .dat size
+//   "DatPath",Length,WriteTime,Hash(hex),Address,StoredLength,Method
+// Entries in solid blocks are listed but never reused, their blocks are
+// packed again every build.
+struct PHDC_ManifestEntry
+{
+  uint64_t Length;
+  uint64_t WriteTime;
+  uint64_t Hash;
+  uint64_t Address;
+  uint64_t StoredLength;
+  uint32_t Method;
+};
+
+//==================================================
+// ReadManifest
+// fills _Entries from _ManifestPath if it was
+// written for _DatPath as it is now and with the
+// same -z setting, returns 0 if it can be used
+//==================================================
+static int
+PHD_ReadManifest(std::string _ManifestPath,
+                 std::string _DatPath,
+                 bool _Compress,
+                 std::map<std::string, PHDC_ManifestEntry> &_Entries)
+{
+  std::ifstream ManifestFile(_ManifestPath, std::ios::binary);
+  if(!ManifestFile.is_open()) return 1;
+
+  std::string Line;
+  int Major = 0, Minor = 0, Compressed = 0;
+  unsigned long long DatSize = 0;
+  if(!std::getline(ManifestFile, Line) ||
+     sscanf(Line.c_str(), "\"PHRDAT-MANIFEST\",%d,%d,%d,%llu", &Major, &Minor, &Compressed, &DatSize) != 4 ||
+     Major != VER_MAJ || Minor != VER_MIN || (Compressed != 0) != _Compress)
+  {
+    return 1;
+  }
+
+  // the manifest is only valid next to the .dat it describes
+  WIN32_FILE_ATTRIBUTE_DATA DatInfo;
+  if(!GetFileAttributesExA(_DatPath.c_str(), GetFileExInfoStandard, &DatInfo) ||
+     ((((uint64_t)DatInfo.nFileSizeHigh << 32) | DatInfo.nFileSizeLow) != DatSize))
+  {
+    return 1;
+  }
+
+  while(std::getline(ManifestFile, Line))
+  {
+    size_t PathEnd = Line.rfind('"');
+    if(Line.length() < 2 || Line[0] != '"' || PathEnd == 0 || PathEnd == std::string::npos) return 1;
+
+    PHDC_ManifestEntry Entry;
+    unsigned long long Length, WriteTime, Hash, Address, StoredLength;
+    unsigned int Method;
+    if(sscanf(Line.c_str() + PathEnd + 1, ",%llu,%llu,%llx,%llu,%llu,%u", &Length, &WriteTime, &Hash, &Address, &StoredLength, &Method) != 6) return 1;
+
+    Entry.Length = Length;
+    Entry.WriteTime = WriteTime;
+    Entry.Hash = Hash;
+    Entry.Address = Address;
+    Entry.StoredLength = StoredLength;
+    Entry.Method = Method;
+    _Entries[Line.substr(1, PathEnd-1)] = Entry;
+  }
+
+  return 0;
+}
+
+//=====================================================
+// Access Traces
+// -l"trace" writes the files a program reads first
+// (PHD_ArchiveTraceWrite, see the trace format in
+// phragdat_format.h) at the start of the .dat in the
+// order it read them, the rest follow in scan order,
+// so a cold start reads the front of the .dat in a
+// few long sequential reads instead of seeking for
+// every file. With -s the traced small files fill the
+// first solid blocks in trace order.
+// -p"hot" takes a trace or list the same way, its
+// files go before everything else and are never put
+// in solid blocks, so they are one range of whole
+// entries (the hot region, recorded in the footer)
+// a reader can load with PHD_ArchivePreloadHot.
+//=====================================================
+#define PHD_NOT_TRACED 0xffffffff
+
+//==================================================
+// ApplyTrace
+// moves the files listed in _TracePath to the front
+// of _Files in trace order, marking them Hot if
+// _Hot, *_Traced receives how many were moved,
+// *_Missing how many listed paths are not in the
+// input (excluded or since removed)
+//==================================================
+static int
+PHD_ApplyTrace(std::string _TracePath,
+               bool _Hot,
+               std::vector<PHDC_File*> &_Files,
+               uint64_t *_Traced,
+               uint64_t *_Missing)
+{
+  *_Traced = 0;
+  *_Missing = 0;
+
+  std::ifstream TraceFile(_TracePath, std::ios::binary);
+  if(!TraceFile.is_open())
+  {
+    std::cerr << "PhragDat error: failed to open " << (_Hot ? "hot list " : "trace ") << _TracePath << ", exiting..." << std::endl;
+    return 1;
+  }
+
+  std::unordered_map<std::string_view, PHDC_File*> FilesByPath;
+  FilesByPath.reserve(_Files.size());
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile) {FilesByPath[_Files[iFile]->DatPath] = _Files[iFile];}
+
+  // -l numbers the files for PHD_PackSolidBlocks, -p only marks them
+  auto Listed = [&](const PHDC_File *_File) {return _Hot ? _File->Hot : _File->TraceOrder != PHD_NOT_TRACED;};
+
+  std::vector<PHDC_File*> Ordered;
+  std::string Line;
+  bool FirstLine = 1;
+
+  while(std::getline(TraceFile, Line))
+  {
+    // remove pesky carriage returns from windows encoded text
+    if(Line.length() && Line.back() == 0xd) Line.pop_back();
+
+    bool Header = FirstLine && Line.compare(0, sizeof(PHD_TRACE_TAG)+1, "\"" PHD_TRACE_TAG "\"") == 0;
+    FirstLine = 0;
+    if(Header || !Line.length()) continue;
+
+    // "DatPath",time or a bare path, written with either slash
+    std::string Path = Line;
+    size_t PathEnd = Line.rfind('"');
+    if(Line[0] == '"' && PathEnd != 0 && PathEnd != std::string::npos) Path = Line.substr(1, PathEnd-1);
+    std::replace(Path.begin(), Path.end(), '\\', '/');
+
+    auto Found = FilesByPath.find(Path);
+    if(Found == FilesByPath.end())
+    {
+      (*_Missing)++;
+      continue;
+    }
+
+    // a path listed twice keeps its first place
+    PHDC_File *File = Found->second;
+    if(Listed(File)) continue;
+    if(_Hot) File->Hot = 1;
+    else File->TraceOrder = (uint32_t)Ordered.size();
+    Ordered.push_back(File);
+  }
+
+  *_Traced = Ordered.size();
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile)
+  {
+    if(!Listed(_Files[iFile])) Ordered.push_back(_Files[iFile]);
+  }
+
+  _Files.swap(Ordered);
+  return 0;
+}
+
+//=================================================
+// CopyFileEntry
+// copies _File (from _OldDat if it is reused, else
+// from its input, hashing it if _Hash) to _Output
+// at _Address, see CopyEngineCopy
+//=================================================
+static int
+PHD_CopyFileEntry(PHD_CopyEngine *_Engine,
+                  PHDC_File *_File,
+                  HANDLE _Output,
+                  uint64_t _Address,
+                  HANDLE _OldDat,
+                  bool _Hash,
+                  double *_Seconds)
+{
+  int Result;
+  if(_File->Reused) Result = PHD_CopyEngineCopyFrom(_Engine, _OldDat, _File->Previous->Address, 0, _File->StoredLength, _Output, _Address, NULL, _File->InputPath, _Seconds);
+  else Result = PHD_CopyEngineCopy(_Engine, _File->InputPath.data(), _File->Length, _Output, _Address, _Hash ? &_File->Hash : NULL, _Seconds);
+
+  _File->Checksum = _Engine->Checksum;
+  return Result;
+}
+
+//=====================================================
+// Deduplication
+// -r stores byte-identical files once, every copy's
+// table of contents entry (and .csv line) points at
+// the same stored bytes. Only files that share a size
+// with another file are hashed, equal hashes are then
+// confirmed byte by byte before two files are merged
+//=====================================================
+
+//=================================================
+// HashFile
+// content hash of the first _Length bytes of
+// _InputPath, _Buffer is PHD_COPY_BUFFER_SIZE
+//=================================================
+static int
+PHD_HashFile(const char *_InputPath,
+             uint64_t _Length,
+             uint8_t *_Buffer,
+             uint64_t *_Hash)
+{
+  HANDLE InputFile = CreateFileA(_InputPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+  if(InputFile == INVALID_HANDLE_VALUE)
+  {
+    std::cerr << "PhragDat error: failed reading " << _InputPath << std::endl;
+    return 1;
+  }
+
+  PHD_ContentHash Hash;
+  PHD_ContentHashInit(&Hash);
+
+  uint64_t Remaining = _Length;
+  while(Remaining)
+  {
+    DWORD BytesRead = 0;
+    if(!ReadFile(InputFile, _Buffer, (DWORD)std::min<uint64_t>(Remaining, PHD_COPY_BUFFER_SIZE), &BytesRead, NULL) || !BytesRead)
+    {
+      std::cerr << "PhragDat error: failed reading " << _InputPath << " (file changed since scan?)" << std::endl;
+      CloseHandle(InputFile);
+      return 1;
+    }
+
+    PHD_StatsRead(BytesRead);
+    PHD_ContentHashUpdate(&Hash, _Buffer, BytesRead);
+    Remaining -= BytesRead;
+  }
+
+  CloseHandle(InputFile);
+  *_Hash = PHD_ContentHashFinal(&Hash);
+  return 0;
+}
+
+//=================================================
+// CompareFiles
+// sets *_Equal if the first _Length bytes of _A
+// and _B match, _Buffer is 2*PHD_COPY_BUFFER_SIZE
+//=================================================
+static int
+PHD_CompareFiles(const char *_A,
+                 const char *_B,
+                 uint64_t _Length,
+                 uint8_t *_Buffer,
+                 bool *_Equal)
+{
+  HANDLE Inputs[2];
+  Inputs[0] = CreateFileA(_A, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  Inputs[1] = CreateFileA(_B, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  PHD_StatsAdd(PHD_Stats.OpenCalls, 2);
+
+  int Result = 0;
+  *_Equal = 1;
+  uint64_t Remaining = _Length;
+
+  while(Remaining && *_Equal && !Result)
+  {
+    DWORD ToRead = (DWORD)std::min<uint64_t>(Remaining, PHD_COPY_BUFFER_SIZE);
+    for(int iInput = 0; iInput < 2 && !Result; ++iInput)
+    {
+      // ReadFile may return less than asked, fill the whole chunk
+      DWORD Filled = 0;
+      while(Filled < ToRead)
+      {
+        DWORD BytesRead = 0;
+        if(Inputs[iInput] == INVALID_HANDLE_VALUE ||
+           !ReadFile(Inputs[iInput], _Buffer + iInput*PHD_COPY_BUFFER_SIZE + Filled, ToRead - Filled, &BytesRead, NULL) || !BytesRead)
+        {
+          std::cerr << "PhragDat error: failed reading " << (iInput ? _B : _A) << " (file changed since scan?)" << std::endl;
+          Result = 1;
+          break;
+        }
+        PHD_StatsRead(BytesRead);
+        Filled += BytesRead;
+      }
+    }
+
+    if(!Result && memcmp(_Buffer, _Buffer + PHD_COPY_BUFFER_SIZE, ToRead)) *_Equal = 0;
+    Remaining -= ToRead;
+  }
+
+  for(int iInput = 0; iInput < 2; ++iInput)
+  {
+    if(Inputs[iInput] != INVALID_HANDLE_VALUE) CloseHandle(Inputs[iInput]);
+  }
+
+  return Result;
+}
+
+//======================================================
+// FindDuplicates
+// points Duplicate of every file in _Files at the first
+// earlier file with the same bytes, candidates are
+// hashed and then byte compared by _Threads workers,
+// *_Duplicates receives the number of files that will
+// not be written
+//======================================================
+static int
+PHD_FindDuplicates(std::vector<PHDC_File*> &_Files,
+                   int _Threads,
+                   uint64_t *_Duplicates)
+{
+  *_Duplicates = 0;
+
+  // a file with a unique size cannot have a copy
+  std::map<uint64_t, std::vector<PHDC_File*>> BySize;
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile) {BySize[_Files[iFile]->Length].push_back(_Files[iFile]);}
+
+  std::vector<PHDC_File*> Candidates;
+  for(auto Group = BySize.begin(); Group != BySize.end(); ++Group)
+  {
+    if(Group->second.size() > 1) Candidates.insert(Candidates.end(), Group->second.begin(), Group->second.end());
+  }
+
+  if(Candidates.empty()) return 0;
+  std::cout << "Deduplicating: hashing " << Candidates.size() << " files with shared sizes..." << std::endl;
+
+  // _Threads workers (the calling thread is one) run _Work until it returns 0
+  std::atomic<uint64_t> NextTask(0);
+  std::atomic<bool> Failed(0);
+  auto RunWorkers = [&](auto _Work)
+  {
+    NextTask = 0;
+    std::vector<std::thread> Workers;
+    for(int iThread = 1; iThread < _Threads; ++iThread) {Workers.push_back(std::thread(_Work));}
+    _Work();
+    for(size_t iThread = 0; iThread < Workers.size(); ++iThread) {Workers[iThread].join();}
+  };
+
+  RunWorkers([&]()
+  {
+    std::vector<uint8_t> Buffer(PHD_COPY_BUFFER_SIZE);
+    while(!Failed)
+    {
+      uint64_t iFile = NextTask++;
+      if(iFile >= Candidates.size()) break;
+
+      // -u already knows the hash of files it reuses
+      PHDC_File *File = Candidates[iFile];
+      if(!File->Reused && PHD_HashFile(File->InputPath.data(), File->Length, &Buffer[0], &File->Hash)) Failed = 1;
+    }
+  });
+  if(Failed) return 1;
+
+  // files sharing a size and a hash, in _Files order: the first is the one stored, the others
+  // are compared with it by the workers, one pair each
+  std::vector<std::vector<PHDC_File*>> Buckets;
+  std::vector<std::pair<PHDC_File*, PHDC_File*>> Pairs;
+  for(auto Group = BySize.begin(); Group != BySize.end(); ++Group)
+  {
+    std::map<uint64_t, std::vector<PHDC_File*>> ByHash;
+    for(size_t iFile = 0; iFile < Group->second.size() && Group->second.size() > 1; ++iFile)
+    {
+      ByHash[Group->second[iFile]->Hash].push_back(Group->second[iFile]);
+    }
+
+    for(auto Bucket = ByHash.begin(); Bucket != ByHash.end(); ++Bucket)
+    {
+      if(Bucket->second.size() < 2) continue;
+      for(size_t iFile = 1; iFile < Bucket->second.size(); ++iFile) {Pairs.push_back(std::make_pair(Bucket->second[0], Bucket->second[iFile]));}
+      Buckets.push_back(std::move(Bucket->second));
+    }
+  }
+
+  std::vector<uint8_t> Equal(Pairs.size(), 0);
+  RunWorkers([&]()
+  {
+    std::vector<uint8_t> Buffer(2*PHD_COPY_BUFFER_SIZE);
+    while(!Failed)
+    {
+      uint64_t iPair = NextTask++;
+      if(iPair >= Pairs.size()) break;
+
+      bool Same = 0;
+      if(PHD_CompareFiles(Pairs[iPair].first->InputPath.data(), Pairs[iPair].second->InputPath.data(), Pairs[iPair].second->Length, &Buffer[0], &Same)) Failed = 1;
+      Equal[iPair] = Same;
+    }
+  });
+  if(Failed) return 1;
+
+  // applied in _Files order, a file that differs from the first of its bucket (a hash collision,
+  // next to never) is compared here with the bucket's later originals, as a serial pass would
+  std::vector<uint8_t> Buffer;
+  size_t iPair = 0;
+  for(size_t iBucket = 0; iBucket < Buckets.size(); ++iBucket)
+  {
+    std::vector<PHDC_File*> &Bucket = Buckets[iBucket];
+    std::vector<PHDC_File*> Originals(1, Bucket[0]);
+    for(size_t iFile = 1; iFile < Bucket.size(); ++iFile)
+    {
+      PHDC_File *File = Bucket[iFile];
+      if(Equal[iPair++]) File->Duplicate = Bucket[0];
+
+      for(size_t iOriginal = 1; iOriginal < Originals.size() && !File->Duplicate; ++iOriginal)
+      {
+        bool Same = 0;
+        Buffer.resize(2*PHD_COPY_BUFFER_SIZE);
+        if(PHD_CompareFiles(Originals[iOriginal]->InputPath.data(), File->InputPath.data(), File->Length, &Buffer[0], &Same)) return 1;
+        if(Same) File->Duplicate = Originals[iOriginal];
+      }
+
+      if(File->Duplicate)
+      {
+        File->Reused = 0;
+        (*_Duplicates)++;
+      }
+      else Originals.push_back(File);
+    }
+  }
+
+  return 0;
+}
+
+//====================================================
+// Alignment
+// -aN starts entries on N byte boundaries (power of
+// 2) so they can be read unbuffered or mapped alone,
+// the gap after the previous entry's pad is zeros
+//====================================================
+// Entries shorter than PHD_ALIGN_MIN_BOUNDARIES boundaries are packed as
+// before: aligning them would waste up to a boundary each for reads that
+// fit in one or two pages/sectors anyway.
+#define PHD_ALIGN_MAX 0x100000 // 1MB
+#define PHD_ALIGN_MIN_BOUNDARIES 4
+
+static uint64_t
+PHD_AlignAddress(uint64_t _Address,
+                 uint64_t _StoredLength,
+                 uint64_t _Alignment)
+{
+  if(_Alignment <= 1 || _StoredLength < _Alignment*PHD_ALIGN_MIN_BOUNDARIES) return _Address;
+  return (_Address + _Alignment-1) & ~(_Alignment-1);
+}
+
+//=======================================================================
+// IoRing backend
+// the stored copy stage (no -z/-s) through Windows 11 IoRing: each
+// worker keeps up to PHD_IORING_DEPTH files in flight in one registered
+// buffer, reading a file and writing it to its Address are two ring
+// operations, and one SubmitIoRing call hands the kernel every operation
+// queued since the last one instead of a ReadFile and a WriteFile per
+// file. The functions are looked up in kernelbase.dll at runtime so
+// phragdat still runs without them, the blocking copy engine is used
+// there and for files too large for a slot. IoRing has no open, stat or
+// close operations: inputs are still opened and closed by the worker
+// (sizes already come from the directory records), -jN overlaps those.
+//=======================================================================
+#define PHD_BACKEND_AUTO 0 // IoRing if the system has it, else blocking
+#define PHD_BACKEND_BLOCKING 1 // copy engine, ReadFile/WriteFile
+#define PHD_BACKEND_IORING 2
+
+#define PHD_IORING_DEPTH 128 // files in flight per worker
+#define PHD_IORING_SLOT_SIZE 0x10000 // 64KB per file in flight, file + pad must fit
+
+#if defined(PHD_IORING)
+struct PHD_IoRingApi
+{
+  decltype(&CreateIoRing) Create;
+  decltype(&IsIoRingOpSupported) IsOpSupported;
+  decltype(&BuildIoRingRegisterBuffers) RegisterBuffers;
+  decltype(&BuildIoRingRegisterFileHandles) RegisterFileHandles;
+  decltype(&BuildIoRingReadFile) Read;
+  decltype(&BuildIoRingWriteFile) Write;
+  decltype(&SubmitIoRing) Submit;
+  decltype(&PopIoRingCompletion) PopCompletion;
+  decltype(&CloseIoRing) Close;
+};
+
+static PHD_IoRingApi PHD_IoRing;
+#endif
+
+//================================================
+// IoRingLoad
+// resolves the IoRing functions once and checks
+// a ring that can write files can be created,
+// returns 1 if the IoRing backend can be used
+//================================================
+static bool
+PHD_IoRingLoad()
+{
+#if defined(PHD_IORING)
+  static const bool Usable = []
+  {
+    HMODULE Module = GetModuleHandleA("kernelbase.dll");
+    if(!Module) return false;
+
+    PHD_IoRing.Create = (decltype(&CreateIoRing))GetProcAddress(Module, "CreateIoRing");
+    PHD_IoRing.IsOpSupported = (decltype(&IsIoRingOpSupported))GetProcAddress(Module, "IsIoRingOpSupported");
+    PHD_IoRing.RegisterBuffers = (decltype(&BuildIoRingRegisterBuffers))GetProcAddress(Module, "BuildIoRingRegisterBuffers");
+    PHD_IoRing.RegisterFileHandles = (decltype(&BuildIoRingRegisterFileHandles))GetProcAddress(Module, "BuildIoRingRegisterFileHandles");
+    PHD_IoRing.Read = (decltype(&BuildIoRingReadFile))GetProcAddress(Module, "BuildIoRingReadFile");
+    PHD_IoRing.Write = (decltype(&BuildIoRingWriteFile))GetProcAddress(Module, "BuildIoRingWriteFile");
+    PHD_IoRing.Submit = (decltype(&SubmitIoRing))GetProcAddress(Module, "SubmitIoRing");
+    PHD_IoRing.PopCompletion = (decltype(&PopIoRingCompletion))GetProcAddress(Module, "PopIoRingCompletion");
+    PHD_IoRing.Close = (decltype(&CloseIoRing))GetProcAddress(Module, "CloseIoRing");
+
+    if(!PHD_IoRing.Create || !PHD_IoRing.IsOpSupported || !PHD_IoRing.RegisterBuffers || !PHD_IoRing.RegisterFileHandles ||
+       !PHD_IoRing.Read || !PHD_IoRing.Write || !PHD_IoRing.Submit || !PHD_IoRing.PopCompletion || !PHD_IoRing.Close) return false;
+
+    // writes arrived with IORING_VERSION_3 (Windows 11 22H2)
+    HIORING Ring;
+    IORING_CREATE_FLAGS Flags = {IORING_CREATE_REQUIRED_FLAGS_NONE, IORING_CREATE_ADVISORY_FLAGS_NONE};
+    if(FAILED(PHD_IoRing.Create(IORING_VERSION_3, Flags, 1, 2, &Ring))) return false;
+    bool Writes = PHD_IoRing.IsOpSupported(Ring, IORING_OP_WRITE) != 0;
+    PHD_IoRing.Close(Ring);
+    return Writes;
+  }();
+
+  return Usable;
+#else
+  return 0;
+#endif
+}
+
+//=================================================
+// IoRingCopy
+// copies _Files (the next index comes from
+// _NextFile, shared with the other workers) to
+// their Address through one ring, see IoRing
+// backend, files that do not fit a slot go through
+// _Engine to _Output (reused ones from _OldDat).
+// _RingOutput and _RingOldDat are overlapped
+// handles to the same files for the ring. Stops
+// when _Failed is set, returns 0 on success
+//=================================================
+#if defined(PHD_IORING)
+struct PHDC_RingSlot
+{
+  PHDC_File *File;
+  HANDLE Input; // INVALID_HANDLE_VALUE for reused files (read from the previous .dat)
+  uint64_t Length; // bytes read, written with the pad after them
+  double StartTime;
+};
+#endif
+
+static int
+PHD_IoRingCopy(std::vector<PHDC_File*> &_Files,
+               std::atomic<uint64_t> &_NextFile,
+               std::atomic<bool> &_Failed,
+               PHD_CopyEngine *_Engine,
+               HANDLE _Output,
+               HANDLE _OldDat,
+               HANDLE _RingOutput,
+               HANDLE _RingOldDat,
+               bool _Hash,
+               std::mutex &_ReportMutex)
+{
+#if defined(PHD_IORING)
+  HIORING Ring;
+  IORING_CREATE_FLAGS Flags = {IORING_CREATE_REQUIRED_FLAGS_NONE, IORING_CREATE_ADVISORY_FLAGS_NONE};
+  if(FAILED(PHD_IoRing.Create(IORING_VERSION_3, Flags, PHD_IORING_DEPTH, 2*PHD_IORING_DEPTH, &Ring)))
+  {
+    std::cerr << "PhragDat error: IoRing: failed to create ring" << std::endl;
+    return 1;
+  }
+
+  uint8_t *Buffer = (uint8_t*)VirtualAlloc(NULL, (size_t)PHD_IORING_DEPTH*PHD_IORING_SLOT_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if(!Buffer)
+  {
+    std::cerr << "PhragDat error: IoRing: failed to allocate ring buffer" << std::endl;
+    PHD_IoRing.Close(Ring);
+    return 1;
+  }
+
+  // buffer 0 holds every slot, handle 0 is the .dat, handle 1 the previous .dat (-u)
+  IORING_BUFFER_INFO BufferInfo = {Buffer, (UINT32)PHD_IORING_DEPTH*PHD_IORING_SLOT_SIZE};
+  HANDLE Handles[2] = {_RingOutput, _RingOldDat};
+  UINT32 HandleCount = (_RingOldDat != INVALID_HANDLE_VALUE) ? 2 : 1;
+
+  int Result = 0;
+  IORING_CQE Completion;
+  if(FAILED(PHD_IoRing.RegisterBuffers(Ring, 1, &BufferInfo, 0)) || FAILED(PHD_IoRing.RegisterFileHandles(Ring, HandleCount, Handles, 0)) ||
+     FAILED(PHD_IoRing.Submit(Ring, 2, INFINITE, NULL)))
+  {
+    std::cerr << "PhragDat error: IoRing: failed to register buffers" << std::endl;
+    Result = 1;
+  }
+
+  while(!Result && PHD_IoRing.PopCompletion(Ring, &Completion) == S_OK)
+  {
+    if(FAILED(Completion.ResultCode))
+    {
+      std::cerr << "PhragDat error: IoRing: failed to register buffers" << std::endl;
+      Result = 1;
+    }
+  }
+
+  PHD_StatsAdd(PHD_Stats.SubmitCalls, 1);
+
+  // user data is slot * 2, + 1 for the write
+  std::vector<PHDC_RingSlot> Slots(PHD_IORING_DEPTH);
+  std::vector<uint32_t> FreeSlots;
+  for(uint32_t iSlot = PHD_IORING_DEPTH; iSlot > 0; --iSlot) FreeSlots.push_back(iSlot-1);
+  uint32_t InFlight = 0;
+  bool Done = 0;
+
+  while(!Result && !_Failed && (!Done || InFlight))
+  {
+    // a read for every free slot
+    while(!Result && !Done && FreeSlots.size())
+    {
+      uint64_t iFile = _NextFile++;
+      if(iFile >= _Files.size())
+      {
+        Done = 1;
+        break;
+      }
+
+      PHDC_File *File = _Files[iFile];
+      uint64_t Length = File->Reused ? File->StoredLength : File->Length;
+      double StartTime = PHD_GetSeconds();
+
+      if(Length + PHD_PAD_SIZE > PHD_IORING_SLOT_SIZE)
+      {
+        double FileSeconds = 0.0;
+        if(PHD_CopyFileEntry(_Engine, File, _Output, File->Address, _OldDat, _Hash, &FileSeconds))
+        {
+          Result = 1;
+          break;
+        }
+
+        if(!FILE_REPORT) continue;
+        std::lock_guard<std::mutex> Lock(_ReportMutex);
+        std::cout << (File->Reused ? "Reusing: " : "Writing: ") << File->InputPath << " (" << std::fixed << std::setprecision(1)
+        << PHD_GetMBPerSecond(File->Length, FileSeconds) << " MB/s)\n";
+        continue;
+      }
+
+      uint32_t iSlot = FreeSlots.back();
+      PHDC_RingSlot &Slot = Slots[iSlot];
+      Slot.File = File;
+      Slot.Input = INVALID_HANDLE_VALUE;
+      Slot.Length = Length;
+      Slot.StartTime = StartTime;
+
+      IORING_HANDLE_REF Source = IoRingHandleRefFromIndex(1);
+      uint64_t SourceAddress = File->Reused ? File->Previous->Address : 0;
+      if(!File->Reused)
+      {
+        Slot.Input = CreateFileA(File->InputPath.data(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+        if(Slot.Input == INVALID_HANDLE_VALUE)
+        {
+          std::cerr << "PhragDat error: failed reading " << File->InputPath << std::endl;
+          Result = 1;
+          break;
+        }
+        Source = IoRingHandleRefFromHandle(Slot.Input);
+      }
+
+      if(FAILED(PHD_IoRing.Read(Ring, Source, IoRingBufferRefFromIndexAndOffset(0, iSlot*PHD_IORING_SLOT_SIZE), (UINT32)Length, SourceAddress, iSlot*2, IOSQE_FLAGS_NONE)))
+      {
+        std::cerr << "PhragDat error: IoRing: failed to queue read of " << File->InputPath << std::endl;
+        if(Slot.Input != INVALID_HANDLE_VALUE) CloseHandle(Slot.Input);
+        Result = 1;
+        break;
+      }
+
+      FreeSlots.pop_back();
+      InFlight++;
+    }
+
+    if(!InFlight) continue;
+
+    if(FAILED(PHD_IoRing.Submit(Ring, 1, INFINITE, NULL)))
+    {
+      std::cerr << "PhragDat error: IoRing: submit failed" << std::endl;
+      Result = 1;
+      break;
+    }
+    PHD_StatsAdd(PHD_Stats.SubmitCalls, 1);
+
+    // finished reads queue their write, finished writes free their slot
+    while(PHD_IoRing.PopCompletion(Ring, &Completion) == S_OK)
+    {
+      uint32_t iSlot = (uint32_t)(Completion.UserData / 2);
+      PHDC_RingSlot &Slot = Slots[iSlot];
+      PHDC_File *File = Slot.File;
+      uint8_t *Data = Buffer + (size_t)iSlot*PHD_IORING_SLOT_SIZE;
+
+      if(!(Completion.UserData & 1))
+      {
+        if(Slot.Input != INVALID_HANDLE_VALUE) CloseHandle(Slot.Input);
+        Slot.Input = INVALID_HANDLE_VALUE;
+
+        // only the length found while scanning is copied, as in the copy engine
+        if(FAILED(Completion.ResultCode) || Completion.Information != Slot.Length)
+        {
+          std::cerr << "PhragDat error: failed reading " << File->InputPath << " (file changed since scan?)" << std::endl;
+          InFlight--;
+          Result = 1;
+          continue;
+        }
+
+        PHD_StatsAdd(PHD_Stats.BytesRead, Slot.Length);
+        if(_Hash && !File->Reused)
+        {
+          PHD_ContentHash Hash;
+          PHD_ContentHashInit(&Hash);
+          PHD_ContentHashUpdate(&Hash, Data, Slot.Length);
+          File->Hash = PHD_ContentHashFinal(&Hash);
+        }
+        File->Checksum = PHD_Crc32c(0, Data, (size_t)Slot.Length);
+        memset(Data + Slot.Length, PHD_PAD_BYTE, PHD_PAD_SIZE);
+
+        if(Result || FAILED(PHD_IoRing.Write(Ring, IoRingHandleRefFromIndex(0), IoRingBufferRefFromIndexAndOffset(0, iSlot*PHD_IORING_SLOT_SIZE),
+                                             (UINT32)(Slot.Length + PHD_PAD_SIZE), File->Address, FILE_WRITE_FLAGS_NONE, iSlot*2 + 1, IOSQE_FLAGS_NONE)))
+        {
+          if(!Result) std::cerr << "PhragDat error: IoRing: failed to queue write of " << File->InputPath << std::endl;
+          InFlight--;
+          Result = 1;
+        }
+        continue;
+      }
+
+      InFlight--;
+      FreeSlots.push_back(iSlot);
+
+      if(FAILED(Completion.ResultCode) || Completion.Information != Slot.Length + PHD_PAD_SIZE)
+      {
+        std::cerr << "PhragDat error: failed writing data from " << File->InputPath << std::endl;
+        Result = 1;
+        continue;
+      }
+
+      double Seconds = PHD_GetSeconds() - Slot.StartTime;
+      PHD_StatsAdd(PHD_Stats.BytesWritten, Slot.Length + PHD_PAD_SIZE);
+      PHD_StatsFile(File->InputPath, Slot.Length, Seconds);
+      _Engine->BytesCopied += Slot.Length;
+      _Engine->Seconds += Seconds;
+
+      if(!FILE_REPORT) continue;
+      std::lock_guard<std::mutex> Lock(_ReportMutex);
+      std::cout << (File->Reused ? "Reusing: " : "Writing: ") << File->InputPath << " (" << std::fixed << std::setprecision(1)
+      << PHD_GetMBPerSecond(File->Length, Seconds) << " MB/s)\n";
+    }
+  }
+
+  // after a failure the slots still in flight have to land before the buffer goes
+  while(InFlight)
+  {
+    if(FAILED(PHD_IoRing.Submit(Ring, 1, INFINITE, NULL))) break;
+    while(PHD_IoRing.PopCompletion(Ring, &Completion) == S_OK)
+    {
+      PHDC_RingSlot &Slot = Slots[(size_t)(Completion.UserData / 2)];
+      if(Slot.Input != INVALID_HANDLE_VALUE) CloseHandle(Slot.Input);
+      Slot.Input = INVALID_HANDLE_VALUE;
+      InFlight--;
+    }
+  }
+
+  PHD_IoRing.Close(Ring);
+  VirtualFree(Buffer, 0, MEM_RELEASE);
+  return Result;
+#else
+  std::cerr << "PhragDat error: IoRing: not available in this build" << std::endl;
+  return 1;
+#endif
+}
+
+//===================================================
+// WriteDataParallel
+// _Threads workers each take the next file and copy
+// it to its precomputed Address in the (pre-sized)
+// .dat, every worker has its own output handle so
+// the positional writes are not serialized, reused
+// files are read from _OldDatPath (-u), with _IoRing
+// every worker copies through its own ring instead
+//===================================================
+static int
+PHD_WriteDataParallel(std::vector<PHDC_File*> &_Files,
+                      std::string _DatPath,
+                      std::string _OldDatPath,
+                      int _Threads,
+                      bool _Hash,
+                      bool _IoRing,
+                      uint64_t *_BytesCopied)
+{
+  std::atomic<uint64_t> NextFile(0);
+  std::atomic<uint64_t> BytesCopied(0);
+  std::atomic<bool> Failed(0);
+  std::mutex ReportMutex;
+
+  auto Worker = [&]()
+  {
+    HANDLE OutputDatFile = CreateFileA(_DatPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+    if(OutputDatFile == INVALID_HANDLE_VALUE)
+    {
+      std::lock_guard<std::mutex> Lock(ReportMutex);
+      std::cerr << "PhragDat error: failed to open " << _DatPath << " for writing" << std::endl;
+      Failed = 1;
+      return;
+    }
+
+    HANDLE OldDatFile = INVALID_HANDLE_VALUE;
+    if(!_OldDatPath.empty())
+    {
+      OldDatFile = CreateFileA(_OldDatPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+      if(OldDatFile == INVALID_HANDLE_VALUE)
+      {
+        std::lock_guard<std::mutex> Lock(ReportMutex);
+        std::cerr << "PhragDat error: failed to open " << _OldDatPath << " for reading" << std::endl;
+        Failed = 1;
+        CloseHandle(OutputDatFile);
+        return;
+      }
+    }
+
+    PHD_CopyEngine CopyEngine;
+    if(PHD_CopyEngineInit(&CopyEngine))
+    {
+      Failed = 1;
+      if(OldDatFile != INVALID_HANDLE_VALUE) CloseHandle(OldDatFile);
+      CloseHandle(OutputDatFile);
+      return;
+    }
+
+    // ring operations complete asynchronously only on overlapped handles
+    if(_IoRing)
+    {
+      HANDLE RingDatFile = CreateFileA(_DatPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+      HANDLE RingOldDatFile = INVALID_HANDLE_VALUE;
+      if(!_OldDatPath.empty()) RingOldDatFile = CreateFileA(_OldDatPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+      PHD_StatsAdd(PHD_Stats.OpenCalls, _OldDatPath.empty() ? 1 : 2);
+
+      if(RingDatFile == INVALID_HANDLE_VALUE || (!_OldDatPath.empty() && RingOldDatFile == INVALID_HANDLE_VALUE))
+      {
+        std::lock_guard<std::mutex> Lock(ReportMutex);
+        std::cerr << "PhragDat error: failed to open " << _DatPath << " for IoRing" << std::endl;
+        Failed = 1;
+      }
+
+      else if(PHD_IoRingCopy(_Files, NextFile, Failed, &CopyEngine, OutputDatFile, OldDatFile, RingDatFile, RingOldDatFile, _Hash, ReportMutex)) Failed = 1;
+
+      if(RingDatFile != INVALID_HANDLE_VALUE) CloseHandle(RingDatFile);
+      if(RingOldDatFile != INVALID_HANDLE_VALUE) CloseHandle(RingOldDatFile);
+    }
+
+    while(!Failed && !_IoRing)
+    {
+      uint64_t iFile = NextFile++;
+      if(iFile >= _Files.size()) break;
+
+      PHDC_File *File = _Files[iFile];
+      double FileSeconds = 0.0;
+      if(PHD_CopyFileEntry(&CopyEngine, File, OutputDatFile, File->Address, OldDatFile, _Hash, &FileSeconds))
+      {
+        Failed = 1;
+        break;
+      }
+
+      if(!FILE_REPORT) continue;
+      std::lock_guard<std::mutex> Lock(ReportMutex);
+      std::cout << (File->Reused ? "Reusing: " : "Writing: ") << File->InputPath << " (" << std::fixed << std::setprecision(1)
+      << PHD_GetMBPerSecond(File->Length, FileSeconds) << " MB/s)\n";
+    }
+
+    BytesCopied += CopyEngine.BytesCopied;
+    PHD_CopyEngineFree(&CopyEngine);
+    if(OldDatFile != INVALID_HANDLE_VALUE) CloseHandle(OldDatFile);
+    CloseHandle(OutputDatFile);
+  };
+
+  std::vector<std::thread> Workers;
+  for(int iThread = 0; iThread < _Threads; ++iThread)
+  {
+    Workers.push_back(std::thread(Worker));
+  }
+
+  for(int iThread = 0; iThread < _Threads; ++iThread)
+  {
+    Workers[iThread].join();
+  }
+
+  *_BytesCopied = BytesCopied;
+  return Failed ? 1 : 0;
+}
+
+//==================================================
+// Compression
+// -z stores every file as its own phragdat_lz.h
+// block so entries stay individually addressable
+//==================================================
+// Files are compressed in memory, so files over PHD_COMPRESS_MAX_SIZE go
+// through the copy engine stored. A block is only kept when it saves at
+// least 1/PHD_COMPRESS_MIN_SAVING of the file, anything else (already
+// compressed images, audio...) is stored and costs nothing to read back.
+#define PHD_COMPRESS_MAX_SIZE 0x10000000 // 256MB
+#define PHD_COMPRESS_MIN_SAVING 32
+#define PHD_COMPRESS_WINDOW 4 // files/blocks in flight per worker
+
+//===================================================
+// Solid Blocks
+// -s packs files smaller than PHD_SOLID_MAX_FILE
+// into blocks of up to PHD_SOLID_BLOCK_SIZE that
+// are compressed as one, so tiny files share one
+// dictionary and one read
+//===================================================
+#define PHD_SOLID_MAX_FILE 0x1000 // 4KB
+#define PHD_SOLID_BLOCK_SIZE 0x40000 // 256KB
+
+struct PHDC_Block
+{
+  std::vector<PHDC_File*> Files; // each file's Address is its offset in the decoded block
+  uint64_t Address; // address inside .dat
+  uint64_t Length; // decoded size in bytes
+  uint64_t StoredLength; // bytes written at Address
+  uint32_t Method; // PHD_METHOD_STORE or PHD_METHOD_LZ
+  uint32_t Checksum; // CRC32C of the stored bytes
+};
+
+struct PHDC_CompressSlot
+{
+  std::vector<uint8_t> Data; // stored bytes + pad, empty if the copy engine writes it
+  bool Ready;
+};
+
+//=================================================
+// PackSolidBlocks
+// moves files smaller than PHD_SOLID_MAX_FILE from
+// _Files into _Blocks (hot files stay, see Access
+// Traces), traced files (-l) first in trace order,
+// the rest grouped by directory then extension so
+// similar files share a block
+//=================================================
+static void
+PHD_PackSolidBlocks(std::vector<PHDC_File*> &_Files,
+                    std::vector<PHDC_Block> &_Blocks)
+{
+  std::vector<PHDC_File*> LargeFiles;
+  std::vector<PHDC_File*> SmallFiles;
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile)
+  {
+    if(_Files[iFile]->Length < PHD_SOLID_MAX_FILE && !_Files[iFile]->Hot) SmallFiles.push_back(_Files[iFile]);
+    else LargeFiles.push_back(_Files[iFile]);
+  }
+
+  // (directory, extension), stable so names stay sorted within a group
+  auto SolidKey = [](const PHDC_File *_File)
+  {
+    std::string_view Path(_File->DatPath);
+    size_t NameStart = Path.rfind('/');
+    NameStart = (NameStart == std::string_view::npos) ? 0 : NameStart+1;
+    size_t Dot = Path.rfind('.');
+    std::string_view Extension = (Dot == std::string_view::npos || Dot < NameStart) ? std::string_view() : Path.substr(Dot);
+    return std::make_pair(Path.substr(0, NameStart), Extension);
+  };
+
+  std::stable_sort(SmallFiles.begin(), SmallFiles.end(), [&](const PHDC_File *_A, const PHDC_File *_B)
+  {
+    if(_A->TraceOrder != _B->TraceOrder) return _A->TraceOrder < _B->TraceOrder;
+    return SolidKey(_A) < SolidKey(_B);
+  });
+
+  for(size_t iFile = 0; iFile < SmallFiles.size(); ++iFile)
+  {
+    PHDC_File *File = SmallFiles[iFile];
+    if(_Blocks.empty() || _Blocks.back().Length + File->Length > PHD_SOLID_BLOCK_SIZE)
+    {
+      _Blocks.push_back(PHDC_Block());
+      _Blocks.back().Address = 0;
+      _Blocks.back().Length = 0;
+      _Blocks.back().StoredLength = 0;
+      _Blocks.back().Method = PHD_METHOD_STORE;
+      _Blocks.back().Checksum = 0;
+    }
+
+    PHDC_Block &Block = _Blocks.back();
+    File->Block = (uint32_t)(_Blocks.size()-1);
+    File->Address = Block.Length;
+    File->StoredLength = File->Length;
+    File->Method = PHD_METHOD_SOLID;
+    Block.Files.push_back(File);
+    Block.Length += File->Length;
+  }
+
+  _Files.swap(LargeFiles);
+}
+
+//===========================================
+// ReadWholeFile
+// reads exactly _Length bytes of _InputPath
+//===========================================
+static int
+PHD_ReadWholeFile(const char *_InputPath,
+                  uint64_t _Length,
+                  uint8_t *_Buffer)
+{
+  HANDLE InputFile = CreateFileA(_InputPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+  if(InputFile == INVALID_HANDLE_VALUE)
+  {
+    std::cerr << "PhragDat error: failed reading " << _InputPath << std::endl;
+    return 1;
+  }
+
+  uint64_t Remaining = _Length;
+  while(Remaining)
+  {
+    DWORD ToRead = (DWORD)std::min<uint64_t>(Remaining, PHD_COPY_BUFFER_SIZE);
+    DWORD BytesRead = 0;
+    if(!ReadFile(InputFile, _Buffer, ToRead, &BytesRead, NULL) || !BytesRead)
+    {
+      std::cerr << "PhragDat error: failed reading " << _InputPath << " (file changed since scan?)" << std::endl;
+      CloseHandle(InputFile);
+      return 1;
+    }
+
+    PHD_StatsRead(BytesRead);
+    _Buffer += BytesRead;
+    Remaining -= BytesRead;
+  }
+
+  CloseHandle(InputFile);
+  return 0;
+}
+
+//=====================================================
+// CompressEntry
+// LZ compresses _Input into _Output, keeping the block
+// unless it saves too little, then appends the pad,
+// _Input may be left empty
+//=====================================================
+static void
+PHD_CompressEntry(PHD_LzState *_State,
+                  std::vector<uint8_t> &_Input,
+                  std::vector<uint8_t> &_Output,
+                  uint32_t *_Method,
+                  uint64_t *_StoredLength,
+                  uint32_t *_Checksum)
+{
+  uint64_t Length = _Input.size();
+  _Output.resize(PHD_LzCompressBound(_Input.size()) + PHD_PAD_SIZE);
+  size_t Compressed = PHD_LzCompress(_State, &_Input[0], _Input.size(), &_Output[0], _Output.size() - PHD_PAD_SIZE);
+
+  if(Compressed && Compressed <= Length - Length/PHD_COMPRESS_MIN_SAVING)
+  {
+    _Output.resize(Compressed);
+    *_Method = PHD_METHOD_LZ;
+    *_StoredLength = Compressed;
+  }
+  else
+  {
+    _Output.swap(_Input);
+    *_Method = PHD_METHOD_STORE;
+    *_StoredLength = Length;
+  }
+
+  *_Checksum = PHD_Crc32c(0, _Output.data(), _Output.size());
+  _Output.insert(_Output.end(), PHD_PAD_SIZE, (uint8_t)PHD_PAD_BYTE);
+}
+
+//=======================================================
+// WriteDataOrdered
+// _Threads workers read (and with _Compress, compress)
+// _Files then pack and compress _Blocks, the calling
+// thread writes them to _Output in that order and sets
+// their (_Alignment aligned) Address starting at
+// *_Address (left at the end of the data), at most
+// PHD_COMPRESS_WINDOW items per worker wait in memory,
+// with _Hash every file is hashed and reused files are
+// copied from _OldDat (-u)
+//=======================================================
+static int
+PHD_WriteDataOrdered(std::vector<PHDC_File*> &_Files,
+                     std::vector<PHDC_Block> &_Blocks,
+                     HANDLE _Output,
+                     HANDLE _OldDat,
+                     int _Threads,
+                     bool _Compress,
+                     bool _Hash,
+                     uint64_t _Alignment,
+                     uint64_t *_Address,
+                     uint64_t *_BytesCopied,
+                     uint64_t *_BytesStored)
+{
+  uint64_t Items = _Files.size() + _Blocks.size(); // files first, then blocks
+  uint64_t Window = (uint64_t)_Threads * PHD_COMPRESS_WINDOW;
+  std::vector<PHDC_CompressSlot> Slots(Window);
+  uint64_t NextItem = 0; // next item a worker claims
+  uint64_t Written = 0; // items appended so far
+  bool Failed = 0;
+  std::mutex Mutex;
+  std::condition_variable Changed;
+
+  auto Worker = [&]()
+  {
+    std::unique_ptr<PHD_LzState> State(new PHD_LzState);
+    std::vector<uint8_t> Input;
+
+    auto Hash = [](const uint8_t *_Data, uint64_t _Length)
+    {
+      PHD_ContentHash ContentHash;
+      PHD_ContentHashInit(&ContentHash);
+      PHD_ContentHashUpdate(&ContentHash, _Data, _Length);
+      return PHD_ContentHashFinal(&ContentHash);
+    };
+
+    for(;;)
+    {
+      uint64_t iItem;
+      {
+        std::unique_lock<std::mutex> Lock(Mutex);
+        Changed.wait(Lock, [&]{return Failed || NextItem >= Items || NextItem < Written + Window;});
+        if(Failed || NextItem >= Items) return;
+        iItem = NextItem++;
+      }
+
+      PHDC_CompressSlot &Slot = Slots[iItem % Window];
+      Slot.Data.clear();
+      int Result = 0;
+      double ItemStartTime = PHD_GetSeconds();
+
+      if(iItem < _Files.size())
+      {
+        PHDC_File *File = _Files[iItem];
+
+        // stored, reused and files too big to hold in memory are copied by the writer
+        if(!File->Reused && _Compress && File->Length <= PHD_COMPRESS_MAX_SIZE)
+        {
+          File->Method = PHD_METHOD_STORE;
+          File->StoredLength = File->Length;
+          Input.resize((size_t)File->Length);
+          Result = PHD_ReadWholeFile(File->InputPath.data(), File->Length, &Input[0]);
+          if(!Result && _Hash) File->Hash = Hash(Input.data(), File->Length);
+
+          // touched but unchanged, the previous build already compressed it
+          if(!Result && File->Previous && File->Previous->Length == File->Length && File->Previous->Hash == File->Hash)
+          {
+            File->Reused = 1;
+            File->Method = File->Previous->Method;
+            File->StoredLength = File->Previous->StoredLength;
+          }
+          else if(!Result) PHD_CompressEntry(State.get(), Input, Slot.Data, &File->Method, &File->StoredLength, &File->Checksum);
+        }
+      }
+
+      else
+      {
+        PHDC_Block *Block = &_Blocks[iItem - _Files.size()];
+        Input.resize((size_t)Block->Length);
+        for(size_t iFile = 0; iFile < Block->Files.size() && !Result; ++iFile)
+        {
+          Result = PHD_ReadWholeFile(Block->Files[iFile]->InputPath.data(), Block->Files[iFile]->Length, &Input[(size_t)Block->Files[iFile]->Address]);
+          if(!Result && _Hash) Block->Files[iFile]->Hash = Hash(&Input[(size_t)Block->Files[iFile]->Address], Block->Files[iFile]->Length);
+        }
+        if(!Result) PHD_CompressEntry(State.get(), Input, Slot.Data, &Block->Method, &Block->StoredLength, &Block->Checksum);
+      }
+
+      // items the writer copies are timed by the copy engine
+      if(!Result && Slot.Data.size() && PHD_Stats.RecordFiles)
+      {
+        std::stringstream ssName;
+        if(iItem < _Files.size()) ssName << _Files[iItem]->InputPath;
+        else ssName << "solid block " << iItem - _Files.size();
+        PHD_StatsFile(ssName.str(), (iItem < _Files.size()) ? _Files[iItem]->Length : _Blocks[iItem - _Files.size()].Length, PHD_GetSeconds() - ItemStartTime);
+      }
+
+      std::lock_guard<std::mutex> Lock(Mutex);
+      if(Result) Failed = 1;
+      Slot.Ready = 1;
+      Changed.notify_all();
+      if(Failed) return;
+    }
+  };
+
+  PHD_CopyEngine CopyEngine;
+  if(PHD_CopyEngineInit(&CopyEngine)) return 1;
+
+  std::vector<std::thread> Workers;
+  for(int iThread = 0; iThread < _Threads; ++iThread)
+  {
+    Workers.push_back(std::thread(Worker));
+  }
+
+  uint64_t BytesCopied = 0;
+  uint64_t BytesStored = 0;
+  for(uint64_t iItem = 0; iItem < Items; ++iItem)
+  {
+    PHDC_CompressSlot &Slot = Slots[iItem % Window];
+    {
+      std::unique_lock<std::mutex> Lock(Mutex);
+      Changed.wait(Lock, [&]{return Failed || Slot.Ready;});
+      if(Failed) break;
+    }
+
+    int Result = 0;
+    uint64_t Length, StoredLength, StartAddress;
+    uint32_t Method;
+    std::stringstream ssName;
+
+    if(iItem < _Files.size())
+    {
+      PHDC_File *File = _Files[iItem];
+      File->Address = PHD_AlignAddress(*_Address, File->StoredLength, _Alignment);
+      *_Address = File->Address;
+      if(Slot.Data.size()) Result = PHD_WriteBlock(_Output, &Slot.Data[0], (DWORD)Slot.Data.size(), _Address);
+      else Result = PHD_CopyFileEntry(&CopyEngine, File, _Output, *_Address, _OldDat, _Hash, NULL);
+
+      ssName << File->InputPath;
+      if(File->Reused) ssName << " (reused)";
+      StartAddress = File->Address;
+      Length = File->Length;
+      StoredLength = File->StoredLength;
+      Method = File->Method;
+    }
+
+    else
+    {
+      PHDC_Block *Block = &_Blocks[iItem - _Files.size()];
+      Block->Address = PHD_AlignAddress(*_Address, Block->StoredLength, _Alignment);
+      *_Address = Block->Address;
+      Result = PHD_WriteBlock(_Output, &Slot.Data[0], (DWORD)Slot.Data.size(), _Address);
+
+      ssName << "solid block " << iItem - _Files.size() << " (" << Block->Files.size() << " files)";
+      StartAddress = Block->Address;
+      Length = Block->Length;
+      StoredLength = Block->StoredLength;
+      Method = Block->Method;
+    }
+
+    if(Result) std::cerr << "PhragDat error: failed writing data from " << ssName.str() << std::endl;
+    else if(FILE_REPORT)
+    {
+      std::cout << "Writing: " << ssName.str() << " ("
+      << ((Method == PHD_METHOD_LZ) ? "lz " : "stored ") << std::fixed << std::setprecision(1)
+      << 100.0*(double)StoredLength / (double)Length << "%)\n";
+    }
+
+    *_Address = StartAddress + StoredLength + PHD_PAD_SIZE; // see Copy Engine pad policy
+    BytesCopied += Length;
+    BytesStored += StoredLength;
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if(Result) Failed = 1;
+    Slot.Ready = 0;
+    Slot.Data = std::vector<uint8_t>();
+    Written++;
+    Changed.notify_all();
+    if(Failed) break;
+  }
+
+  for(int iThread = 0; iThread < _Threads; ++iThread)
+  {
+    Workers[iThread].join();
+  }
+
+  PHD_CopyEngineFree(&CopyEngine);
+
+  *_BytesCopied = BytesCopied;
+  *_BytesStored = BytesStored;
+  return Failed ? 1 : 0;
+}
+
+//=====================================================
+// BuildMphf
+// seeds of one partition's minimal perfect hash over
+// _Hashes (see phragdat_format.h), _Slots[i] is key
+// i's slot. Biggest buckets are placed first while
+// most slots are free, each takes the first hash
+// selector and displacement that puts all of its keys
+// on free slots. Returns 1 if two keys are equal (no
+// seed can separate them) or there are too many
+//=====================================================
+static int
+PHD_BuildMphf(const uint64_t *_Hashes,
+              uint64_t _Count,
+              std::vector<uint16_t> &_Seeds,
+              std::vector<uint64_t> &_Slots)
+{
+  if(_Count > (1 << PHD_MPHF_DISPLACEMENT_BITS)) return 1;
+
+  uint64_t BucketCount = (_Count + PHD_MPHF_BUCKET_KEYS-1) / PHD_MPHF_BUCKET_KEYS;
+  _Seeds.assign(BucketCount, 0);
+  _Slots.assign(_Count, 0);
+
+  // keys grouped by bucket (counting sort)
+  std::vector<uint64_t> KeyBucket(_Count);
+  std::vector<uint64_t> BucketStart(BucketCount+1, 0);
+  for(uint64_t iKey = 0; iKey < _Count; ++iKey)
+  {
+    KeyBucket[iKey] = PHD_MphfBucket(_Hashes[iKey], BucketCount);
+    ++BucketStart[KeyBucket[iKey]+1];
+  }
+  for(uint64_t iBucket = 0; iBucket < BucketCount; ++iBucket) BucketStart[iBucket+1] += BucketStart[iBucket];
+
+  std::vector<uint64_t> BucketKeys(_Count);
+  {
+    std::vector<uint64_t> Next(BucketStart.begin(), BucketStart.end()-1);
+    for(uint64_t iKey = 0; iKey < _Count; ++iKey) BucketKeys[Next[KeyBucket[iKey]]++] = iKey;
+  }
+
+  // buckets by size, biggest first, in bucket order within a size (counting sort, sizes over 64
+  // only come from equal keys and fail below)
+  std::vector<uint64_t> Order(BucketCount);
+  {
+    uint64_t SizeStart[66] = {};
+    for(uint64_t iBucket = 0; iBucket < BucketCount; ++iBucket) ++SizeStart[64 - std::min<uint64_t>(BucketStart[iBucket+1] - BucketStart[iBucket], 64) + 1];
+    for(int iSize = 0; iSize < 65; ++iSize) SizeStart[iSize+1] += SizeStart[iSize];
+    for(uint64_t iBucket = 0; iBucket < BucketCount; ++iBucket) Order[SizeStart[64 - std::min<uint64_t>(BucketStart[iBucket+1] - BucketStart[iBucket], 64)]++] = iBucket;
+  }
+
+  std::vector<uint8_t> Taken(_Count, 0);
+  uint64_t Positions[64];
+
+  for(uint64_t iOrder = 0; iOrder < BucketCount; ++iOrder)
+  {
+    uint64_t Bucket = Order[iOrder];
+    const uint64_t *Keys = &BucketKeys[BucketStart[Bucket]];
+    uint64_t Size = BucketStart[Bucket+1] - BucketStart[Bucket];
+    if(!Size) break; // the rest are empty too
+    if(Size > 64) return 1;
+
+    bool Placed = 0;
+    for(uint32_t Selector = 0; Selector < PHD_MPHF_SELECTORS && !Placed; ++Selector)
+    {
+      // slots before displacement, keys sharing one can not be separated by sliding
+      uint16_t Seed = (uint16_t)(Selector << PHD_MPHF_DISPLACEMENT_BITS);
+      bool Distinct = 1;
+      for(uint64_t iKey = 0; iKey < Size && Distinct; ++iKey)
+      {
+        Positions[iKey] = PHD_MphfSlot(_Hashes[Keys[iKey]], Seed, _Count);
+        for(uint64_t jKey = 0; jKey < iKey; ++jKey) if(Positions[jKey] == Positions[iKey]) Distinct = 0;
+      }
+      if(!Distinct) continue;
+
+      for(uint64_t Displacement = 0; Displacement < _Count; ++Displacement)
+      {
+        bool Free = 1;
+        for(uint64_t iKey = 0; iKey < Size && Free; ++iKey)
+        {
+          uint64_t Slot = Positions[iKey] + Displacement;
+          Free = !Taken[(Slot >= _Count) ? Slot - _Count : Slot];
+        }
+        if(!Free) continue;
+
+        _Seeds[Bucket] = (uint16_t)(Seed | Displacement);
+        for(uint64_t iKey = 0; iKey < Size; ++iKey)
+        {
+          uint64_t Slot = Positions[iKey] + Displacement;
+          if(Slot >= _Count) Slot -= _Count;
+          Taken[Slot] = 1;
+          _Slots[Keys[iKey]] = Slot;
+        }
+        Placed = 1;
+        break;
+      }
+    }
+
+    if(!Placed) return 1;
+  }
+
+  return 0;
+}
+
+//=====================================================
+// BuildIndex
+// partitioned minimal perfect hash over _Hashes for
+// the table of contents and the -g header (see
+// phragdat_format.h), the partitions are built by
+// _Threads threads, _Slots[i] is key i's slot.
+// Returns 1 like PHD_BuildMphf
+//=====================================================
+static int
+PHD_BuildIndex(const std::vector<uint64_t> &_Hashes,
+               int _Threads,
+               std::vector<PHD_TocPartition> &_Partitions,
+               std::vector<uint16_t> &_Seeds,
+               std::vector<uint64_t> &_Slots)
+{
+  uint64_t KeyCount = _Hashes.size();
+  uint64_t PartitionCount = std::max<uint64_t>(1, (KeyCount + PHD_MPHF_PARTITION_KEYS-1) / PHD_MPHF_PARTITION_KEYS);
+
+  // keys grouped by partition (counting sort), hashes copied so each partition's are contiguous
+  std::vector<uint32_t> KeyPartition(KeyCount);
+  std::vector<uint64_t> PartitionStart(PartitionCount+1, 0);
+  for(uint64_t iKey = 0; iKey < KeyCount; ++iKey)
+  {
+    KeyPartition[iKey] = (uint32_t)PHD_MphfPartition(_Hashes[iKey], PartitionCount);
+    ++PartitionStart[KeyPartition[iKey]+1];
+  }
+  for(uint64_t iPartition = 0; iPartition < PartitionCount; ++iPartition) PartitionStart[iPartition+1] += PartitionStart[iPartition];
+
+  std::vector<uint64_t> PartitionKeys(KeyCount);
+  std::vector<uint64_t> PartitionHashes(KeyCount);
+  {
+    std::vector<uint64_t> Next(PartitionStart.begin(), PartitionStart.end()-1);
+    for(uint64_t iKey = 0; iKey < KeyCount; ++iKey)
+    {
+      uint64_t Position = Next[KeyPartition[iKey]]++;
+      PartitionKeys[Position] = iKey;
+      PartitionHashes[Position] = _Hashes[iKey];
+    }
+  }
+  KeyPartition = std::vector<uint32_t>();
+
+  _Partitions.resize(PartitionCount+1);
+  uint64_t BucketCount = 0;
+  for(uint64_t iPartition = 0; iPartition <= PartitionCount; ++iPartition)
+  {
+    _Partitions[iPartition].SlotOffset = (uint32_t)PartitionStart[iPartition];
+    _Partitions[iPartition].BucketOffset = (uint32_t)BucketCount;
+    if(iPartition < PartitionCount) BucketCount += (PartitionStart[iPartition+1] - PartitionStart[iPartition] + PHD_MPHF_BUCKET_KEYS-1) / PHD_MPHF_BUCKET_KEYS;
+  }
+
+  _Seeds.assign(BucketCount, 0);
+  _Slots.assign(KeyCount, 0);
+
+  // partitions write disjoint seeds and slots, nothing is shared but the counter
+  std::atomic<uint64_t> NextPartition(0);
+  std::atomic<bool> Failed(0);
+  auto Worker = [&]()
+  {
+    std::vector<uint16_t> Seeds;
+    std::vector<uint64_t> Slots;
+    while(!Failed)
+    {
+      uint64_t iPartition = NextPartition++;
+      if(iPartition >= PartitionCount) break;
+
+      uint64_t Start = PartitionStart[iPartition];
+      uint64_t Count = PartitionStart[iPartition+1] - Start;
+      if(PHD_BuildMphf(&PartitionHashes[Start], Count, Seeds, Slots))
+      {
+        Failed = 1;
+        break;
+      }
+
+      for(size_t iSeed = 0; iSeed < Seeds.size(); ++iSeed) _Seeds[_Partitions[iPartition].BucketOffset + iSeed] = Seeds[iSeed];
+      for(uint64_t iKey = 0; iKey < Count; ++iKey) _Slots[PartitionKeys[Start + iKey]] = Start + Slots[iKey];
+    }
+  };
+
+  std::vector<std::thread> Workers;
+  for(int iThread = 1; iThread < _Threads; ++iThread) {Workers.push_back(std::thread(Worker));}
+  Worker();
+  for(size_t iThread = 0; iThread < Workers.size(); ++iThread) {Workers[iThread].join();}
+
+  return Failed ? 1 : 0;
+}
+
+//=================================================
+// WriteToc
+// builds the table of contents (phragdat_format.h)
+// for _Files and _Blocks and writes it at _DataEnd
+// rounded up to PHD_TOC_ALIGN, footer last, with
+// _Append at the file pointer (which must be at
+// _DataEnd) so _Output can be a pipe. The index
+// is built with _Threads threads
+//=================================================
+static int
+PHD_WriteToc(HANDLE _Output,
+             std::vector<PHDC_File*> &_Files,
+             std::vector<PHDC_Block> &_Blocks,
+             uint64_t _Alignment,
+             uint64_t _DataEnd,
+             bool _Append,
+             int _Threads)
+{
+  uint64_t TocAddress = (_DataEnd + PHD_TOC_ALIGN-1) & ~(uint64_t)(PHD_TOC_ALIGN-1);
+
+  if((uint64_t)_Files.size() >= 0xffffffff)
+  {
+    std::cerr << "PhragDat error: the table of contents holds under 4G files" << std::endl;
+    return 1;
+  }
+
+  std::vector<uint64_t> Hashes(_Files.size());
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile) Hashes[iFile] = PHD_HashPath(_Files[iFile]->DatPath);
+
+  // entries go in slot order, only two paths with the same 64-bit hash need the probed table (by path)
+  std::vector<PHD_TocPartition> Partitions;
+  std::vector<uint16_t> Seeds;
+  std::vector<uint64_t> Slots;
+  uint32_t IndexType = PHD_INDEX_MPHF;
+  if(PHD_BuildIndex(Hashes, _Threads, Partitions, Seeds, Slots))
+  {
+    IndexType = PHD_INDEX_TABLE;
+    for(size_t iFile = 0; iFile < _Files.size(); ++iFile) Slots[iFile] = iFile;
+  }
+
+  std::vector<PHD_TocEntry> Entries(_Files.size());
+  std::vector<PHD_TocBlock> TocBlocks(_Blocks.size());
+  std::string Strings;
+
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile)
+  {
+    std::string_view DatPath = _Files[iFile]->DatPath;
+    if(Strings.length() + DatPath.length() > 0xffffffff)
+    {
+      std::cerr << "PhragDat error: path table exceeds 4GB" << std::endl;
+      return 1;
+    }
+
+    PHD_TocEntry &Entry = Entries[Slots[iFile]];
+    Entry.Hash = Hashes[iFile];
+    Entry.Offset = _Files[iFile]->Address;
+    Entry.Length = _Files[iFile]->Length;
+    Entry.StoredLength = _Files[iFile]->StoredLength;
+    Entry.Method = _Files[iFile]->Method;
+    Entry.Block = _Files[iFile]->Block;
+    Entry.Checksum = (_Files[iFile]->Method == PHD_METHOD_SOLID) ? 0 : _Files[iFile]->Checksum;
+    Entry.PathOffset = (uint32_t)Strings.length();
+    Entry.PathLength = (uint32_t)DatPath.length();
+    Strings += DatPath;
+  }
+
+  std::vector<uint8_t> Index;
+  uint64_t IndexCount;
+  if(IndexType == PHD_INDEX_MPHF)
+  {
+    uint64_t FingerprintsOffset = Partitions.size()*sizeof(PHD_TocPartition);
+    uint64_t SeedsOffset = (FingerprintsOffset + Entries.size() + 1) & ~(uint64_t)1;
+    Index.assign(SeedsOffset + Seeds.size()*sizeof(uint16_t), 0);
+    memcpy(&Index[0], Partitions.data(), FingerprintsOffset);
+    for(size_t iEntry = 0; iEntry < Entries.size(); ++iEntry) Index[FingerprintsOffset + iEntry] = PHD_MphfFingerprint(Entries[iEntry].Hash);
+    if(Seeds.size()) memcpy(&Index[SeedsOffset], Seeds.data(), Seeds.size()*sizeof(uint16_t));
+    IndexCount = Partitions.size()-1;
+  }
+
+  else
+  {
+    // open addressed table at most half full, so lookups mostly take one probe
+    uint64_t TableSlots = 1;
+    while(TableSlots < (uint64_t)_Files.size()*2) TableSlots <<= 1;
+
+    std::vector<uint32_t> Table(TableSlots, 0);
+    for(size_t iEntry = 0; iEntry < Entries.size(); ++iEntry)
+    {
+      uint64_t Slot = Entries[iEntry].Hash & (TableSlots-1);
+      while(Table[Slot]) Slot = (Slot+1) & (TableSlots-1);
+      Table[Slot] = (uint32_t)(iEntry+1);
+    }
+
+    Index.resize(TableSlots*sizeof(uint32_t));
+    memcpy(&Index[0], Table.data(), Index.size());
+    IndexCount = TableSlots;
+  }
+
+  // hot files (-p) are written first and never in a block, so their stored bytes are one range
+  uint64_t HotStart = 0, HotEnd = 0;
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile)
+  {
+    if(!_Files[iFile]->Hot) continue;
+    if(!HotEnd || _Files[iFile]->Address < HotStart) HotStart = _Files[iFile]->Address;
+    HotEnd = std::max(HotEnd, _Files[iFile]->Address + _Files[iFile]->StoredLength);
+  }
+
+  for(size_t iBlock = 0; iBlock < _Blocks.size(); ++iBlock)
+  {
+    TocBlocks[iBlock].Offset = _Blocks[iBlock].Address;
+    TocBlocks[iBlock].Length = _Blocks[iBlock].Length;
+    TocBlocks[iBlock].StoredLength = _Blocks[iBlock].StoredLength;
+    TocBlocks[iBlock].Method = _Blocks[iBlock].Method;
+    TocBlocks[iBlock].FileCount = (uint32_t)_Blocks[iBlock].Files.size();
+    TocBlocks[iBlock].Checksum = _Blocks[iBlock].Checksum;
+  }
+
+  PHD_TocFooter Footer = {};
+  Footer.EntriesOffset = TocAddress;
+  Footer.EntryCount = Entries.size();
+  Footer.BlocksOffset = Footer.EntriesOffset + Entries.size()*sizeof(PHD_TocEntry);
+  Footer.BlockCount = TocBlocks.size();
+  Footer.IndexOffset = Footer.BlocksOffset + TocBlocks.size()*sizeof(PHD_TocBlock);
+  Footer.IndexCount = IndexCount;
+  Footer.IndexType = IndexType;
+  Footer.StringsOffset = Footer.IndexOffset + Index.size();
+  Footer.StringsLength = Strings.length();
+  Footer.HotOffset = HotStart;
+  Footer.HotLength = HotEnd - HotStart;
+  Footer.TocVersion = PHD_TOC_VERSION;
+  Footer.Alignment = (uint32_t)_Alignment;
+  memcpy(Footer.Magic, PHD_TocMagic, sizeof(Footer.Magic));
+
+  // parts are back to back from EntriesOffset, so this is one CRC over the table of contents
+  uint32_t Checksum = PHD_Crc32c(0, Entries.data(), Entries.size()*sizeof(PHD_TocEntry));
+  Checksum = PHD_Crc32c(Checksum, TocBlocks.data(), TocBlocks.size()*sizeof(PHD_TocBlock));
+  Checksum = PHD_Crc32c(Checksum, Index.data(), Index.size());
+  Checksum = PHD_Crc32c(Checksum, Strings.data(), Strings.length());
+  Footer.Checksum = PHD_Crc32c(Checksum, &Footer, offsetof(PHD_TocFooter, Checksum));
+
+  struct {const void *Data; uint64_t Size;} Parts[6] =
+  {
+    {"\0\0\0\0\0\0\0", TocAddress - _DataEnd},
+    {Entries.data(), Entries.size()*sizeof(PHD_TocEntry)},
+    {TocBlocks.data(), TocBlocks.size()*sizeof(PHD_TocBlock)},
+    {Index.data(), Index.size()},
+    {Strings.data(), Strings.length()},
+    {&Footer, sizeof(Footer)}
+  };
+
+  uint64_t Address = _DataEnd;
+  for(int iPart = 0; iPart < 6; ++iPart)
+  {
+    // WriteFile takes a DWORD size, write anything bigger in 1GB pieces
+    const uint8_t *Data = (const uint8_t*)Parts[iPart].Data;
+    uint64_t Remaining = Parts[iPart].Size;
+    while(Remaining)
+    {
+      DWORD Size = (DWORD)std::min<uint64_t>(Remaining, 0x40000000);
+      if(PHD_WriteBlock(_Output, Data, Size, _Append ? NULL : &Address)) return 1;
+      Data += Size;
+      Remaining -= Size;
+    }
+  }
+
+  return 0;
+}
+
+//=================================================
+// LoadExclusions
+// reads the rules in _ExclusionsPath (if any) and
+// compiles them into _Exclusions, progress goes to
+// _Report
+//=================================================
+static int
+PHD_LoadExclusions(std::string _ExclusionsPath,
+                   std::ostream &_Report,
+                   PHDC_ExclusionMatcher *_Exclusions)
+{
+  std::vector<std::string> ExclusionRules;
+
+  if(_ExclusionsPath.length())
+  {
+    std::string ExcludeStr;
+    std::ifstream ExclusionFile;
+
+    ExclusionFile.open(_ExclusionsPath, std::ios::in | std::ios::binary);
+    if(ExclusionFile.is_open())
+    {
+      _Report << "Found exclusion list, importing..." << std::endl;
+      char c;
+      while(ExclusionFile.get(c))
+      {
+        if(c == '\n')
+        {
+          // remove pesky carriage returns from windows encoded text
+          if(ExcludeStr.length() && ExcludeStr.back()==0xd) ExcludeStr.pop_back();
+          if(ExcludeStr.length()) ExclusionRules.push_back(ExcludeStr);
+          ExcludeStr.clear();
+        }
+        else ExcludeStr.push_back(c);
+      }
+
+      if(ExcludeStr.length() && ExcludeStr.back()==0xd) ExcludeStr.pop_back();
+      if(ExcludeStr.length()) ExclusionRules.push_back(ExcludeStr);
+
+      ExclusionFile.close();
+    }
+
+    else //ExclusionFile didnt open
+    {
+      std::cerr << "Unable to open Exclusions list, ignoring and continuing" << std::endl;
+    }
+  }
+
+  if(PHD_CompileExclusions(ExclusionRules, _Exclusions)) return 1;
+
+  // report to user
+  for(size_t iRule = 0; iRule < _Exclusions->Rules.size(); ++iRule)
+  {
+    _Report << (_Exclusions->RuleNegated[iRule] ? "Adding inclusion: " : "Adding exclusion: ") << _Exclusions->Rules[iRule] << std::endl;
+  }
+
+  return 0;
+}
+
+//=================================================
+// WriteCsv
+// writes the .csv contents file for _Files,
+// progress goes to _Report
+//=================================================
+static int
+PHD_WriteCsv(std::string _CsvPath,
+             const std::vector<PHDC_File*> &_Files,
+             std::vector<PHDC_Block> &_Blocks,
+             bool _Compress,
+             bool _Solid,
+             std::ostream &_Report)
+{
+  _Report << "Writing: " << _CsvPath << "..." << std::endl;
+
+  // write contents.csv file
+  {
+    FILE *OutputCSVFile;
+    OutputCSVFile = fopen(_CsvPath.c_str(), "wb");
+
+    if(!OutputCSVFile)
+    {
+      std::cerr << "PhragDat error: failed writing " << _CsvPath << ", exiting..." << std::endl;
+      return 1;
+    }
+
+    // write header
+    {
+      std::stringstream ssHeader;
+      ssHeader << "\"PHRDAT\"," << (int)VER_MAJ << "," << (int)VER_MIN << "\n";
+      std::string FileContents = ssHeader.str();
+      fwrite(&FileContents[0], 1, FileContents.length(), OutputCSVFile);
+    }
+
+    // write file contents
+    for(int iFile = 0; iFile < _Files.size(); ++iFile)
+    {
+      std::stringstream ssContents;
+      PHDC_File *File = _Files[iFile];
+      PHDC_Block *Block = (File->Block != PHD_NO_BLOCK) ? &_Blocks[File->Block] : NULL;
+
+      // files in a solid block point at their block, the offset inside the decoded block comes last
+      ssContents << "\"" << File->DatPath
+      << "\"," << (uint64_t)(Block ? Block->Address : File->Address)
+      << "," << (uint64_t)File->Length;
+
+      // -z/-s: what is actually at Address
+      if(_Compress || _Solid) ssContents << "," << (uint64_t)(Block ? Block->StoredLength : File->StoredLength) << "," << (Block ? Block->Method : File->Method);
+      if(_Solid) ssContents << "," << (Block ? (int64_t)File->Block : (int64_t)-1) << "," << (uint64_t)(Block ? File->Address : 0);
+      ssContents << "\n";
+      std::string FileContents = ssContents.str();
+      fwrite(&FileContents[0], 1, FileContents.length(), OutputCSVFile);
+    }
+
+    fclose(OutputCSVFile);
+  }
+
+  _Report << _CsvPath << " written" << std::endl;
+
+  return 0;
+}
+
+//================================
+// CppString
+// _String as a C++ string literal
+//================================
+static std::string
+PHD_CppString(std::string_view _String)
+{
+  std::string Output = "\"";
+  for(char Char : _String)
+  {
+    if(Char == '"' || Char == '\\') {Output.push_back('\\'); Output.push_back(Char);}
+
+    // octal escapes stop after 3 digits, unlike \x
+    else if((uint8_t)Char < 0x20 || (uint8_t)Char >= 0x7f)
+    {
+      char Escape[8];
+      snprintf(Escape, sizeof(Escape), "\\%03o", (unsigned)(uint8_t)Char);
+      Output += Escape;
+    }
+
+    else Output.push_back(Char);
+  }
+  Output.push_back('"');
+  return Output;
+}
+
+//==================================================================
+// WriteHeader
+// writes the C++17 contents header (-g) for _Files: constexpr
+// entries in the slot order of the same minimal perfect hash as
+// the table of contents, so phd::find is two mixes and one
+// compare with nothing to load at startup, see PHD_HelpStr
+//==================================================================
+static int
+PHD_WriteHeader(std::string _HeaderPath,
+                std::string _SimpleName,
+                const std::vector<PHDC_File*> &_Files,
+                std::vector<PHDC_Block> &_Blocks,
+                int _Threads,
+                std::ostream &_Report)
+{
+  _Report << "Writing: " << _HeaderPath << "..." << std::endl;
+
+  std::vector<uint64_t> Hashes(_Files.size());
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile) Hashes[iFile] = PHD_HashPath(_Files[iFile]->DatPath);
+
+  std::vector<PHD_TocPartition> Partitions;
+  std::vector<uint16_t> Seeds;
+  std::vector<uint64_t> Slots;
+  if(PHD_BuildIndex(Hashes, _Threads, Partitions, Seeds, Slots))
+  {
+    std::cerr << "PhragDat error: two paths have the same 64-bit hash, " << _HeaderPath << " not written" << std::endl;
+    return 1;
+  }
+
+  std::vector<PHDC_File*> BySlot(_Files.size());
+  for(size_t iFile = 0; iFile < _Files.size(); ++iFile) BySlot[Slots[iFile]] = _Files[iFile];
+
+  // namespace and include guard from the .dat name
+  std::string Namespace = _SimpleName;
+  for(char &Char : Namespace) if(!isalnum((uint8_t)Char)) Char = '_';
+  if(Namespace.empty() || isdigit((uint8_t)Namespace[0])) Namespace.insert(0, "_");
+  std::string Guard = "PHD_CONTENTS_" + Namespace + "_H";
+  for(char &Char : Guard) Char = (char)toupper((uint8_t)Char);
+
+  std::stringstream ss;
+  ss <<
+  "//====================================\n"
+  "// " << _SimpleName << ".h\n"
+  "// generated by PhragDat v" << VER_MAJ << "." << VER_MIN << " with\n"
+  "// " << _SimpleName << ".dat, do not edit\n"
+  "//====================================\n"
+  "// phd::find(\"ui/font.ttf\") hashes the path (FNV-1a), picks its slot with\n"
+  "// the minimal perfect hash of the .dat's table of contents and compares\n"
+  "// that one entry, nullptr if the path is not in the .dat. Everything is\n"
+  "// constexpr, nothing runs at startup.\n"
+  "// phd::at(path) fails to compile in a constant expression if the path is\n"
+  "// missing (at run time it returns an entry with an empty path):\n"
+  "//   constexpr const phd::entry &Font = phd::at(\"ui/font.ttf\");\n"
+  "//   Load(PHD_ASSET(\"ui/font.ttf\")); // the same inside an expression\n"
+  "//   Load(phd::require(\"ui/font.ttf\")); // C++20, consteval\n"
+  "// method 2 entries are length bytes at offset in the decoded\n"
+  "// blocks[block]. Headers of several .dat files can be included together,\n"
+  "// then name the one you mean: phd::" << Namespace << "::find(path)\n"
+  "//====================================\n"
+  "\n"
+  "#ifndef " << Guard << "\n"
+  "#define " << Guard << "\n"
+  "\n"
+  "#include <stdint.h>\n"
+  "#include <string_view>\n"
+  "\n"
+  "namespace phd\n"
+  "{\n"
+  "#ifndef PHD_CONTENTS_TYPES\n"
+  "#define PHD_CONTENTS_TYPES\n"
+  "  struct entry\n"
+  "  {\n"
+  "    uint64_t hash; // phd::hash(path)\n"
+  "    uint64_t offset; // address inside the .dat (inside the decoded block for method 2)\n"
+  "    uint64_t length; // file size in bytes\n"
+  "    uint64_t stored_length; // bytes at offset\n"
+  "    uint32_t method; // 0 stored, 1 LZ (phragdat_lz.h), 2 in a solid block\n"
+  "    uint32_t block; // solid block index, 0xffffffff if none\n"
+  "    std::string_view path;\n"
+  "  };\n"
+  "\n"
+  "  struct partition\n"
+  "  {\n"
+  "    uint32_t slot_offset; // first entry, the next partition's is the end\n"
+  "    uint32_t bucket_offset; // first seed\n"
+  "  };\n"
+  "\n"
+  "  struct block\n"
+  "  {\n"
+  "    uint64_t offset; // address inside the .dat\n"
+  "    uint64_t length; // decoded size in bytes\n"
+  "    uint64_t stored_length; // bytes at offset\n"
+  "    uint32_t method; // 0 stored, 1 LZ\n"
+  "  };\n"
+  "\n"
+  "  // 64-bit FNV-1a, PHD_HashPath in phragdat_format.h\n"
+  "  constexpr uint64_t hash(std::string_view path)\n"
+  "  {\n"
+  "    uint64_t h = 0xcbf29ce484222325ULL;\n"
+  "    for(char c : path) h = (h ^ (uint8_t)c) * 0x100000001b3ULL;\n"
+  "    return h;\n"
+  "  }\n"
+  "\n"
+  "  // PHD_MphfMix in phragdat_format.h\n"
+  "  constexpr uint64_t mix(uint64_t x)\n"
+  "  {\n"
+  "    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;\n"
+  "    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;\n"
+  "    return x ^ (x >> 31);\n"
+  "  }\n"
+  "\n"
+  "  // not constexpr: a missing path reaching it in a constant expression is the compile error\n"
+  "  inline const entry &not_found(std::string_view)\n"
+  "  {\n"
+  "    static constexpr entry none = {0, 0, 0, 0, 0, 0xffffffff, {}};\n"
+  "    return none;\n"
+  "  }\n"
+  "#endif\n"
+  "\n"
+  "  inline namespace " << Namespace << "\n"
+  "  {\n"
+  "    inline constexpr uint64_t entry_count = " << _Files.size() << ";\n"
+  "    inline constexpr uint64_t block_count = " << _Blocks.size() << ";\n";
+
+  if(_Blocks.size())
+  {
+    ss << "\n    inline constexpr block blocks[" << _Blocks.size() << "] =\n    {\n";
+    for(PHDC_Block &Block : _Blocks)
+    {
+      ss << "      {" << Block.Address << "ULL, " << Block.Length << "ULL, " << Block.StoredLength << "ULL, " << Block.Method << "},\n";
+    }
+    ss << "    };\n";
+  }
+
+  if(_Files.size())
+  {
+    // PHD_TocPartition and seeds as in the table of contents (phragdat_format.h)
+    ss << "\n    inline constexpr uint64_t partition_count = " << Partitions.size()-1 << ";\n";
+    ss << "    inline constexpr partition partitions[" << Partitions.size() << "] =\n    {";
+    for(size_t iPartition = 0; iPartition < Partitions.size(); ++iPartition)
+    {
+      ss << ((iPartition % 8) ? " " : "\n      ") << "{" << Partitions[iPartition].SlotOffset << ", " << Partitions[iPartition].BucketOffset << "},";
+    }
+    ss << "\n    };\n";
+
+    ss << "\n    inline constexpr uint16_t seeds[" << Seeds.size() << "] =\n    {";
+    for(size_t iSeed = 0; iSeed < Seeds.size(); ++iSeed)
+    {
+      ss << ((iSeed % 16) ? " " : "\n      ") << Seeds[iSeed] << ",";
+    }
+    ss << "\n    };\n";
+
+    // entry i is slot i, paths carry their length so the compiler never measures a literal
+    ss << "\n    inline constexpr entry entries[" << _Files.size() << "] =\n    {\n";
+    for(PHDC_File *File : BySlot)
+    {
+      ss << "      {0x" << std::hex << PHD_HashPath(File->DatPath) << std::dec << "ULL, " << File->Address << "ULL, "
+      << File->Length << "ULL, " << File->StoredLength << "ULL, " << File->Method << ", " << File->Block << "U, "
+      << "{" << PHD_CppString(File->DatPath) << ", " << File->DatPath.length() << "}},\n";
+    }
+    ss << "    };\n";
+
+    ss <<
+    "\n"
+    "    // the entry of path, nullptr if it is not in the .dat\n"
+    "    constexpr const entry *find(std::string_view path)\n"
+    "    {\n"
+    "      uint64_t h = phd::hash(path), m = mix(h);\n"
+    "      const partition *p = &partitions[((m >> 32) * partition_count) >> 32];\n"
+    "      uint64_t slots = p[1].slot_offset - p[0].slot_offset;\n"
+    "      if(!slots) return nullptr;\n"
+    "      uint16_t seed = seeds[p[0].bucket_offset + (((m & 0xffffffff) * (p[1].bucket_offset - p[0].bucket_offset)) >> 32)];\n"
+    "      uint64_t slot = (((mix(h ^ (0x9e3779b97f4a7c15ULL * ((seed >> " << PHD_MPHF_DISPLACEMENT_BITS << ") + 1))) & 0xffffffff) * slots) >> 32) + (seed & "
+    << ((1 << PHD_MPHF_DISPLACEMENT_BITS)-1) << ");\n"
+    "      const entry &e = entries[p[0].slot_offset + ((slot >= slots) ? slot - slots : slot)];\n"
+    "      return (e.hash == h && e.path == path) ? &e : nullptr;\n"
+    "    }\n";
+  }
+
+  else
+  {
+    ss <<
+    "\n"
+    "    constexpr const entry *find(std::string_view) {return nullptr;}\n";
+  }
+
+  ss <<
+  "\n"
+  "    constexpr const entry &at(std::string_view path)\n"
+  "    {\n"
+  "      const entry *e = find(path);\n"
+  "      return e ? *e : not_found(path);\n"
+  "    }\n"
+  "\n"
+  "#if defined(__cpp_consteval)\n"
+  "    consteval const entry &require(std::string_view path) {return at(path);}\n"
+  "#endif\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "#ifndef PHD_ASSET\n"
+  "#define PHD_ASSET(path) ([]() -> const ::phd::entry & {constexpr const ::phd::entry &PHD_Entry = ::phd::at(path); return PHD_Entry;}())\n"
+  "#endif\n"
+  "\n"
+  "#endif // " << Guard << "\n";
+
+  std::string Contents = ss.str();
+  FILE *OutputHeaderFile = fopen(_HeaderPath.c_str(), "wb");
+  if(!OutputHeaderFile)
+  {
+    std::cerr << "PhragDat error: failed writing " << _HeaderPath << ", exiting..." << std::endl;
+    return 1;
+  }
+
+  bool Failed = fwrite(Contents.data(), 1, Contents.length(), OutputHeaderFile) != Contents.length();
+  if(fclose(OutputHeaderFile) || Failed)
+  {
+    std::cerr << "PhragDat error: failed writing " << _HeaderPath << ", exiting..." << std::endl;
+    std::remove(_HeaderPath.c_str());
+    return 1;
+  }
+
+  _Report << _HeaderPath << " written" << std::endl;
+
+  return 0;
+}
+
+//=====================================================
+// Compile Timing
+// seconds spent in each phase of the last PHD_COMPILE
+// (or PHD_COMPILE_STREAM), for --stats and
+// phragdat_bench
+//=====================================================
+struct PHDC_CompileTimes
+{
+  double Exclusions; // reading and compiling the rules (they are applied while scanning)
+  double Scan; // walking the input tree
+  double Layout; // file list, -r duplicate search, addresses and -s packing
+  double Write; // file data
+  double Index; // table of contents, rename and -u manifest
+  double Csv; // .csv and -g header
+  double Total;
+  uint64_t Files;
+  uint64_t BytesCopied; // original bytes of every written file
+  uint64_t BytesStored; // bytes they take in the .dat
+};
+
+static PHDC_CompileTimes PHD_CompileTimes;
+
+//================================
+// JsonString
+// quoted, escaped JSON string
+//================================
+static std::string
+PHD_JsonString(const std::string &_String)
+{
+  std::string Result = "\"";
+  for(size_t iChar = 0; iChar < _String.length(); ++iChar)
+  {
+    uint8_t Char = (uint8_t)_String[iChar];
+    if(Char == '"' || Char == '\\') Result.push_back('\\');
+    if(Char < 0x20)
+    {
+      char Escape[8];
+      snprintf(Escape, sizeof(Escape), "\\u%04x", Char);
+      Result += Escape;
+    }
+    else Result.push_back((char)Char);
+  }
+  Result.push_back('"');
+  return Result;
+}
+
+//====================================================
+// ReportStats
+// --stats prints PHD_CompileTimes and PHD_Stats to
+// _Report, --stats-json writes them to _JsonPath as
+// one JSON document
+//====================================================
+static int
+PHD_ReportStats(bool _Text, std::string _JsonPath, std::ostream &_Report)
+{
+  const PHDC_CompileTimes &Times = PHD_CompileTimes;
+  const char *PhaseNames[7] = {"exclusions", "scan", "layout", "write", "index", "csv", "total"};
+  double Phases[7] = {Times.Exclusions, Times.Scan, Times.Layout, Times.Write, Times.Index, Times.Csv, Times.Total};
+
+  uint64_t Syscalls[5] = {PHD_Stats.OpenCalls, PHD_Stats.EnumerateCalls, PHD_Stats.ReadCalls, PHD_Stats.WriteCalls, PHD_Stats.SubmitCalls};
+  const char *SyscallNames[5] = {"open", "enumerate", "read", "write", "submit"};
+  uint64_t PeakMemory = PHD_PeakMemory();
+
+  std::vector<std::pair<double, std::pair<std::string, uint64_t>>> Slowest = PHD_Stats.Slowest;
+  std::sort(Slowest.rbegin(), Slowest.rend());
+
+  if(_Text)
+  {
+    _Report << "Stats:" << std::fixed << std::setprecision(3) << "\n  phases (s):";
+    for(int iPhase = 0; iPhase < 7; ++iPhase) _Report << " " << PhaseNames[iPhase] << " " << Phases[iPhase];
+
+    _Report << std::setprecision(1) << "\n  " << Times.Files << " files, " << PHD_GetPerSecond(Times.Files, Times.Total) << " files/s, "
+    << PHD_GetMBPerSecond(Times.BytesCopied, Times.Total) << " MB/s overall"
+    << "\n  directories scanned: " << PHD_Stats.DirectoriesScanned
+    << "\n  excluded (files/directories):";
+    for(int iKind = 0; iKind < PHD_RULE_KINDS; ++iKind)
+    {
+      _Report << " " << PHD_RuleKindNames[iKind] << " " << PHD_Stats.FilesExcluded[iKind] << "/" << PHD_Stats.DirectoriesExcluded[iKind];
+    }
+
+    _Report << "\n  bytes read: " << PHD_Stats.BytesRead << ", written: " << PHD_Stats.BytesWritten << "\n  syscalls:";
+    for(int iCall = 0; iCall < 5; ++iCall) _Report << " " << SyscallNames[iCall] << " " << Syscalls[iCall];
+
+    _Report << "\n  memory: peak " << PeakMemory/(1024*1024) << " MB, " << PHD_Stats.Allocations << " allocations (" << PHD_Stats.BytesAllocated
+    << " bytes), file table " << PHD_Stats.FileTableBytes << " bytes, paths " << PHD_Stats.PathArenaBytes << " bytes"
+    << "\n  slowest files:";
+    for(size_t iFile = 0; iFile < Slowest.size(); ++iFile)
+    {
+      _Report << "\n    " << std::setprecision(3) << Slowest[iFile].first << " s, " << Slowest[iFile].second.second << " bytes: " << Slowest[iFile].second.first;
+    }
+    _Report << std::endl;
+  }
+
+  if(_JsonPath.length())
+  {
+    std::stringstream ssJson;
+    ssJson << std::fixed << std::setprecision(6)
+    << "{\n  \"version\": \"" << (int)VER_MAJ << "." << (int)VER_MIN << "\",\n  \"phases\": {";
+    for(int iPhase = 0; iPhase < 7; ++iPhase) ssJson << (iPhase ? ", " : "") << "\"" << PhaseNames[iPhase] << "\": " << Phases[iPhase];
+
+    ssJson << "},\n  \"files\": " << Times.Files << ",\n  \"bytes_copied\": " << Times.BytesCopied << ",\n  \"bytes_stored\": " << Times.BytesStored
+    << ",\n  \"files_per_second\": " << PHD_GetPerSecond(Times.Files, Times.Total) << ",\n  \"mb_per_second\": " << PHD_GetMBPerSecond(Times.BytesCopied, Times.Total)
+    << ",\n  \"directories_scanned\": " << PHD_Stats.DirectoriesScanned << ",\n  \"files_excluded\": {";
+    for(int iKind = 0; iKind < PHD_RULE_KINDS; ++iKind) ssJson << (iKind ? ", " : "") << "\"" << PHD_RuleKindNames[iKind] << "\": " << PHD_Stats.FilesExcluded[iKind];
+
+    ssJson << "},\n  \"directories_excluded\": {";
+    for(int iKind = 0; iKind < PHD_RULE_KINDS; ++iKind) ssJson << (iKind ? ", " : "") << "\"" << PHD_RuleKindNames[iKind] << "\": " << PHD_Stats.DirectoriesExcluded[iKind];
+
+    ssJson << "},\n  \"bytes_read\": " << PHD_Stats.BytesRead << ",\n  \"bytes_written\": " << PHD_Stats.BytesWritten << ",\n  \"syscalls\": {";
+    for(int iCall = 0; iCall < 5; ++iCall) ssJson << "\"" << SyscallNames[iCall] << "\": " << Syscalls[iCall] << ", ";
+
+    ssJson << "\"total\": " << Syscalls[0] + Syscalls[1] + Syscalls[2] + Syscalls[3] + Syscalls[4] << "},\n  \"memory\": {\"peak_working_set\": " << PeakMemory
+    << ", \"allocations\": " << PHD_Stats.Allocations << ", \"bytes_allocated\": " << PHD_Stats.BytesAllocated
+    << ", \"file_table_bytes\": " << PHD_Stats.FileTableBytes << ", \"path_arena_bytes\": " << PHD_Stats.PathArenaBytes << "},\n  \"slowest\": [";
+    for(size_t iFile = 0; iFile < Slowest.size(); ++iFile)
+    {
+      ssJson << (iFile ? ",\n" : "\n") << "    {\"path\": " << PHD_JsonString(Slowest[iFile].second.first) << ", \"bytes\": " << Slowest[iFile].second.second
+      << ", \"seconds\": " << Slowest[iFile].first << "}";
+    }
+    ssJson << (Slowest.size() ? "\n  ]\n}\n" : "]\n}\n");
+
+    std::string Json = ssJson.str();
+    FILE *JsonFile = fopen(_JsonPath.c_str(), "wb");
+    bool Failed = !JsonFile || fwrite(&Json[0], 1, Json.length(), JsonFile) != Json.length();
+    if((JsonFile && fclose(JsonFile)) || Failed)
+    {
+      std::cerr << "PhragDat error: failed writing " << _JsonPath << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//================================
+//    PHD_COMPILE
+//================================
+static int
+PHD_COMPILE(std::string _Input,
+            std::string _DatPath,
+            std::string _CPath,
+            std::string _Exclusions,
+            int _Threads,
+            bool _Compress,
+            bool _Solid,
+            bool _Incremental,
+            bool _Dedup,
+            uint64_t _Alignment,
+            int _Backend,
+            std::string _HPath,
+            std::string _TracePath,
+            std::string _HotPath)
+{
+  PHD_CompileTimes = PHDC_CompileTimes();
+  double CompileStartTime = PHD_GetSeconds();
+
+  // check input strings
+  if(!_Input.length() || !_DatPath.length() || !_CPath.length())
+  {
+    std::cerr << "PhragDat Error: invalid input, see phragdat -h for help" << std::endl;
+    return 1;
+  }
+
+  // check inputs are valid directories
+  {
+    DWORD ftyp = GetFileAttributesA(_Input.c_str());
+    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    {
+      std::cerr << "PhragDat error: " << _Input << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
+      if(DEBUG_MODE) {std::cout << "ftyp reads: " << (int)ftyp << std::endl;}
+      return 1;
+    }
+  }
+
+  {
+    DWORD ftyp = GetFileAttributesA(_DatPath.c_str());
+    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    {
+      std::cerr << "PhragDat error: " << _DatPath << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
+      if(DEBUG_MODE) {std::cout << "ftyp reads: " << (int)ftyp << std::endl;}
+      return 1;
+    }
+  }
+
+  {
+    DWORD ftyp = GetFileAttributesA(_CPath.c_str());
+    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    {
+      std::cerr << "PhragDat error: " << _CPath << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
+      if(DEBUG_MODE) {std::cout << "ftyp reads: " << (int)ftyp << std::endl;}
+      return 1;
+    }
+  }
+
+  // -g is optional
+  if(_HPath.length())
+  {
+    DWORD ftyp = GetFileAttributesA(_HPath.c_str());
+    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    {
+      std::cerr << "PhragDat error: " << _HPath << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
+      return 1;
+    }
+  }
+
+  // output dat info
+  std::string Dat_OutputPath; // full path & name
+  std::string Dat_OutputName; // path minus parent dirs
+  std::string Dat_SimpleName; // name with no path or ext
+  std::string C_OutputPath; // full path & name
+  std::string H_OutputPath; // full path & name, empty without -g
+
+  Dat_OutputPath = _DatPath;
+  std::filesystem::path p(_DatPath);
+  Dat_OutputName = p.filename().string();
+
+  Dat_OutputName = _Input;
+  if(Dat_OutputName.back()=='/') {Dat_OutputName.pop_back();}
+  Dat_OutputName.append(".dat");
+  Dat_OutputName = PHD_RemoveParentsFromPath(Dat_OutputName);
+
+  Dat_OutputPath = _DatPath;
+  if(Dat_OutputPath.back()!='/') {Dat_OutputPath.push_back('/');}
+  Dat_OutputPath.append(Dat_OutputName);
+
+  Dat_SimpleName = Dat_OutputName;
+  for(int i=0; i<4; i++) {Dat_SimpleName.pop_back();}
+  for(int i=0; i<Dat_SimpleName.length(); i++) { if(Dat_SimpleName[i]==' ') {Dat_SimpleName[i] = '_';} }
+
+  C_OutputPath = _CPath;
+  if(C_OutputPath.back() != '/') {C_OutputPath.push_back('/');}
+  C_OutputPath.append(Dat_SimpleName);
+  C_OutputPath.append(".csv");
+
+  if(_HPath.length())
+  {
+    H_OutputPath = _HPath;
+    if(H_OutputPath.back() != '/') {H_OutputPath.push_back('/');}
+    H_OutputPath.append(Dat_SimpleName);
+    H_OutputPath.append(".h");
+  }
+
+  // OutputDat DEBUG report
+  if(DEBUG_MODE) {std::cout << "Dat_OutputPath: " << Dat_OutputPath << "\nDat_OutputName: " << Dat_OutputName << std::endl;}
+
+  // previous build (-u), see Incremental Builds
+  std::string ManifestPath = Dat_OutputPath.substr(0, Dat_OutputPath.length()-4) + ".manifest";
+  std::map<std::string, PHDC_ManifestEntry> Manifest;
+  bool Incremental = 0;
+
+  if(_Incremental)
+  {
+    Incremental = !PHD_ReadManifest(ManifestPath, Dat_OutputPath, _Compress, Manifest);
+    if(!Incremental) std::cout << "No usable manifest for " << Dat_OutputPath << ", writing every file" << std::endl;
+  }
+
+  // a full build without -u leaves nothing a later -u could trust
+  else std::remove(ManifestPath.c_str());
+
+  std::vector<PHDC_File> MasterFileList; // contiguous, reserved before it is filled so pointers into it stay valid
+  std::unordered_set<std::string_view> MasterDirectoryList; // views of the scan tree's paths
+  PHDC_PathArena MasterPaths;
+  std::vector<PHDC_Block> SolidBlocks;
+
+  // Populate Exclusions list (rule syntax: see Exclusion rules above)
+  double PhaseStartTime = PHD_GetSeconds();
+  PHDC_ExclusionMatcher Exclusions;
+  if(PHD_LoadExclusions(_Exclusions, std::cout, &Exclusions)) return 1;
+  PHD_CompileTimes.Exclusions = PHD_GetSeconds() - PhaseStartTime;
+
+  // AddressCounter
+  uint64_t AddressCounter = 8;
+
+  // root directory
+  MasterDirectoryList.insert(_Input);
+  size_t DatPathStart = _Input.length() + (_Input.back() == '/' ? 0 : 1);
+
+  // scan input tree
+  // (empty directories cost one enumeration, same as checking them first did)
+
+  PhaseStartTime = PHD_GetSeconds();
+  std::unique_ptr<PHDC_ScanNode> Root;
+  if(_Threads > 1) Root = PHD_ScanTreeParallel(_Input, Exclusions, _Threads);
+  else Root = PHD_ScanTreeSerial(_Input, Exclusions);
+  PHD_CompileTimes.Scan = PHD_GetSeconds() - PhaseStartTime;
+  PhaseStartTime = PHD_GetSeconds();
+
+  // flatten breadth first, same order whichever way the tree was scanned
+  // (directories first, so the file table and path arena are sized once)
+  std::vector<PHDC_ScanNode*> Queue;
+  Queue.push_back(Root.get());
+  size_t FileCount = 0;
+  size_t PathBytes = 0;
+
+  for(size_t iNode = 0; iNode < Queue.size(); ++iNode)
+  {
+    PHDC_ScanNode *Node = Queue[iNode];
+
+    // add directories to masterlist, make sure no duplicates
+    for(size_t iDirectory = 0; iDirectory < Node->Children.size(); ++iDirectory)
+    {
+      if(!MasterDirectoryList.insert(Node->Children[iDirectory]->Path).second)
+      {
+        if(DEBUG_MODE) {std::cout << Node->Children[iDirectory]->Path << " exists in list, skipping..." << std::endl;}
+
+        continue;
+      }
+
+      Queue.push_back(Node->Children[iDirectory].get());
+    }
+
+    for(size_t iFile = 0; iFile < Node->Files.size(); ++iFile)
+    {
+      if(!Node->Files[iFile].Size) continue;
+      FileCount++;
+      PathBytes += Node->Path.length() + Node->Files[iFile].NameLength + 2; // '/' and NUL
+    }
+  }
+
+  MasterFileList.reserve(FileCount);
+  PHD_ArenaReserve(&MasterPaths, PathBytes);
+
+  for(size_t iNode = 0; iNode < Queue.size(); ++iNode)
+  {
+    PHDC_ScanNode *Node = Queue[iNode];
+
+    // add files to masterlist
+    for(size_t iFile = 0; iFile < Node->Files.size(); ++iFile)
+    {
+      // skip 0 length (size comes from the directory record)
+      uint64_t Length = Node->Files[iFile].Size;
+      if(!Length)
+      {
+        if(DEBUG_MODE) {std::cout << Node->Path << "/" << PHD_ScanFileName(Node, Node->Files[iFile]) << " is empty, skipping..." << std::endl;}
+
+        continue;
+      }
+
+      MasterFileList.push_back(PHDC_File());
+      PHDC_File *File = &MasterFileList.back();
+      File->InputPath = PHD_ArenaJoin(&MasterPaths, Node->Path, PHD_ScanFileName(Node, Node->Files[iFile]));
+
+      // remove _Input from DatPath
+      File->DatPath = File->InputPath.substr(DatPathStart);
+
+      File->Address = 0;
+      File->Length = Length;
+      File->StoredLength = Length;
+      File->Method = PHD_METHOD_STORE;
+      File->Block = PHD_NO_BLOCK;
+      File->WriteTime = Node->Files[iFile].WriteTime;
+      File->Hash = 0;
+      File->Previous = NULL;
+      File->Reused = 0;
+      File->Duplicate = NULL;
+      File->Checksum = 0;
+      File->TraceOrder = PHD_NOT_TRACED;
+      File->Hot = 0;
+
+      // solid block members are packed again every build
+      auto Previous = Incremental ? Manifest.find(std::string(File->DatPath)) : Manifest.end();
+      if(Previous != Manifest.end() && Previous->second.Method != PHD_METHOD_SOLID && !(_Solid && Length < PHD_SOLID_MAX_FILE))
+      {
+        File->Previous = &Previous->second;
+
+        if(File->Previous->Length == Length && File->Previous->WriteTime == File->WriteTime)
+        {
+          File->Reused = 1;
+          File->Hash = File->Previous->Hash;
+          File->StoredLength = File->Previous->StoredLength;
+          File->Method = File->Previous->Method;
+        }
+      }
+    }
+  }
+
+  PHD_Stats.FileTableBytes = MasterFileList.capacity() * sizeof(PHDC_File);
+  PHD_Stats.PathArenaBytes = MasterPaths.Bytes;
+  PHD_StatsAllocation((MasterFileList.capacity() ? 1 : 0) + MasterPaths.Allocations, PHD_Stats.FileTableBytes + MasterPaths.Bytes);
+
+  // debug report
+  if(DEBUG_MODE)
+  {
+    for(size_t iFile = 0; iFile < MasterFileList.size(); ++iFile)
+    {
+      std::cout << "\nInput File: " << MasterFileList[iFile].InputPath
+      << "\nDatPath: " << MasterFileList[iFile].DatPath
+      << "\nLength: " << MasterFileList[iFile].Length
+      << std::endl;
+    }
+  }
+
+  std::vector<PHDC_File*> Files;
+  for(size_t iFile = 0; iFile < MasterFileList.size(); ++iFile) {Files.push_back(&MasterFileList[iFile]);}
+
+  // hot files (-p) first, then traced files (-l), see Access Traces
+  uint64_t Traced = 0, TraceMissing = 0, HotFiles = 0, HotMissing = 0;
+  if(_TracePath.length() && PHD_ApplyTrace(_TracePath, 0, Files, &Traced, &TraceMissing)) return 1;
+  if(_HotPath.length() && PHD_ApplyTrace(_HotPath, 1, Files, &HotFiles, &HotMissing)) return 1;
+
+  // store identical files once (-r), see Deduplication
+  uint64_t Duplicates = 0;
+  if(_Dedup && PHD_FindDuplicates(Files, _Threads, &Duplicates)) return 1;
+
+  // every file that is written gets the next address, -z/-s reassign them as they are appended
+  std::vector<PHDC_File*> WriteFiles;
+  for(size_t iFile = 0; iFile < Files.size(); ++iFile)
+  {
+    PHDC_File *File = Files[iFile];
+    if(File->Duplicate) continue;
+
+    AddressCounter = PHD_AlignAddress(AddressCounter, File->Length, _Alignment);
+    File->Address = AddressCounter;
+    AddressCounter += File->Length+PHD_PAD_SIZE; // see Copy Engine pad policy
+    WriteFiles.push_back(File);
+  }
+
+  // -s moves small files out of WriteFiles, blocks are addressed when they are written
+  if(_Solid) PHD_PackSolidBlocks(WriteFiles, SolidBlocks);
+
+  PHD_CompileTimes.Layout = PHD_GetSeconds() - PhaseStartTime;
+
+  // write .dat file
+  // (raw Win32 handles so the copy engine can move whole blocks per call)
+  {
+    // -u reads reused files from the previous .dat, so the new one is written beside it
+    std::string WritePath = Incremental ? Dat_OutputPath + ".tmp" : Dat_OutputPath;
+    HANDLE OldDatFile = INVALID_HANDLE_VALUE;
+    if(Incremental)
+    {
+      OldDatFile = CreateFileA(Dat_OutputPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+      if(OldDatFile == INVALID_HANDLE_VALUE)
+      {
+        std::cerr << "PhragDat error: failed to open " << Dat_OutputPath << " for reading, exiting..." << std::endl;
+        return 1;
+      }
+    }
+
+    // shared so parallel workers can open their own handles to it
+    HANDLE OutputDatFile = CreateFileA(WritePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    PHD_StatsAdd(PHD_Stats.OpenCalls, 1);
+
+    if(OutputDatFile == INVALID_HANDLE_VALUE)
+    {
+      std::cerr << "PhragDat error: failed to write " << WritePath << ", check read/write privileges or spelling and try again, exiting..." << std::endl;
+      if(OldDatFile != INVALID_HANDLE_VALUE) CloseHandle(OldDatFile);
+      return 1;
+    }
+
+    auto Abort = [&]()
+    {
+      CloseHandle(OutputDatFile);
+      if(OldDatFile != INVALID_HANDLE_VALUE) CloseHandle(OldDatFile);
+      std::remove(WritePath.c_str());
+    };
+
+    // write header
+    {
+      char Header[8] = {0x50, 0x48, 0x52, 0x44, 0x41, 0x54, VER_MAJ, VER_MIN};
+      if(PHD_WriteBlock(OutputDatFile, Header, 8, NULL))
+      {
+        std::cerr << "PhragDat error: failed to write " << WritePath << ", exiting..." << std::endl;
+        Abort();
+        return 1;
+      }
+    }
+
+    // write data
+    double WriteStartTime = PHD_GetSeconds();
+    uint64_t BytesCopied = 0;
+    uint64_t BytesStored = 0;
+
+    // stored copies go through IoRing if the system has it (see IoRing backend), -z/-s read files to compress them
+    bool IoRing = 0;
+    if(_Backend != PHD_BACKEND_BLOCKING && !_Compress && !_Solid)
+    {
+      IoRing = PHD_IoRingLoad();
+      if(!IoRing && _Backend == PHD_BACKEND_IORING) std::cout << "IoRing is not available, using blocking I/O" << std::endl;
+    }
+
+    if(_Compress || _Solid)
+    {
+      // stored sizes are only known once compressed, so addresses are assigned as files are appended
+
+      AddressCounter = PHD_HEADER_SIZE;
+      if(PHD_WriteDataOrdered(WriteFiles, SolidBlocks, OutputDatFile, OldDatFile, _Threads, _Compress, _Incremental, _Alignment, &AddressCounter, &BytesCopied, &BytesStored))
+      {
+        std::cerr << "PhragDat error: failed writing " << WritePath << ", exiting..." << std::endl;
+        Abort();
+        return 1;
+      }
+    }
+
+    else if(_Threads > 1 || IoRing)
+    {
+      // pre-size so every worker can write straight to its Address
+      LARGE_INTEGER DatSize;
+      DatSize.QuadPart = (LONGLONG)AddressCounter;
+
+      if(!SetFilePointerEx(OutputDatFile, DatSize, NULL, FILE_BEGIN) || !SetEndOfFile(OutputDatFile) ||
+         PHD_WriteDataParallel(WriteFiles, WritePath, Incremental ? Dat_OutputPath : std::string(), _Threads, _Incremental, IoRing, &BytesCopied))
+      {
+        std::cerr << "PhragDat error: failed writing " << WritePath << ", exiting..." << std::endl;
+        Abort();
+        return 1;
+      }
+    }
+
+    else
+    {
+      PHD_CopyEngine CopyEngine;
+      if(PHD_CopyEngineInit(&CopyEngine))
+      {
+        Abort();
+        return 1;
+      }
+
+      for(size_t iFile = 0; iFile < WriteFiles.size(); ++iFile)
+      {
+        PHDC_File *File = WriteFiles[iFile];
+        if(FILE_REPORT) std::cout << (File->Reused ? "Reusing: " : "Writing: ") << File->InputPath;
+
+        double FileSeconds = 0.0;
+        // written at its Address, so -a gaps are left as zeros
+        if(PHD_CopyFileEntry(&CopyEngine, File, OutputDatFile, File->Address, OldDatFile, _Incremental, &FileSeconds))
+        {
+          std::cerr << "PhragDat error: failed writing " << WritePath << ", exiting..." << std::endl;
+          PHD_CopyEngineFree(&CopyEngine);
+          Abort();
+          return 1;
+        }
+
+        if(FILE_REPORT)
+        {
+          std::cout << " (" << std::fixed << std::setprecision(1)
+          << PHD_GetMBPerSecond(File->Length, FileSeconds) << " MB/s)\n";
+        }
+      }
+
+      BytesCopied = CopyEngine.BytesCopied;
+      PHD_CopyEngineFree(&CopyEngine);
+    }
+
+    double WriteSeconds = PHD_GetSeconds() - WriteStartTime;
+    PHD_CompileTimes.Write = WriteSeconds;
+    PhaseStartTime = PHD_GetSeconds();
+
+    // copies share whatever was written for their original
+    uint64_t BytesDeduplicated = 0;
+    for(size_t iFile = 0; iFile < Files.size(); ++iFile)
+    {
+      PHDC_File *File = Files[iFile];
+      if(!File->Duplicate) continue;
+
+      File->Address = File->Duplicate->Address;
+      File->StoredLength = File->Duplicate->StoredLength;
+      File->Method = File->Duplicate->Method;
+      File->Block = File->Duplicate->Block;
+      File->Checksum = File->Duplicate->Checksum;
+      BytesDeduplicated += (File->Method == PHD_METHOD_SOLID) ? File->Length : File->StoredLength + PHD_PAD_SIZE;
+    }
+
+    // write table of contents after the data
+    if(PHD_WriteToc(OutputDatFile, Files, SolidBlocks, _Alignment, AddressCounter, 0, _Threads))
+    {
+      std::cerr << "PhragDat error: failed writing table of contents to " << WritePath << ", exiting..." << std::endl;
+      Abort();
+      return 1;
+    }
+
+    CloseHandle(OutputDatFile);
+
+    if(Incremental)
+    {
+      CloseHandle(OldDatFile);
+      if(!MoveFileExA(WritePath.c_str(), Dat_OutputPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+      {
+        std::cerr << "PhragDat error: failed replacing " << Dat_OutputPath << " with " << WritePath << ", exiting..." << std::endl;
+        std::remove(WritePath.c_str());
+        return 1;
+      }
+    }
+
+    PHD_CompileTimes.Index = PHD_GetSeconds() - PhaseStartTime;
+    PHD_CompileTimes.Files = MasterFileList.size();
+    PHD_CompileTimes.BytesCopied = BytesCopied;
+    PHD_CompileTimes.BytesStored = (_Compress || _Solid) ? BytesStored : BytesCopied;
+
+    std::cout << Dat_OutputPath << " written: " << MasterFileList.size() << " files, "
+    << BytesCopied << " bytes, " << std::fixed << std::setprecision(1)
+    << PHD_GetMBPerSecond(BytesCopied, WriteSeconds) << " MB/s" << std::endl;
+
+    if((_Compress || _Solid) && BytesCopied)
+    {
+      std::cout << "Compressed: " << BytesCopied << " -> " << BytesStored << " bytes ("
+      << std::fixed << std::setprecision(1) << 100.0*(double)BytesStored / (double)BytesCopied << "%)" << std::endl;
+    }
+
+    if(_Incremental)
+    {
+      uint64_t Reused = 0;
+      for(uint64_t iFile = 0; iFile < (uint64_t)MasterFileList.size(); ++iFile) {Reused += MasterFileList[iFile].Reused;}
+      std::cout << "Incremental: " << Reused << " files reused, " << WriteFiles.size() - Reused << " rewritten" << std::endl;
+    }
+
+    if(_TracePath.length())
+    {
+      std::cout << "Traced: " << Traced << " files placed first";
+      if(TraceMissing) std::cout << ", " << TraceMissing << " traced paths not in the input";
+      std::cout << std::endl;
+    }
+
+    if(_HotPath.length())
+    {
+      uint64_t HotBytes = 0;
+      for(size_t iFile = 0; iFile < WriteFiles.size(); ++iFile) {if(WriteFiles[iFile]->Hot) HotBytes += WriteFiles[iFile]->StoredLength;}
+      std::cout << "Hot: " << HotFiles << " files, " << HotBytes << " bytes at the start of the .dat";
+      if(HotMissing) std::cout << ", " << HotMissing << " listed paths not in the input";
+      std::cout << std::endl;
+    }
+
+    if(_Dedup)
+    {
+      std::cout << "Deduplicated: " << Duplicates << " files stored once, " << BytesDeduplicated << " bytes saved" << std::endl;
+    }
+  }
+
+  // write manifest for the next -u build
+  PhaseStartTime = PHD_GetSeconds();
+  if(_Incremental)
+  {
+    WIN32_FILE_ATTRIBUTE_DATA DatInfo;
+    FILE *OutputManifestFile = fopen(ManifestPath.c_str(), "wb");
+
+    if(!OutputManifestFile || !GetFileAttributesExA(Dat_OutputPath.c_str(), GetFileExInfoStandard, &DatInfo))
+    {
+      std::cerr << "PhragDat error: failed writing " << ManifestPath << ", exiting..." << std::endl;
+      if(OutputManifestFile) fclose(OutputManifestFile);
+      std::remove(ManifestPath.c_str());
+      return 1;
+    }
+
+    std::stringstream ssManifest;
+    ssManifest << "\"PHRDAT-MANIFEST\"," << (int)VER_MAJ << "," << (int)VER_MIN << "," << (int)_Compress
+    << "," << ((((uint64_t)DatInfo.nFileSizeHigh << 32) | DatInfo.nFileSizeLow)) << "\n";
+
+    for(uint64_t iFile = 0; iFile < (uint64_t)MasterFileList.size(); ++iFile)
+    {
+      PHDC_File *File = &MasterFileList[iFile];
+      ssManifest << "\"" << File->DatPath << "\"," << File->Length << "," << File->WriteTime << ","
+      << std::hex << File->Hash << std::dec << "," << File->Address << "," << File->StoredLength << "," << File->Method << "\n";
+    }
+
+    std::string ManifestContents = ssManifest.str();
+    bool Failed = fwrite(&ManifestContents[0], 1, ManifestContents.length(), OutputManifestFile) != ManifestContents.length();
+    if(fclose(OutputManifestFile) || Failed)
+    {
+      std::cerr << "PhragDat error: failed writing " << ManifestPath << ", exiting..." << std::endl;
+      std::remove(ManifestPath.c_str());
+      return 1;
+    }
+  }
+
+  PHD_CompileTimes.Index += PHD_GetSeconds() - PhaseStartTime;
+
+  PhaseStartTime = PHD_GetSeconds();
+  if(PHD_WriteCsv(C_OutputPath, Files, SolidBlocks, _Compress, _Solid, std::cout)) return 1;
+  if(H_OutputPath.length() && PHD_WriteHeader(H_OutputPath, Dat_SimpleName, Files, SolidBlocks, _Threads, std::cout)) return 1;
+  PHD_CompileTimes.Csv = PHD_GetSeconds() - PhaseStartTime;
+  PHD_CompileTimes.Total = PHD_GetSeconds() - CompileStartTime;
+
+  return 0;
+}
+
+//====================================
+//    PHD_COMPILE_STREAM
+// -d- writes the .dat to stdout in
+// one pass while the tree is walked
+//====================================
+// Every entry is appended as soon as its directory has been enumerated and
+// the table of contents follows the data, so nothing is ever seeked and the
+// output can feed a pipe. Files come out in the same breadth first order as
+// PHD_COMPILE, so the archive matches a -j1 build of the same tree. -s, -u,
+// -r, -l and -p need every file before the first is written and are refused
+// by main, so are -jN (N > 1) and -b"ioring": the walk and the writes run on
+// one thread with the blocking copy engine. Only the table of contents grows
+// with the tree, the data goes through one copy buffer (one compressed file
+// with -z).
+static int
+PHD_COMPILE_STREAM(std::string _Input,
+                   std::string _CPath,
+                   std::string _Exclusions,
+                   bool _Compress,
+                   uint64_t _Alignment,
+                   std::string _HPath)
+{
+  PHD_CompileTimes = PHDC_CompileTimes();
+  double CompileStartTime = PHD_GetSeconds();
+
+  // check input strings
+  if(!_Input.length())
+  {
+    std::cerr << "PhragDat Error: invalid input, see phragdat -h for help" << std::endl;
+    return 1;
+  }
+
+  // check inputs are valid directories
+  {
+    DWORD ftyp = GetFileAttributesA(_Input.c_str());
+    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    {
+      std::cerr << "PhragDat error: " << _Input << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
+      return 1;
+    }
+  }
+
+  // the .csv and .h are optional, named after _Input as in PHD_COMPILE
+  std::string Dat_SimpleName = _Input;
+  if(Dat_SimpleName.back()=='/') {Dat_SimpleName.pop_back();}
+  Dat_SimpleName.append(".dat");
+  Dat_SimpleName = PHD_RemoveParentsFromPath(Dat_SimpleName);
+  for(int i=0; i<4; i++) {Dat_SimpleName.pop_back();}
+  for(int i=0; i<Dat_SimpleName.length(); i++) { if(Dat_SimpleName[i]==' ') {Dat_SimpleName[i] = '_';} }
+
+  std::string C_OutputPath;
+  if(_CPath.length())
+  {
+    DWORD ftyp = GetFileAttributesA(_CPath.c_str());
+    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    {
+      std::cerr << "PhragDat error: " << _CPath << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
+      return 1;
+    }
+
+    C_OutputPath = _CPath;
+    if(C_OutputPath.back() != '/') {C_OutputPath.push_back('/');}
+    C_OutputPath.append(Dat_SimpleName);
+    C_OutputPath.append(".csv");
+  }
+
+  std::string H_OutputPath;
+  if(_HPath.length())
+  {
+    DWORD ftyp = GetFileAttributesA(_HPath.c_str());
+    if(ftyp != FILE_ATTRIBUTE_DIRECTORY)
+    {
+      std::cerr << "PhragDat error: " << _HPath << " is not a valid directory. Check read/write privileges or check the path is correct. Aborting." << std::endl;
+      return 1;
+    }
+
+    H_OutputPath = _HPath;
+    if(H_OutputPath.back() != '/') {H_OutputPath.push_back('/');}
+    H_OutputPath.append(Dat_SimpleName);
+    H_OutputPath.append(".h");
+  }
+
+  // stdout carries the .dat, written with WriteFile so no text mode translation applies
+  HANDLE Output = GetStdHandle(STD_OUTPUT_HANDLE);
+  DWORD ConsoleMode;
+  if(Output == INVALID_HANDLE_VALUE || !Output || GetConsoleMode(Output, &ConsoleMode))
+  {
+    std::cerr << "PhragDat error: -d- writes the .dat to stdout, redirect it to a file or pipe" << std::endl;
+    return 1;
+  }
+
+  // progress goes to stderr from here on
+  double PhaseStartTime = PHD_GetSeconds();
+  PHDC_ExclusionMatcher Exclusions;
+  if(PHD_LoadExclusions(_Exclusions, std::cerr, &Exclusions)) return 1;
+  PHD_CompileTimes.Exclusions = PHD_GetSeconds() - PhaseStartTime;
+
+  PHD_CopyEngine CopyEngine;
+  if(PHD_CopyEngineInit(&CopyEngine)) return 1;
+
+  std::deque<PHDC_File> MasterFileList; // grows as the walk goes, a deque never moves what it holds
+  PHDC_PathArena MasterPaths;
+  std::vector<PHDC_File*> Files;
+  std::vector<PHDC_Block> SolidBlocks; // always empty, see -s above
+  size_t DatPathStart = _Input.length() + (_Input.back() == '/' ? 0 : 1);
+
+  std::unique_ptr<PHD_LzState> State(_Compress ? new PHD_LzState : NULL);
+  std::vector<uint8_t> Input;
+  std::vector<uint8_t> Stored; // compressed (or stored) bytes + pad, empty if the copy engine writes it
+  std::vector<uint8_t> Zeros((size_t)_Alignment, 0); // an -a gap is shorter than _Alignment
+
+  double WriteStartTime = PHD_GetSeconds();
+  uint64_t Address = PHD_HEADER_SIZE;
+  uint64_t BytesCopied = 0;
+  uint64_t BytesStored = 0;
+
+  auto Fail = [&]()
+  {
+    std::cerr << "PhragDat error: failed writing .dat to stdout, exiting..." << std::endl;
+    PHD_CopyEngineFree(&CopyEngine);
+    return 1;
+  };
+
+  // write header
+  {
+    char Header[8] = {0x50, 0x48, 0x52, 0x44, 0x41, 0x54, VER_MAJ, VER_MIN};
+    if(PHD_WriteBlock(Output, Header, 8, NULL)) return Fail();
+  }
+
+  // walk breadth first, each directory's files are written before the next is enumerated
+  std::deque<std::unique_ptr<PHDC_ScanNode>> Queue;
+  Queue.push_back(std::unique_ptr<PHDC_ScanNode>(new PHDC_ScanNode()));
+  Queue.back()->Path = _Input;
+  Queue.back()->MatchState = Exclusions.Start;
+
+  while(!Queue.empty())
+  {
+    std::unique_ptr<PHDC_ScanNode> Node = std::move(Queue.front());
+    Queue.pop_front();
+
+    PhaseStartTime = PHD_GetSeconds();
+    PHD_ScanNode(Node.get(), Exclusions);
+    PHD_CompileTimes.Scan += PHD_GetSeconds() - PhaseStartTime;
+    for(size_t iChild = 0; iChild < Node->Children.size(); ++iChild)
+    {
+      Queue.push_back(std::move(Node->Children[iChild]));
+    }
+
+    for(size_t iFile = 0; iFile < Node->Files.size(); ++iFile)
+    {
+      // skip 0 length (size comes from the directory record)
+      uint64_t Length = Node->Files[iFile].Size;
+      if(!Length) continue;
+
+      MasterFileList.push_back(PHDC_File());
+      PHDC_File *File = &MasterFileList.back();
+      File->InputPath = PHD_ArenaJoin(&MasterPaths, Node->Path, PHD_ScanFileName(Node.get(), Node->Files[iFile]));
+      File->DatPath = File->InputPath.substr(DatPathStart);
+      File->Length = Length;
+      File->StoredLength = Length;
+      File->Method = PHD_METHOD_STORE;
+      File->Block = PHD_NO_BLOCK;
+      File->WriteTime = Node->Files[iFile].WriteTime;
+      File->Hash = 0;
+      File->Previous = NULL;
+      File->Reused = 0;
+      File->Duplicate = NULL;
+      File->Checksum = 0;
+      File->TraceOrder = PHD_NOT_TRACED;
+      File->Hot = 0;
+      Files.push_back(File);
+
+      // same decision as PHD_WriteDataOrdered, so -z output matches too
+      Stored.clear();
+      if(_Compress && Length <= PHD_COMPRESS_MAX_SIZE)
+      {
+        double FileStartTime = PHD_GetSeconds();
+        Input.resize((size_t)Length);
+        if(PHD_ReadWholeFile(File->InputPath.data(), Length, &Input[0])) return Fail();
+        PHD_CompressEntry(State.get(), Input, Stored, &File->Method, &File->StoredLength, &File->Checksum);
+        PHD_StatsFile(File->InputPath, Length, PHD_GetSeconds() - FileStartTime);
+      }
+
+      File->Address = PHD_AlignAddress(Address, File->StoredLength, _Alignment);
+      if(File->Address > Address && PHD_WriteBlock(Output, &Zeros[0], (DWORD)(File->Address - Address), NULL)) return Fail();
+
+      if(Stored.size())
+      {
+        if(PHD_WriteBlock(Output, &Stored[0], (DWORD)Stored.size(), NULL)) return Fail();
+      }
+      else
+      {
+        if(PHD_CopyEngineCopy(&CopyEngine, File->InputPath.data(), Length, Output, PHD_APPEND, NULL, NULL)) return Fail();
+        File->Checksum = CopyEngine.Checksum;
+      }
+
+      if(FILE_REPORT)
+      {
+        std::cerr << "Writing: " << File->InputPath << " ("
+        << ((File->Method == PHD_METHOD_LZ) ? "lz " : "stored ") << std::fixed << std::setprecision(1)
+        << 100.0*(double)File->StoredLength / (double)Length << "%)\n";
+      }
+
+      Address = File->Address + File->StoredLength + PHD_PAD_SIZE; // see Copy Engine pad policy
+      BytesCopied += Length;
+      BytesStored += File->StoredLength;
+    }
+  }
+
+  // the walk is timed as scan, everything else in the loop as write
+  double WriteSeconds = PHD_GetSeconds() - WriteStartTime;
+  PHD_CompileTimes.Write = WriteSeconds - PHD_CompileTimes.Scan;
+
+  // table of contents as the trailer
+  PhaseStartTime = PHD_GetSeconds();
+  if(PHD_WriteToc(Output, Files, SolidBlocks, _Alignment, Address, 1, 1)) return Fail();
+  PHD_CopyEngineFree(&CopyEngine);
+  PHD_CompileTimes.Index = PHD_GetSeconds() - PhaseStartTime;
+  PHD_CompileTimes.Files = MasterFileList.size();
+  PHD_CompileTimes.BytesCopied = BytesCopied;
+  PHD_CompileTimes.BytesStored = BytesStored;
+  PHD_Stats.FileTableBytes = MasterFileList.size() * sizeof(PHDC_File);
+  PHD_Stats.PathArenaBytes = MasterPaths.Bytes;
+  PHD_StatsAllocation(MasterPaths.Allocations, MasterPaths.Bytes); // the deque's blocks are its own business
+
+  std::cerr << "stdout written: " << MasterFileList.size() << " files, "
+  << BytesCopied << " bytes, " << std::fixed << std::setprecision(1)
+  << PHD_GetMBPerSecond(BytesCopied, WriteSeconds) << " MB/s" << std::endl;
+
+  if(_Compress && BytesCopied)
+  {
+    std::cerr << "Compressed: " << BytesCopied << " -> " << BytesStored << " bytes ("
+    << std::fixed << std::setprecision(1) << 100.0*(double)BytesStored / (double)BytesCopied << "%)" << std::endl;
+  }
+
+  PhaseStartTime = PHD_GetSeconds();
+  if(C_OutputPath.length() && PHD_WriteCsv(C_OutputPath, Files, SolidBlocks, _Compress, 0, std::cerr)) return 1;
+  if(H_OutputPath.length() && PHD_WriteHeader(H_OutputPath, Dat_SimpleName, Files, SolidBlocks, 1, std::cerr)) return 1;
+  PHD_CompileTimes.Csv = PHD_GetSeconds() - PhaseStartTime;
+  PHD_CompileTimes.Total = PHD_GetSeconds() - CompileStartTime;
+
+  return 0;
+}
+
+//================================
+//    PHD_VERIFY
+// checks the checksums of every
+// entry and block in _DatPath
+//================================
+// Stored ranges are split into PHD_VERIFY_CHUNK pieces that _Threads workers
+// checksum straight from the mapping in address order, the CRCs of the pieces
+// of each range are combined afterwards, so one huge entry is checked by
+// every thread and the disk is read front to back.
+#define PHD_VERIFY_CHUNK 0x1000000 // 16MB
+
+static int
+PHD_VERIFY(std::string _DatPath, int _Threads)
+{
+  PHD_Archive Archive;
+  int OpenResult = PHD_ArchiveOpen(&Archive, _DatPath.c_str());
+  if(OpenResult)
+  {
+    std::cerr << "PhragDat error: failed to open " << _DatPath
+    << ((OpenResult == PHD_ARCHIVE_ERROR_FORMAT) ? " (not a .dat, truncated or damaged table of contents)" : "") << std::endl;
+    return 1;
+  }
+
+  if(!Archive.TocOffset)
+  {
+    std::cerr << "PhragDat error: " << _DatPath << " was written before v6.0 and has no checksums" << std::endl;
+    PHD_ArchiveClose(&Archive);
+    return 1;
+  }
+
+  double StartTime = PHD_GetSeconds();
+  if(PHD_ArchiveVerifyToc(&Archive))
+  {
+    std::cerr << "PhragDat error: " << _DatPath << ": table of contents checksum mismatch" << std::endl;
+    PHD_ArchiveClose(&Archive);
+    return 1;
+  }
+
+  // every stored range once, entries sharing bytes (-r) are checked together
+  struct PHDC_VerifyRange
+  {
+    uint64_t Offset;
+    uint64_t Length;
+    uint32_t Checksum;
+    const PHD_TocEntry *Entry; // NULL for a solid block
+    uint64_t Block;
+    uint64_t FirstChunk;
+  };
+
+  std::vector<PHDC_VerifyRange> Ranges;
+  for(uint64_t iEntry = 0; iEntry < Archive.EntryCount; ++iEntry)
+  {
+    const PHD_TocEntry *Entry = &Archive.Entries[iEntry];
+    if(Entry->Method != PHD_METHOD_SOLID) Ranges.push_back({Entry->Offset, Entry->StoredLength, Entry->Checksum, Entry, PHD_NO_BLOCK, 0});
+  }
 
-        if(erase)
-        {
-          if(DEBUG_MODE) {std::cout << "Removing exception: " << (*iFileList) << std::endl;}
+  for(uint64_t iBlock = 0; iBlock < Archive.BlockCount; ++iBlock)
+  {
+    const PHD_TocBlock *Block = &Archive.Blocks[iBlock];
+    Ranges.push_back({Block->Offset, Block->StoredLength, Block->Checksum, NULL, iBlock, 0});
+  }
 
-          iFileList = FileList.erase(iFileList);
-        }
+  std::sort(Ranges.begin(), Ranges.end(), [](const PHDC_VerifyRange &_A, const PHDC_VerifyRange &_B)
+  {
+    return (_A.Offset != _B.Offset) ? _A.Offset < _B.Offset : (_A.Length != _B.Length) ? _A.Length < _B.Length : _A.Checksum < _B.Checksum;
+  });
 
-        else
-        {
-          iFileList++;
-        }
-      }
-    }
+  Ranges.erase(std::unique(Ranges.begin(), Ranges.end(), [](const PHDC_VerifyRange &_A, const PHDC_VerifyRange &_B)
+  {
+    return _A.Offset == _B.Offset && _A.Length == _B.Length && _A.Checksum == _B.Checksum;
+  }), Ranges.end());
+
+  uint64_t ChunkCount = 0;
+  uint64_t BytesChecked = 0;
+  for(size_t iRange = 0; iRange < Ranges.size(); ++iRange)
+  {
+    Ranges[iRange].FirstChunk = ChunkCount;
+    ChunkCount += std::max<uint64_t>(1, (Ranges[iRange].Length + PHD_VERIFY_CHUNK-1) / PHD_VERIFY_CHUNK);
+    BytesChecked += Ranges[iRange].Length;
+  }
 
-    // Directory Exclusions
-    for(int iExclusion = 0; iExclusion < DirExclusions.size(); ++iExclusion)
+  // out of bounds ranges are caught when the pieces are combined
+  std::vector<uint32_t> ChunkChecksums(ChunkCount, 0);
+  std::atomic<uint64_t> NextChunk(0);
+  auto Worker = [&]()
+  {
+    size_t iRange = 0;
+    for(;;)
     {
-      std::vector<std::string>::iterator iDirectoryList = DirectoryList.begin();
-      while(iDirectoryList != DirectoryList.end())
-      {
-        if((*iDirectoryList).find(DirExclusions[iExclusion]) != std::string::npos)
-        {
-          if(DEBUG_MODE) {std::cout << "Removing exception: " << (*iDirectoryList) << std::endl;}
+      uint64_t iChunk = NextChunk++;
+      if(iChunk >= ChunkCount) break;
 
-          iDirectoryList = DirectoryList.erase(iDirectoryList);
-        }
+      // chunks are claimed in order, so the range only ever moves forward
+      while(iRange+1 < Ranges.size() && Ranges[iRange+1].FirstChunk <= iChunk) ++iRange;
+      const PHDC_VerifyRange &Range = Ranges[iRange];
 
-        else
-        {
-          iDirectoryList++;
-        }
-      }
+      uint64_t Start = (iChunk - Range.FirstChunk) * PHD_VERIFY_CHUNK;
+      uint64_t Length = std::min<uint64_t>(Range.Length - Start, PHD_VERIFY_CHUNK);
+      std::string_view Data = PHD_ArchiveRange(&Archive, Range.Offset + Start, Length);
+      if(Data.data()) ChunkChecksums[iChunk] = PHD_Crc32c(0, Data.data(), Data.length());
     }
+  };
 
-    // add directories to masterlist
-    for(int iDirectory = 0; iDirectory < DirectoryList.size(); ++iDirectory)
-    {
-      // skip empty
-      if(PathIsDirectoryEmptyA(DirectoryList[iDirectory].c_str()))
-      {
-        if(DEBUG_MODE) {std::cout << DirectoryList[iDirectory] << " is empty, skipping..." << std::endl;}
+  std::vector<std::thread> Workers;
+  for(int iThread = 1; iThread < _Threads; ++iThread) {Workers.push_back(std::thread(Worker));}
+  Worker();
+  for(size_t iThread = 0; iThread < Workers.size(); ++iThread) {Workers[iThread].join();}
 
-        continue;
-      }
+  uint64_t Damaged = 0;
+  for(size_t iRange = 0; iRange < Ranges.size(); ++iRange)
+  {
+    const PHDC_VerifyRange &Range = Ranges[iRange];
+    uint32_t Checksum = 0;
+    for(uint64_t Start = 0, iChunk = Range.FirstChunk; Start < Range.Length; Start += PHD_VERIFY_CHUNK, ++iChunk)
+    {
+      Checksum = PHD_Crc32cCombine(Checksum, ChunkChecksums[iChunk], std::min<uint64_t>(Range.Length - Start, PHD_VERIFY_CHUNK));
+    }
 
-      // make sure no duplicates
-      bool SkipDir = 0;
+    if(Checksum == Range.Checksum && PHD_ArchiveRange(&Archive, Range.Offset, Range.Length).data()) continue;
 
-      for(int iMasterDirectory = 0; iMasterDirectory < MasterDirectoryList.size(); ++iMasterDirectory)
-      {
-        if(MasterDirectoryList[iMasterDirectory] == DirectoryList[iDirectory])
-        {
-          SkipDir = 1;
-        }
-      }
+    Damaged++;
+    if(Range.Entry) std::cerr << "PhragDat error: checksum mismatch: " << PHD_ArchiveEntryPath(&Archive, Range.Entry) << std::endl;
+    else std::cerr << "PhragDat error: checksum mismatch: solid block " << Range.Block << " (" << Archive.Blocks[Range.Block].FileCount << " files)" << std::endl;
+  }
 
-      if(SkipDir && DEBUG_MODE)
-      {
-        std::cout << DirectoryList[iDirectory] << " exists in list, skipping..." << std::endl;
-      }
+  double Seconds = PHD_GetSeconds() - StartTime;
+  std::cout << _DatPath << " verified: " << Archive.EntryCount << " entries, " << Archive.BlockCount << " solid blocks, "
+  << BytesChecked << " bytes, " << std::fixed << std::setprecision(1) << PHD_GetMBPerSecond(BytesChecked, Seconds) << " MB/s, "
+  << Damaged << " damaged" << std::endl;
 
-      if(!SkipDir)
-      {
-        MasterDirectoryList.push_back(DirectoryList[iDirectory]);
-      }
-    }
+  PHD_ArchiveClose(&Archive);
+  return Damaged ? 1 : 0;
+}
 
-    // add files to masterlist
-    for(int iFile = 0; iFile < FileList.size(); ++iFile)
-    {
-      // skip 0 length
-      uint64_t Length = (uint64_t)std::filesystem::file_size(FileList[iFile]);
-      if(!Length)
-      {
-        if(DEBUG_MODE) {std::cout << FileList[iFile] << " is empty, skipping..." << std::endl;}
+//=================================================
+// FilterSelects
+// -f rules use the exclusion syntax, an entry is
+// extracted if the rules would exclude it (or a
+// directory above it), everything without rules
+//=================================================
+static bool
+PHD_FilterSelects(const PHDC_ExclusionMatcher &_Filter, std::string_view _Path)
+{
+  if(_Filter.Rules.empty()) return 1;
 
-        continue;
-      }
+  uint32_t State = _Filter.Start;
+  size_t NameStart = 0;
+  for(;;)
+  {
+    size_t Slash = _Path.find('/', NameStart);
+    if(Slash == std::string_view::npos) return PHD_GlobExcludes(_Filter, PHD_GlobStep(_Filter, State, _Path.substr(NameStart)), 0);
 
-      MasterFileList[NewFileUID].InputPath = FileList[iFile];
+    State = PHD_GlobStep(_Filter, State, _Path.substr(NameStart, Slash - NameStart));
+    if(PHD_GlobExcludes(_Filter, State, 1)) return 1;
+    State = PHD_GlobStep(_Filter, State, "/");
+    NameStart = Slash+1;
+  }
+}
 
-      // remove _Input from DatPath
-      std::string DatPath = FileList[iFile];
-      for(int iChar = (int)_Input.length() + 1; iChar < (int)FileList[iFile].length(); ++iChar)
-      {
-        MasterFileList[NewFileUID].DatPath.push_back(FileList[iFile][iChar]);
-      }
+//=================================================
+// SafeDatPath
+// a path from a damaged or hand made .dat may not
+// leave the output directory: relative, no drive,
+// no empty, "." or ".." parts
+//=================================================
+static bool
+PHD_SafeDatPath(std::string_view _Path)
+{
+  if(!_Path.length() || _Path.find(':') != std::string_view::npos || _Path.find('\\') != std::string_view::npos) return 0;
 
-      MasterFileList[NewFileUID].Address = AddressCounter;
-      MasterFileList[NewFileUID].Length = Length;
+  size_t NameStart = 0;
+  for(;;)
+  {
+    size_t Slash = _Path.find('/', NameStart);
+    std::string_view Name = _Path.substr(NameStart, (Slash == std::string_view::npos) ? std::string_view::npos : Slash - NameStart);
+    if(!Name.length() || Name == "." || Name == "..") return 0;
+    if(Slash == std::string_view::npos) return 1;
+    NameStart = Slash+1;
+  }
+}
 
-      // iterate for next file
-      AddressCounter += Length+1; // fwrite puts 1 byte pad (0xff) between each file
-      NewFileUID++;
-    }
+//===============================================
+// WriteWholeFile
+// creates _OutputPath holding _Length bytes of
+// _Data, written straight from the caller's
+// memory (the .dat mapping for stored entries)
+//===============================================
+static int
+PHD_WriteWholeFile(std::string _OutputPath,
+                   const void *_Data,
+                   uint64_t _Length)
+{
+  HANDLE OutputFile = CreateFileA(_OutputPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if(OutputFile == INVALID_HANDLE_VALUE) return 1;
 
-    // iterate or end loop
-    if(CurrentDirectory+1 == MasterDirectoryList.size())
+  // WriteFile takes a DWORD size, write anything bigger in 1GB pieces
+  const uint8_t *Data = (const uint8_t*)_Data;
+  while(_Length)
+  {
+    DWORD Size = (DWORD)std::min<uint64_t>(_Length, 0x40000000);
+    if(PHD_WriteBlock(OutputFile, Data, Size, NULL))
     {
-      doGetDirList = 0;
+      CloseHandle(OutputFile);
+      return 1;
     }
+    Data += Size;
+    _Length -= Size;
+  }
 
-    else
-    {
-      CurrentDirectory++;
-    }
+  CloseHandle(OutputFile);
+  return 0;
+}
+
+//================================
+//    PHD_EXTRACT
+// writes the entries of _DatPath
+// selected by _Filters under
+// _OutputPath
+//================================
+// Every directory is created first, then _Threads workers take entries in
+// address order and write each one with a single WriteFile from the mapped
+// .dat, so stored entries never pass through a buffer of ours. -z entries
+// are decoded into a per-worker buffer, the files of a solid block are one
+// work item so the block is decoded once. Checksums are checked before an
+// entry is written, damaged entries are reported and skipped.
+static int
+PHD_EXTRACT(std::string _DatPath,
+            std::string _OutputPath,
+            const std::vector<std::string> &_Filters,
+            int _Threads)
+{
+  if(!_OutputPath.length())
+  {
+    std::cerr << "PhragDat Error: extract needs an output directory (-o\"path\"), see phragdat -h for help" << std::endl;
+    return 1;
   }
 
-  // debug report
-  if(DEBUG_MODE)
+  PHDC_ExclusionMatcher Filter;
+  if(PHD_CompileExclusions(_Filters, &Filter)) return 1;
+
+  PHD_Archive Archive;
+  int OpenResult = PHD_ArchiveOpen(&Archive, _DatPath.c_str());
+  if(OpenResult)
   {
-    for(uint64_t iFile = 0; iFile < (uint64_t)MasterFileList.size(); ++iFile)
-    {
-      std::cout << "\nInput File: " << MasterFileList[iFile].InputPath
-      << "\nDatPath: " << MasterFileList[iFile].DatPath
-      << "\nLength: " << MasterFileList[iFile].Length
-      << std::endl;
-    }
+    std::cerr << "PhragDat error: failed to open " << _DatPath
+    << ((OpenResult == PHD_ARCHIVE_ERROR_FORMAT) ? " (not a .dat, truncated or damaged table of contents)" : "") << std::endl;
+    return 1;
   }
 
-  // write .dat file
-  // (using C's FILE* instead of C++ filestream
-  // because its simpler when dealing with raw bytes,
-  // C++ filestream tends to mess with signed/unsigned which I can't be bothered to work around)
+  if(!Archive.TocOffset || PHD_ArchiveVerifyToc(&Archive))
+  {
+    std::cerr << "PhragDat error: " << _DatPath << (Archive.TocOffset ? ": table of contents checksum mismatch" : " was written before v6.0 and has no table of contents") << std::endl;
+    PHD_ArchiveClose(&Archive);
+    return 1;
+  }
+
+  double StartTime = PHD_GetSeconds();
+  if(_OutputPath.back() != '/') _OutputPath.push_back('/');
+
+  // work items in address order, the files of one solid block share an item
+  struct PHDC_ExtractItem
+  {
+    uint64_t Offset;
+    uint64_t Block;
+    std::vector<const PHD_TocEntry*> Entries;
+  };
+
+  std::vector<PHDC_ExtractItem> Items;
+  std::map<uint64_t, size_t> BlockItems;
+  std::vector<std::string> Directories;
+  uint64_t Selected = 0;
+
+  for(uint64_t iEntry = 0; iEntry < Archive.EntryCount; ++iEntry)
   {
-    FILE *OutputDatFile;
-    OutputDatFile = fopen(Dat_OutputPath.c_str(), "wb");
+    const PHD_TocEntry *Entry = &Archive.Entries[iEntry];
+    std::string_view Path = PHD_ArchiveEntryPath(&Archive, Entry);
+    if(!PHD_FilterSelects(Filter, Path)) continue;
 
-    if(!OutputDatFile)
+    if(!PHD_SafeDatPath(Path))
     {
-      std::cerr << "PhragDat error: failed to write " << Dat_OutputPath << ", check read/write privileges or spelling and try again, exiting..." << std::endl;
+      std::cerr << "PhragDat error: refusing to extract " << Path << ", it is not a path inside the output directory" << std::endl;
+      PHD_ArchiveClose(&Archive);
       return 1;
     }
 
-    // write header
+    for(size_t Slash = Path.find('/'); Slash != std::string_view::npos; Slash = Path.find('/', Slash+1))
     {
-      char Header[8] = {0x50, 0x48, 0x52, 0x44, 0x41, 0x54, VER_MAJ, VER_MIN};
-      fwrite(Header, 1, 8, OutputDatFile);
+      Directories.push_back(std::string(Path.substr(0, Slash)));
     }
 
-    // write data
-    for(int iFile = 0; iFile < MasterFileList.size(); ++iFile)
+    if(Entry->Method == PHD_METHOD_SOLID)
     {
-      std::cout << "Writing: " << MasterFileList[iFile].InputPath << std::endl;
-
-      FILE *InputFile;
-      InputFile = fopen(MasterFileList[iFile].InputPath.c_str(), "rb");
-
-      if(!InputFile)
-      {
-        std::cerr << "PhragDat error: failed reading " << MasterFileList[iFile].InputPath << ", exiting..." << std::endl;
-        fclose(OutputDatFile);
-        std::remove(Dat_OutputPath.c_str());
-        return 1;
-      }
-
-      int c;
-      do
+      auto Found = BlockItems.find(Entry->Block);
+      if(Found == BlockItems.end())
       {
-        c = fgetc (InputFile);
-        fputc(c, OutputDatFile);
+        uint64_t BlockOffset = (Entry->Block < Archive.BlockCount) ? Archive.Blocks[Entry->Block].Offset : 0;
+        Found = BlockItems.insert(std::make_pair((uint64_t)Entry->Block, Items.size())).first;
+        Items.push_back({BlockOffset, Entry->Block, {}});
       }
-      while (c != EOF);
-
-      fclose(InputFile);
+      Items[Found->second].Entries.push_back(Entry);
     }
 
-    fclose(OutputDatFile);
+    else Items.push_back({Entry->Offset, PHD_NO_BLOCK, {Entry}});
+    Selected++;
   }
 
-  std::cout << Dat_OutputPath << " written" << std::endl;
-  std::cout << "Writing: " << C_OutputPath << "..." << std::endl;
+  std::stable_sort(Items.begin(), Items.end(), [](const PHDC_ExtractItem &_A, const PHDC_ExtractItem &_B) {return _A.Offset < _B.Offset;});
 
-  // write contents.csv file
-  {
-    FILE *OutputCSVFile;
-    OutputCSVFile = fopen(C_OutputPath.c_str(), "wb");
+  // parents sort before their children, so one pass creates the whole tree
+  std::sort(Directories.begin(), Directories.end());
+  Directories.erase(std::unique(Directories.begin(), Directories.end()), Directories.end());
 
-    if(!OutputCSVFile)
+  std::error_code Error;
+  std::filesystem::create_directories(_OutputPath, Error);
+  for(size_t iDirectory = 0; iDirectory < Directories.size(); ++iDirectory)
+  {
+    std::string Directory = _OutputPath + Directories[iDirectory];
+    if(!CreateDirectoryA(Directory.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
     {
-      std::cerr << "PhragDat error: failed writing " << C_OutputPath << ", exiting..." << std::endl;
+      std::cerr << "PhragDat error: failed to create " << Directory << ", check read/write privileges" << std::endl;
+      PHD_ArchiveClose(&Archive);
       return 1;
     }
+  }
 
-    // write header
-    {
-      std::stringstream ssHeader;
-      ssHeader << "\"PHRDAT\"," << (int)VER_MAJ << "," << (int)VER_MIN << "\n";
-      std::string FileContents = ssHeader.str();
-      fwrite(&FileContents[0], 1, FileContents.length(), OutputCSVFile);
-    }
+  std::atomic<uint64_t> NextItem(0);
+  std::atomic<uint64_t> BytesWritten(0);
+  std::atomic<uint64_t> Damaged(0);
+  std::atomic<bool> Failed(0);
+  std::mutex ReportMutex;
 
-    // write file contents
-    for(int iFile = 0; iFile < MasterFileList.size(); ++iFile)
+  auto Worker = [&]()
+  {
+    PHD_BlockCache Cache;
+    std::vector<uint8_t> Buffer;
+
+    while(!Failed)
     {
-      std::stringstream ssContents;
-      ssContents << "\"" << MasterFileList[iFile].DatPath
-      << "\"," << (uint64_t)MasterFileList[iFile].Address
-      << "," << (uint64_t)MasterFileList[iFile].Length << "\n";
-      std::string FileContents = ssContents.str();
-      fwrite(&FileContents[0], 1, FileContents.length(), OutputCSVFile);
-    }
+      uint64_t iItem = NextItem++;
+      if(iItem >= Items.size()) break;
+      const PHDC_ExtractItem &Item = Items[iItem];
 
-    fclose(OutputCSVFile);
+      bool Intact = (Item.Block != PHD_NO_BLOCK) ? !PHD_ArchiveVerifyBlock(&Archive, Item.Block) : !PHD_ArchiveVerifyEntry(&Archive, Item.Entries[0]);
 
-  }
+      for(size_t iEntry = 0; iEntry < Item.Entries.size() && !Failed; ++iEntry)
+      {
+        const PHD_TocEntry *Entry = Item.Entries[iEntry];
+        std::string_view Path = PHD_ArchiveEntryPath(&Archive, Entry);
+        std::string_view Data;
+
+        if(Intact && Entry->Method == PHD_METHOD_LZ)
+        {
+          Buffer.resize((size_t)Entry->Length);
+          if(!PHD_ArchiveRead(&Archive, Entry, Buffer.data())) Data = std::string_view((const char*)Buffer.data(), Buffer.size());
+        }
+        else if(Intact) Data = PHD_ArchiveView(&Archive, Entry, &Cache);
 
-  std::cout << C_OutputPath << " written" << std::endl;
+        if(!Data.data())
+        {
+          std::lock_guard<std::mutex> Lock(ReportMutex);
+          std::cerr << "PhragDat error: " << Path << " is damaged, skipping" << std::endl;
+          Damaged++;
+          continue;
+        }
 
-  return 0;
+        if(PHD_WriteWholeFile(_OutputPath + std::string(Path), Data.data(), Data.length()))
+        {
+          std::lock_guard<std::mutex> Lock(ReportMutex);
+          std::cerr << "PhragDat error: failed writing " << _OutputPath << Path << ", exiting..." << std::endl;
+          Failed = 1;
+          break;
+        }
+
+        BytesWritten += Data.length();
+      }
+    }
+  };
+
+  std::vector<std::thread> Workers;
+  for(int iThread = 1; iThread < _Threads; ++iThread) {Workers.push_back(std::thread(Worker));}
+  Worker();
+  for(size_t iThread = 0; iThread < Workers.size(); ++iThread) {Workers[iThread].join();}
+
+  double Seconds = PHD_GetSeconds() - StartTime;
+  std::cout << _DatPath << " extracted to " << _OutputPath << ": " << Selected - Damaged << " of " << Archive.EntryCount << " files, "
+  << BytesWritten << " bytes, " << std::fixed << std::setprecision(1) << PHD_GetMBPerSecond(BytesWritten, Seconds) << " MB/s";
+  if(Damaged) std::cout << ", " << Damaged << " damaged";
+  std::cout << std::endl;
+
+  PHD_ArchiveClose(&Archive);
+  return (Failed || Damaged) ? 1 : 0;
 }
 
 /* // just testing some stuff, ignore this
@@ -799,19 +5069,39 @@ std::map<std::string,DatFileMember> nspdat =
 
 //================================
 //    Main
+// (phragdat_bench.cpp includes
+// this file with PHD_NO_MAIN)
 //================================
+#ifndef PHD_NO_MAIN
 int main(int argc, char **argv)
 {
-  if(argc < 2 || argc > 5)
+  if(argc < 2)
   {
     std::cerr << PHD_UsageStr << std::endl;
     return 1;
   }
 
   std::string arg_input; // -i"path"
-  std::string arg_datpath; // -d"path"
+  std::string arg_datpath; // -d"path", -d- for stdout
   std::string arg_cpath; // -c"path"
+  std::string arg_hpath; // -g"path"
   std::string arg_exclusions; // -e"path"
+  std::string arg_trace; // -l"path"
+  std::string arg_hot; // -p"path"
+  int arg_threads = 1; // -jN
+  bool arg_compress = 0; // -z
+  bool arg_solid = 0; // -s
+  uint64_t arg_alignment = 1; // -aN
+  bool arg_incremental = 0; // -u
+  bool arg_dedup = 0; // -r
+  std::string arg_verify; // -t"path"
+  std::string arg_extract; // -x"path"
+  std::string arg_outpath; // -o"path"
+  std::vector<std::string> arg_filters; // -f"rule", repeatable
+  bool arg_stats = 0; // --stats
+  std::string arg_statsjson; // --stats-json"path"
+  bool arg_quiet = 0; // -q
+  int arg_backend = PHD_BACKEND_AUTO; // -b"ioring"/"blocking"
   std::map<int,bool> ArgIsProcessed; // check all args processed
 
   // process args
@@ -881,6 +5171,19 @@ int main(int argc, char **argv)
       }
     }
 
+    // set header path
+    if(ThisArg[0] == '-' && ThisArg[1] == 'g')
+    {
+      if(ThisArg.length() > 2)
+      {
+        for(int iChar = 2; iChar < ThisArg.length(); ++iChar)
+        {
+          arg_hpath.push_back(ThisArg[iChar]);
+          ArgIsProcessed[iArg] = 1;
+        }
+      }
+    }
+
     // set exclusions
     if(ThisArg[0] == '-' && ThisArg[1] == 'e')
     {
@@ -894,11 +5197,175 @@ int main(int argc, char **argv)
       }
     }
 
+    // set access trace
+    if(ThisArg[0] == '-' && ThisArg[1] == 'l')
+    {
+      if(ThisArg.length() > 2)
+      {
+        for(int iChar = 2; iChar < ThisArg.length(); ++iChar)
+        {
+          arg_trace.push_back(ThisArg[iChar]);
+          ArgIsProcessed[iArg] = 1;
+        }
+      }
+    }
+
+    // set hot list
+    if(ThisArg[0] == '-' && ThisArg[1] == 'p')
+    {
+      if(ThisArg.length() > 2)
+      {
+        for(int iChar = 2; iChar < ThisArg.length(); ++iChar)
+        {
+          arg_hot.push_back(ThisArg[iChar]);
+          ArgIsProcessed[iArg] = 1;
+        }
+      }
+    }
+
+    // set compression
+    if(ThisArg == "-z")
+    {
+      arg_compress = 1;
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set solid blocks
+    if(ThisArg == "-s")
+    {
+      arg_solid = 1;
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set incremental rebuild
+    if(ThisArg == "-u")
+    {
+      arg_incremental = 1;
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set verify
+    if(ThisArg[0] == '-' && ThisArg[1] == 't')
+    {
+      if(ThisArg.length() > 2)
+      {
+        for(int iChar = 2; iChar < ThisArg.length(); ++iChar)
+        {
+          arg_verify.push_back(ThisArg[iChar]);
+          ArgIsProcessed[iArg] = 1;
+        }
+      }
+    }
+
+    // set extract
+    if(ThisArg[0] == '-' && ThisArg[1] == 'x')
+    {
+      if(ThisArg.length() > 2)
+      {
+        for(int iChar = 2; iChar < ThisArg.length(); ++iChar)
+        {
+          arg_extract.push_back(ThisArg[iChar]);
+          ArgIsProcessed[iArg] = 1;
+        }
+      }
+    }
+
+    // set extract output path
+    if(ThisArg[0] == '-' && ThisArg[1] == 'o')
+    {
+      if(ThisArg.length() > 2)
+      {
+        for(int iChar = 2; iChar < ThisArg.length(); ++iChar)
+        {
+          arg_outpath.push_back(ThisArg[iChar]);
+          ArgIsProcessed[iArg] = 1;
+        }
+      }
+    }
+
+    // add extract filter
+    if(ThisArg[0] == '-' && ThisArg[1] == 'f' && ThisArg.length() > 2)
+    {
+      arg_filters.push_back(ThisArg.substr(2));
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set statistics report
+    if(ThisArg == "--stats")
+    {
+      arg_stats = 1;
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set statistics json path
+    if(ThisArg.compare(0, 12, "--stats-json") == 0 && ThisArg.length() > 12)
+    {
+      arg_statsjson = ThisArg.substr(12);
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set quiet (no per-file lines)
+    if(ThisArg == "-q")
+    {
+      arg_quiet = 1;
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set copy backend
+    if(ThisArg[0] == '-' && ThisArg[1] == 'b' && ThisArg.length() > 2)
+    {
+      std::string Backend = ThisArg.substr(2);
+      if(Backend == "auto") arg_backend = PHD_BACKEND_AUTO;
+      else if(Backend == "blocking") arg_backend = PHD_BACKEND_BLOCKING;
+      else if(Backend == "ioring") arg_backend = PHD_BACKEND_IORING;
+      else
+      {
+        std::cerr << "PhragDat Error: -b backend must be auto, blocking or ioring" << std::endl;
+        return 1;
+      }
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set deduplication
+    if(ThisArg == "-r")
+    {
+      arg_dedup = 1;
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set entry alignment
+    if(ThisArg[0] == '-' && ThisArg[1] == 'a' && ThisArg.length() > 2)
+    {
+      arg_alignment = strtoull(&ThisArg[2], NULL, 10);
+      if(!arg_alignment || (arg_alignment & (arg_alignment-1)) || arg_alignment > PHD_ALIGN_MAX)
+      {
+        std::cerr << "PhragDat Error: -a alignment must be a power of 2 from 1 to " << PHD_ALIGN_MAX << std::endl;
+        return 1;
+      }
+      ArgIsProcessed[iArg] = 1;
+    }
+
+    // set threads (-j alone uses every hardware thread)
+    if(ThisArg[0] == '-' && ThisArg[1] == 'j')
+    {
+      if(ThisArg.length() > 2) arg_threads = atoi(&ThisArg[2]);
+      else arg_threads = (int)std::thread::hardware_concurrency();
+      if(arg_threads < 1) arg_threads = 1;
+      ArgIsProcessed[iArg] = 1;
+    }
+
     // remove duplicate slashes in args
     if(arg_input.length()) arg_input = PHD_EnsureSingleSlashes(arg_input);
     if(arg_datpath.length()) arg_datpath = PHD_EnsureSingleSlashes(arg_datpath);
     if(arg_cpath.length()) arg_cpath = PHD_EnsureSingleSlashes(arg_cpath);
+    if(arg_hpath.length()) arg_hpath = PHD_EnsureSingleSlashes(arg_hpath);
     if(arg_exclusions.length()) arg_exclusions = PHD_EnsureSingleSlashes(arg_exclusions);
+    if(arg_trace.length()) arg_trace = PHD_EnsureSingleSlashes(arg_trace);
+    if(arg_hot.length()) arg_hot = PHD_EnsureSingleSlashes(arg_hot);
+    if(arg_verify.length()) arg_verify = PHD_EnsureSingleSlashes(arg_verify);
+    if(arg_extract.length()) arg_extract = PHD_EnsureSingleSlashes(arg_extract);
+    if(arg_outpath.length()) arg_outpath = PHD_EnsureSingleSlashes(arg_outpath);
+    if(arg_statsjson.length()) arg_statsjson = PHD_EnsureSingleSlashes(arg_statsjson);
 
   }
 
@@ -912,7 +5379,38 @@ int main(int argc, char **argv)
     }
   }
 
-  int ecode = PHD_COMPILE(arg_input, arg_datpath, arg_cpath, arg_exclusions);
+  if(arg_verify.length()) return PHD_VERIFY(arg_verify, arg_threads);
+  if(arg_extract.length()) return PHD_EXTRACT(arg_extract, arg_outpath, arg_filters, arg_threads);
+
+  FILE_REPORT = !arg_quiet;
+  PHD_Stats.RecordFiles = arg_stats || arg_statsjson.length();
+  int ecode;
+
+  // -d- streams the .dat to stdout
+  if(arg_datpath == "-")
+  {
+    if(arg_solid || arg_incremental || arg_dedup || arg_trace.length() || arg_hot.length())
+    {
+      std::cerr << "PhragDat Error: -s, -u, -r, -l and -p need every file before the first is written, they cannot be used with -d-" << std::endl;
+      return 1;
+    }
+    if(arg_threads > 1)
+    {
+      std::cerr << "PhragDat Error: -d- walks and writes the input on one thread, -j cannot be used with it" << std::endl;
+      return 1;
+    }
+    if(arg_backend == PHD_BACKEND_IORING)
+    {
+      std::cerr << "PhragDat Error: -d- writes stdout in order with the blocking copy engine, -b\"ioring\" needs a .dat file" << std::endl;
+      return 1;
+    }
+    ecode = PHD_COMPILE_STREAM(arg_input, arg_cpath, arg_exclusions, arg_compress, arg_alignment, arg_hpath);
+  }
+
+  else ecode = PHD_COMPILE(arg_input, arg_datpath, arg_cpath, arg_exclusions, arg_threads, arg_compress, arg_solid, arg_incremental, arg_dedup, arg_alignment, arg_backend, arg_hpath, arg_trace, arg_hot);
+
+  if(!ecode && PHD_Stats.RecordFiles) ecode = PHD_ReportStats(arg_stats, arg_statsjson, (arg_datpath == "-") ? std::cerr : std::cout);
 
   return ecode;
-}
\ No newline at end of file
+}
+#endif // PHD_NO_MAIN
@@ -0,0 +1,595 @@
+//====================================
+// PhragDat Benchmarks
+// synthetic input tree + phase timing
+// C++17 Windows 64-bit
+//====================================
+// (c) Phragware 2020
+//====================================
+
+// pull in the whole tool without its main()
+#define PHD_NO_MAIN
+#include "phragdat.cpp"
+
+#define BENCH_DEFAULT_FILES 1000000
+#define BENCH_FANOUT 16 // subdirectories per directory
+#define BENCH_DEFAULT_DEPTH 3 // directory levels below the root
+#define BENCH_MAX_DEPTH 5
+#define BENCH_DEFAULT_MAX_SIZE 4096
+#define BENCH_WORDS_SIZE 0x1000 // file contents are runs copied from this many random bytes
+#define BENCH_READ_DIRECTORY_SHARE 16 // the read benchmark loads every file of one directory in this many
+
+static std::string BENCH_UsageStr =
+"phragdat_bench -o\"bench/tree/dir\" -nFILES(optional) -dDEPTH(optional) -s\"uniform:MAX\"|\"log:MAX\"(optional)\
+\n               -pDUPLICATE%(optional) -jN(optional) -rREPEATS(optional) -J\"results.json\"(optional)\
+\n    generates a synthetic tree in bench/tree/dir (kept and reused if it already matches), times the\
+\n    serial scan against the parallel scan with 2..N threads, then compiles the tree with several\
+\n    option sets into bench/tree/dir.out and times each phase of PHD_COMPILE (best and first run,\
+\n    the tree is in the file cache for both), then loads the files of one directory in 16 from the\
+\n    .dat one read per file and with PHD_ArchiveReadBatch, cached (warm) and unbuffered\
+\n    -nFILES: file count, default 1000000\
+\n    -dDEPTH: directory levels of 16 subdirectories each, files spread over the deepest level, default 3\
+\n    -s: file sizes, uniform from 1 to MAX bytes or log-uniform (many small, few large), default uniform:4096\
+\n    -pDUPLICATE%: percentage of files that are byte-identical copies of an earlier file, default 0\
+\n    -J: also write every result to results.json";
+
+//================================
+// BenchTree (generator settings)
+//================================
+struct BENCH_Tree
+{
+  uint64_t Files;
+  int Depth;
+  bool LogSizes; // log-uniform instead of uniform
+  uint64_t MaxSize;
+  int DuplicatePercent;
+};
+
+//=======================================
+// BenchTreeSettings
+// one line that identifies a tree, kept
+// in phdbench.txt to reuse the tree
+//=======================================
+static std::string
+BENCH_TreeSettings(const BENCH_Tree &_Tree)
+{
+  std::stringstream ssSettings;
+  ssSettings << "files=" << _Tree.Files << ",fanout=" << BENCH_FANOUT << ",depth=" << _Tree.Depth
+  << ",sizes=" << (_Tree.LogSizes ? "log:" : "uniform:") << _Tree.MaxSize << ",duplicates=" << _Tree.DuplicatePercent;
+  return ssSettings.str();
+}
+
+//=============================================
+// BenchGenerateTree
+// deterministic tree: _Tree.Depth levels of
+// BENCH_FANOUT directories, files spread round
+// robin over the leaf directories, contents
+// are seeded per file (a duplicate reuses the
+// seed and size of an earlier file) and built
+// from runs of a shared word table so -z has
+// something to find
+//=============================================
+static int
+BENCH_GenerateTree(std::string _Root, const BENCH_Tree &_Tree)
+{
+  std::string MarkerPath = _Root + "/phdbench.txt";
+  std::string Settings = BENCH_TreeSettings(_Tree);
+
+  // reuse an existing tree generated with the same settings
+  {
+    std::ifstream Marker(MarkerPath);
+    std::string Line;
+    if(Marker.is_open() && std::getline(Marker, Line) && Line == Settings)
+    {
+      std::cout << "Reusing synthetic tree in " << _Root << std::endl;
+      return 0;
+    }
+  }
+
+  // never write over (or delete) a directory that holds anything else
+  if(GetFileAttributesA(_Root.c_str()) != INVALID_FILE_ATTRIBUTES && !PathIsDirectoryEmptyA(_Root.c_str()))
+  {
+    std::cerr << "PhragDat bench error: " << _Root << " holds a tree generated with other settings (or other files), delete it or pick another directory" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Generating " << _Tree.Files << " files in " << _Root << "..." << std::endl;
+  CreateDirectoryA(_Root.c_str(), NULL);
+
+  std::vector<std::string> Level;
+  Level.push_back(_Root);
+  for(int iDepth = 0; iDepth < _Tree.Depth; ++iDepth)
+  {
+    std::vector<std::string> NextLevel;
+    for(size_t iDir = 0; iDir < Level.size(); ++iDir)
+    {
+      for(int iSub = 0; iSub < BENCH_FANOUT; ++iSub)
+      {
+        std::stringstream ssDir;
+        ssDir << Level[iDir] << "/d" << iSub;
+        CreateDirectoryA(ssDir.str().c_str(), NULL);
+        NextLevel.push_back(ssDir.str());
+      }
+    }
+    Level = NextLevel;
+  }
+
+  std::mt19937 Random(2020);
+  std::vector<uint8_t> Words(BENCH_WORDS_SIZE);
+  for(size_t iByte = 0; iByte < Words.size(); ++iByte) Words[iByte] = (uint8_t)Random();
+
+  // (size, content seed) of every file so far, duplicates pick one at random
+  std::vector<std::pair<uint64_t, uint32_t>> Contents;
+  Contents.reserve((size_t)_Tree.Files);
+  std::vector<uint8_t> Data;
+
+  for(uint64_t iFile = 0; iFile < _Tree.Files; ++iFile)
+  {
+    std::stringstream ssFile;
+    ssFile << Level[iFile % Level.size()] << "/f" << iFile << ".bin";
+
+    uint64_t Size;
+    uint32_t Seed;
+    if(iFile && (int)(Random() % 100) < _Tree.DuplicatePercent)
+    {
+      std::pair<uint64_t, uint32_t> Original = Contents[Random() % Contents.size()];
+      Size = Original.first;
+      Seed = Original.second;
+    }
+    else
+    {
+      if(_Tree.LogSizes) Size = (uint64_t)exp(log((double)_Tree.MaxSize) * (double)Random() / 4294967296.0);
+      else Size = 1 + (uint64_t)Random() % _Tree.MaxSize;
+      if(Size < 1) Size = 1;
+      if(Size > _Tree.MaxSize) Size = _Tree.MaxSize;
+      Seed = (uint32_t)Random();
+    }
+    Contents.push_back(std::make_pair(Size, Seed));
+
+    Data.resize((size_t)Size);
+    std::mt19937 FileRandom(Seed);
+    for(size_t iByte = 0; iByte < Data.size();)
+    {
+      uint32_t Run = FileRandom();
+      size_t Offset = Run % (BENCH_WORDS_SIZE - 32);
+      size_t Length = std::min<size_t>(4 + (Run >> 16) % 28, Data.size() - iByte);
+      memcpy(&Data[iByte], &Words[Offset], Length);
+      iByte += Length;
+    }
+
+    HANDLE File = CreateFileA(ssFile.str().c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    bool Failed = (File == INVALID_HANDLE_VALUE);
+    for(uint64_t Written = 0; !Failed && Written < Size;)
+    {
+      DWORD Chunk = (DWORD)std::min<uint64_t>(Size - Written, 0x40000000);
+      Failed = PHD_WriteBlock(File, &Data[(size_t)Written], Chunk, NULL) != 0;
+      Written += Chunk;
+    }
+
+    if(Failed)
+    {
+      std::cerr << "PhragDat bench error: failed writing " << ssFile.str() << std::endl;
+      if(File != INVALID_HANDLE_VALUE) CloseHandle(File);
+      return 1;
+    }
+    CloseHandle(File);
+  }
+
+  std::ofstream Marker(MarkerPath);
+  Marker << Settings << "\n";
+  return 0;
+}
+
+//=======================================
+// BenchFlatten
+// breadth first file list of scan tree
+//=======================================
+static void
+BENCH_Flatten(PHDC_ScanNode *_Root, std::vector<std::string> &_Files, uint64_t *_Directories, uint64_t *_Bytes)
+{
+  std::vector<PHDC_ScanNode*> Queue;
+  Queue.push_back(_Root);
+  *_Bytes = 0;
+
+  for(size_t iNode = 0; iNode < Queue.size(); ++iNode)
+  {
+    PHDC_ScanNode *Node = Queue[iNode];
+    for(size_t iChild = 0; iChild < Node->Children.size(); ++iChild) Queue.push_back(Node->Children[iChild].get());
+    for(size_t iFile = 0; iFile < Node->Files.size(); ++iFile)
+    {
+      _Files.push_back(Node->Path + "/" + std::string(PHD_ScanFileName(Node, Node->Files[iFile])));
+      *_Bytes += Node->Files[iFile].Size;
+    }
+  }
+
+  *_Directories = (uint64_t)Queue.size();
+}
+
+//====================================
+// BenchScan
+// best of _Repeats, 1 thread = serial
+//====================================
+static double
+BENCH_Scan(std::string _Root, int _Threads, int _Repeats, std::vector<std::string> &_Files, uint64_t *_Directories, uint64_t *_Bytes)
+{
+  PHDC_ExclusionMatcher Exclusions;
+  double Best = 0.0;
+
+  for(int iRepeat = 0; iRepeat < _Repeats; ++iRepeat)
+  {
+    double StartTime = PHD_GetSeconds();
+    std::unique_ptr<PHDC_ScanNode> Root;
+    if(_Threads > 1) Root = PHD_ScanTreeParallel(_Root, Exclusions, _Threads);
+    else Root = PHD_ScanTreeSerial(_Root, Exclusions);
+    double Seconds = PHD_GetSeconds() - StartTime;
+
+    if(!iRepeat || Seconds < Best) Best = Seconds;
+
+    _Files.clear();
+    BENCH_Flatten(Root.get(), _Files, _Directories, _Bytes);
+  }
+
+  return Best;
+}
+
+//=====================================
+// BenchCompile
+// best of _Repeats by total time and
+// the first run, PHD_COMPILE's report
+// is discarded
+//=====================================
+struct BENCH_NullBuffer : std::streambuf
+{
+  int overflow(int _Char) {return _Char;}
+};
+
+static int
+BENCH_Compile(std::string _Root, std::string _OutputDir, int _Threads, bool _Compress, bool _Solid, bool _Dedup, int _Backend, int _Repeats, PHDC_CompileTimes *_Best, PHDC_CompileTimes *_First)
+{
+  BENCH_NullBuffer NullBuffer;
+
+  for(int iRepeat = 0; iRepeat < _Repeats; ++iRepeat)
+  {
+    std::streambuf *Cout = std::cout.rdbuf(&NullBuffer);
+    int Result = PHD_COMPILE(_Root, _OutputDir, _OutputDir, std::string(), _Threads, _Compress, _Solid, 0, _Dedup, 1, _Backend, std::string(), std::string(), std::string());
+    std::cout.rdbuf(Cout);
+
+    if(Result) return 1;
+    if(!iRepeat) *_First = PHD_CompileTimes;
+    if(!iRepeat || PHD_CompileTimes.Total < _Best->Total) *_Best = PHD_CompileTimes;
+  }
+
+  return 0;
+}
+
+//=============================================
+// BenchRead
+// a "level load" from _DatPath: every file of
+// one directory in BENCH_READ_DIRECTORY_SHARE,
+// in a shuffled order, read the way .csv users
+// do (one positioned ReadFile per file, _Threads
+// 0) or as one PHD_ArchiveReadBatch with
+// _Threads threads. Best of _Repeats, *_Data
+// receives the files back to back to compare.
+// The compile just wrote the .dat, so cached
+// reads only time calls and copies: _Unbuffered
+// reads go to the device every repeat
+//=============================================
+static int
+BENCH_Read(std::string _DatPath, int _Threads, bool _Unbuffered, int _Repeats, std::vector<uint8_t> &_Data, uint64_t *_Files, double *_Best)
+{
+  PHD_Archive Archive;
+  if(PHD_ArchiveOpen(&Archive, _DatPath.c_str()))
+  {
+    std::cerr << "PhragDat bench error: failed to open " << _DatPath << std::endl;
+    return 1;
+  }
+
+  // directories in path order, every BENCH_READ_DIRECTORY_SHARE-th one is loaded
+  std::map<std::string_view, std::vector<std::string_view>> Directories;
+  for(uint64_t iEntry = 0; iEntry < Archive.EntryCount; ++iEntry)
+  {
+    std::string_view Path = PHD_ArchiveEntryPath(&Archive, &Archive.Entries[iEntry]);
+    size_t NameStart = Path.rfind('/');
+    Directories[Path.substr(0, (NameStart == std::string_view::npos) ? 0 : NameStart)].push_back(Path);
+  }
+
+  std::vector<std::string_view> Paths;
+  size_t iDirectory = 0;
+  for(auto Directory = Directories.begin(); Directory != Directories.end(); ++Directory, ++iDirectory)
+  {
+    if(!(iDirectory % BENCH_READ_DIRECTORY_SHARE)) Paths.insert(Paths.end(), Directory->second.begin(), Directory->second.end());
+  }
+
+  std::sort(Paths.begin(), Paths.end());
+  std::shuffle(Paths.begin(), Paths.end(), std::mt19937(2020));
+
+  // buffers are laid out before timing, as a loader sizes them from the .csv
+  std::vector<PHD_BatchRead> Reads(Paths.size());
+  uint64_t Bytes = 0;
+  uint64_t Largest = 0;
+  for(size_t iPath = 0; iPath < Paths.size(); ++iPath)
+  {
+    Reads[iPath].Path = Paths[iPath];
+    Reads[iPath].BufferSize = PHD_ArchiveFind(&Archive, Paths[iPath])->Length;
+    Bytes += Reads[iPath].BufferSize;
+    Largest = std::max(Largest, Reads[iPath].BufferSize);
+  }
+
+  _Data.assign((size_t)Bytes, 0);
+  for(size_t iPath = 0, Offset = 0; iPath < Paths.size(); Offset += (size_t)Reads[iPath++].BufferSize) {Reads[iPath].Buffer = &_Data[Offset];}
+
+  // unbuffered per-file reads cover the file's sectors into an aligned buffer and copy it out
+  HANDLE Unbuffered = INVALID_HANDLE_VALUE;
+  uint8_t *Sectors = NULL;
+  if(_Unbuffered && !_Threads)
+  {
+    Unbuffered = CreateFileA(_DatPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+    Sectors = (uint8_t*)VirtualAlloc(NULL, (size_t)Largest + 2*PHD_BATCH_SECTOR, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if(Unbuffered == INVALID_HANDLE_VALUE || !Sectors)
+    {
+      std::cerr << "PhragDat bench error: failed to open " << _DatPath << " unbuffered" << std::endl;
+      if(Unbuffered != INVALID_HANDLE_VALUE) CloseHandle(Unbuffered);
+      if(Sectors) VirtualFree(Sectors, 0, MEM_RELEASE);
+      PHD_ArchiveClose(&Archive);
+      return 1;
+    }
+  }
+
+  int Result = 0;
+  for(int iRepeat = 0; iRepeat < _Repeats && !Result; ++iRepeat)
+  {
+    double StartTime = PHD_GetSeconds();
+
+    if(_Threads) Result = PHD_ArchiveReadBatch(&Archive, Reads.data(), Reads.size(), PHD_BATCH_GAP, _Threads, _Unbuffered);
+
+    // seek to the address, read the length
+    for(size_t iPath = 0; iPath < Paths.size() && !_Threads && !Result; ++iPath)
+    {
+      const PHD_TocEntry *Entry = PHD_ArchiveFind(&Archive, Paths[iPath]);
+      uint64_t Start = _Unbuffered ? Entry->Offset & ~(uint64_t)(PHD_BATCH_SECTOR-1) : Entry->Offset;
+      uint64_t Needed = Entry->Offset + Entry->Length - Start;
+      uint64_t Length = _Unbuffered ? (Needed + PHD_BATCH_SECTOR-1) & ~(uint64_t)(PHD_BATCH_SECTOR-1) : Needed;
+
+      OVERLAPPED Overlapped = {};
+      Overlapped.Offset = (DWORD)(Start & 0xffffffff);
+      Overlapped.OffsetHigh = (DWORD)(Start >> 32);
+      DWORD BytesRead = 0;
+      if(Entry->Method != PHD_METHOD_STORE || Length > 0xffffffff ||
+         !ReadFile(_Unbuffered ? Unbuffered : Archive.File, _Unbuffered ? Sectors : (uint8_t*)Reads[iPath].Buffer, (DWORD)Length, &BytesRead, &Overlapped) ||
+         BytesRead < Needed)
+      {
+        Result = 1;
+      }
+      else if(_Unbuffered) memcpy(Reads[iPath].Buffer, Sectors + (Entry->Offset - Start), (size_t)Entry->Length);
+    }
+
+    double Seconds = PHD_GetSeconds() - StartTime;
+    if(!iRepeat || Seconds < *_Best) *_Best = Seconds;
+  }
+
+  if(Unbuffered != INVALID_HANDLE_VALUE) CloseHandle(Unbuffered);
+  if(Sectors) VirtualFree(Sectors, 0, MEM_RELEASE);
+  PHD_ArchiveClose(&Archive);
+  *_Files = Paths.size();
+
+  if(Result) std::cerr << "PhragDat bench error: reading " << _DatPath << " failed" << std::endl;
+  return Result ? 1 : 0;
+}
+
+//================================
+//    Main
+//================================
+int main(int argc, char **argv)
+{
+  std::string arg_output; // -o"path"
+  BENCH_Tree arg_tree = {BENCH_DEFAULT_FILES, BENCH_DEFAULT_DEPTH, 0, BENCH_DEFAULT_MAX_SIZE, 0}; // -nN -dN -s"sizes" -pN
+  int arg_threads = (int)std::thread::hardware_concurrency(); // -jN
+  int arg_repeats = 3; // -rN
+  std::string arg_json; // -J"path"
+
+  for(int iArg = 1; iArg < argc; ++iArg)
+  {
+    std::string ThisArg = argv[iArg];
+
+    if(ThisArg[0] == '-' && ThisArg[1] == 'o' && ThisArg.length() > 2) arg_output = PHD_EnsureSingleSlashes(ThisArg.substr(2));
+    else if(ThisArg[0] == '-' && ThisArg[1] == 'n' && ThisArg.length() > 2) arg_tree.Files = strtoull(&ThisArg[2], NULL, 10);
+    else if(ThisArg[0] == '-' && ThisArg[1] == 'd' && ThisArg.length() > 2) arg_tree.Depth = atoi(&ThisArg[2]);
+    else if(ThisArg[0] == '-' && ThisArg[1] == 'p' && ThisArg.length() > 2) arg_tree.DuplicatePercent = atoi(&ThisArg[2]);
+    else if(ThisArg[0] == '-' && ThisArg[1] == 'j' && ThisArg.length() > 2) arg_threads = atoi(&ThisArg[2]);
+    else if(ThisArg[0] == '-' && ThisArg[1] == 'r' && ThisArg.length() > 2) arg_repeats = atoi(&ThisArg[2]);
+    else if(ThisArg[0] == '-' && ThisArg[1] == 'J' && ThisArg.length() > 2) arg_json = ThisArg.substr(2);
+    else if(ThisArg.compare(0, 10, "-suniform:") == 0 && ThisArg.length() > 10)
+    {
+      arg_tree.MaxSize = strtoull(&ThisArg[10], NULL, 10);
+      arg_tree.LogSizes = 0;
+    }
+    else if(ThisArg.compare(0, 6, "-slog:") == 0 && ThisArg.length() > 6)
+    {
+      arg_tree.MaxSize = strtoull(&ThisArg[6], NULL, 10);
+      arg_tree.LogSizes = 1;
+    }
+    else
+    {
+      std::cerr << BENCH_UsageStr << std::endl;
+      return 1;
+    }
+  }
+
+  if(!arg_output.length() || !arg_tree.Files || !arg_tree.MaxSize || arg_tree.Depth < 0 || arg_tree.Depth > BENCH_MAX_DEPTH ||
+     arg_tree.DuplicatePercent < 0 || arg_tree.DuplicatePercent > 100)
+  {
+    std::cerr << BENCH_UsageStr << std::endl;
+    return 1;
+  }
+
+  if(arg_threads < 2) arg_threads = 2;
+  if(arg_repeats < 1) arg_repeats = 1;
+  if(arg_output.back() == '/') arg_output.pop_back();
+
+  if(BENCH_GenerateTree(arg_output, arg_tree)) return 1;
+
+  std::stringstream ssJson;
+  ssJson << std::fixed << std::setprecision(6);
+
+  // serial loop is the baseline every parallel run is checked against
+  std::vector<std::string> SerialFiles;
+  uint64_t SerialDirectories = 0;
+  uint64_t TreeBytes = 0;
+  double SerialSeconds = BENCH_Scan(arg_output, 1, arg_repeats, SerialFiles, &SerialDirectories, &TreeBytes);
+
+  std::cout << std::fixed << std::setprecision(3)
+  << "scan serial: " << SerialFiles.size() << " files, " << SerialDirectories << " dirs, "
+  << SerialSeconds << " s, " << std::setprecision(0) << (double)SerialFiles.size() / SerialSeconds << " files/s" << std::endl;
+
+  ssJson << "{\n  \"tree\": {\"path\": " << PHD_JsonString(arg_output) << ", \"settings\": " << PHD_JsonString(BENCH_TreeSettings(arg_tree))
+  << ", \"files\": " << SerialFiles.size() << ", \"directories\": " << SerialDirectories << ", \"bytes\": " << TreeBytes << "},\n"
+  << "  \"scan\": [\n    {\"threads\": 1, \"seconds\": " << SerialSeconds << ", \"files_per_second\": " << (double)SerialFiles.size() / SerialSeconds << "}";
+
+  for(int iThreads = 2; iThreads <= arg_threads; iThreads *= 2)
+  {
+    std::vector<std::string> ParallelFiles;
+    uint64_t ParallelDirectories = 0;
+    uint64_t ParallelBytes = 0;
+    double ParallelSeconds = BENCH_Scan(arg_output, iThreads, arg_repeats, ParallelFiles, &ParallelDirectories, &ParallelBytes);
+
+    std::cout << std::fixed << std::setprecision(3)
+    << "scan parallel -j" << iThreads << ": " << ParallelFiles.size() << " files, " << ParallelDirectories << " dirs, "
+    << ParallelSeconds << " s, " << std::setprecision(0) << (double)ParallelFiles.size() / ParallelSeconds << " files/s, "
+    << std::setprecision(2) << SerialSeconds / ParallelSeconds << "x serial" << std::endl;
+
+    if(ParallelFiles != SerialFiles || ParallelDirectories != SerialDirectories)
+    {
+      std::cerr << "PhragDat bench error: parallel scan with " << iThreads << " threads does not match the serial scan" << std::endl;
+      return 1;
+    }
+
+    ssJson << ",\n    {\"threads\": " << iThreads << ", \"seconds\": " << ParallelSeconds << ", \"files_per_second\": " << (double)ParallelFiles.size() / ParallelSeconds << "}";
+
+    if(iThreads < arg_threads && iThreads*2 > arg_threads) iThreads = arg_threads/2;
+  }
+
+  // the generator and the scans above leave the tree in the file cache, so no run reads it cold:
+  // the first run of each option set shows what the repeats (the best is reported) hide
+  std::cout << "compile: best of " << arg_repeats << " with the input tree in the file cache, first run in brackets" << std::endl;
+  ssJson << "\n  ],\n  \"compile_cache\": \"warm\",\n  \"compile\": [";
+
+  // .dat and .csv go beside the tree, inside it they would be scanned by the next run
+  std::string CompileDir = arg_output + ".out";
+  CreateDirectoryA(CompileDir.c_str(), NULL);
+
+  // -bblocking against the default shows what IoRing gains where the system has it
+  struct {int Threads; bool Compress; bool Solid; bool Dedup; int Backend;} Configs[] =
+  {
+    {1, 0, 0, 0, PHD_BACKEND_AUTO},
+    {arg_threads, 0, 0, 0, PHD_BACKEND_AUTO},
+    {arg_threads, 0, 0, 0, PHD_BACKEND_BLOCKING},
+    {arg_threads, 1, 0, 0, PHD_BACKEND_AUTO},
+    {arg_threads, 1, 1, 0, PHD_BACKEND_AUTO},
+    {arg_threads, 0, 0, 1, PHD_BACKEND_AUTO}
+  };
+
+  for(size_t iConfig = 0; iConfig < sizeof(Configs)/sizeof(Configs[0]); ++iConfig)
+  {
+    std::stringstream ssName;
+    if(Configs[iConfig].Compress) ssName << "-z ";
+    if(Configs[iConfig].Solid) ssName << "-s ";
+    if(Configs[iConfig].Dedup) ssName << "-r ";
+    if(Configs[iConfig].Backend == PHD_BACKEND_BLOCKING) ssName << "-bblocking ";
+    ssName << "-j" << Configs[iConfig].Threads;
+
+    PHDC_CompileTimes Times = {};
+    PHDC_CompileTimes First = {};
+    if(BENCH_Compile(arg_output, CompileDir, Configs[iConfig].Threads, Configs[iConfig].Compress, Configs[iConfig].Solid, Configs[iConfig].Dedup, Configs[iConfig].Backend, arg_repeats, &Times, &First))
+    {
+      std::cerr << "PhragDat bench error: compile " << ssName.str() << " failed" << std::endl;
+      return 1;
+    }
+
+    // the process peak, so it covers every run so far
+    uint64_t PeakMemory = PHD_PeakMemory();
+    double MBPerSecond = PHD_GetMBPerSecond(Times.BytesCopied, Times.Total);
+    double FilesPerSecond = PHD_GetPerSecond(Times.Files, Times.Total);
+
+    std::cout << std::fixed << std::setprecision(3)
+    << "compile " << ssName.str() << ": " << Times.Total << " s [" << First.Total << "] (exclusions " << Times.Exclusions << " [" << First.Exclusions
+    << "], scan " << Times.Scan << " [" << First.Scan << "], layout " << Times.Layout << " [" << First.Layout << "], write " << Times.Write
+    << " [" << First.Write << "], index " << Times.Index << " [" << First.Index << "], csv " << Times.Csv << " [" << First.Csv << "]), "
+    << std::setprecision(1) << MBPerSecond << " MB/s, " << std::setprecision(0) << FilesPerSecond << " files/s, "
+    << Times.BytesCopied << " -> " << Times.BytesStored << " bytes, peak " << PeakMemory/(1024*1024) << " MB" << std::endl;
+
+    ssJson << (iConfig ? ",\n" : "\n") << "    {\"options\": " << PHD_JsonString(ssName.str())
+    << ", \"seconds\": " << Times.Total << ", \"exclusions\": " << Times.Exclusions << ", \"scan\": " << Times.Scan
+    << ", \"layout\": " << Times.Layout << ", \"write\": " << Times.Write << ", \"index\": " << Times.Index << ", \"csv\": " << Times.Csv
+    << ", \"files\": " << Times.Files << ", \"bytes\": " << Times.BytesCopied << ", \"stored_bytes\": " << Times.BytesStored
+    << ", \"mb_per_second\": " << MBPerSecond << ", \"files_per_second\": " << FilesPerSecond << ", \"peak_memory\": " << PeakMemory
+    << ",\n     \"first\": {\"seconds\": " << First.Total << ", \"exclusions\": " << First.Exclusions << ", \"scan\": " << First.Scan
+    << ", \"layout\": " << First.Layout << ", \"write\": " << First.Write << ", \"index\": " << First.Index << ", \"csv\": " << First.Csv << "}}";
+  }
+
+  // the read benchmark loads from a plain -jN build, the last one above may be deduplicated
+  ssJson << "\n  ],\n  \"read\": [";
+
+  PHDC_CompileTimes ReadTimes = {};
+  if(BENCH_Compile(arg_output, CompileDir, arg_threads, 0, 0, 0, PHD_BACKEND_AUTO, 1, &ReadTimes, &ReadTimes)) return 1;
+  std::string DatPath = CompileDir + "/" + PHD_RemoveParentsFromPath(arg_output + ".dat");
+
+  // one ReadFile per file is the baseline every batch is checked against, first through the file
+  // cache the compile just filled (calls and copies), then unbuffered (what the device does)
+  int ReadThreads[] = {0, 1, arg_threads};
+  std::vector<uint8_t> PerFileData;
+  size_t iResult = 0;
+
+  for(int Unbuffered = 0; Unbuffered < 2; ++Unbuffered)
+  {
+    double PerFileSeconds = 0.0;
+    for(size_t iRead = 0; iRead < sizeof(ReadThreads)/sizeof(ReadThreads[0]); ++iRead, ++iResult)
+    {
+      std::vector<uint8_t> Data;
+      uint64_t Files = 0;
+      double Seconds = 0.0;
+      if(BENCH_Read(DatPath, ReadThreads[iRead], Unbuffered, arg_repeats, Data, &Files, &Seconds)) return 1;
+
+      std::stringstream ssName;
+      if(ReadThreads[iRead]) ssName << "batch -j" << ReadThreads[iRead];
+      else ssName << "per-file";
+      const char *Cache = Unbuffered ? "unbuffered" : "warm";
+
+      if(!ReadThreads[iRead]) PerFileSeconds = Seconds;
+      if(!iResult) PerFileData.swap(Data);
+      else if(Data != PerFileData)
+      {
+        std::cerr << "PhragDat bench error: read " << Cache << " " << ssName.str() << " does not match the per-file reads" << std::endl;
+        return 1;
+      }
+
+      double MBPerSecond = PHD_GetMBPerSecond(PerFileData.size(), Seconds);
+      double FilesPerSecond = PHD_GetPerSecond(Files, Seconds);
+
+      std::cout << std::fixed << std::setprecision(3)
+      << "read " << Cache << " " << ssName.str() << ": " << Files << " files, " << PerFileData.size() << " bytes, " << Seconds << " s, "
+      << std::setprecision(1) << MBPerSecond << " MB/s, " << std::setprecision(0) << FilesPerSecond << " files/s";
+      if(ReadThreads[iRead] && Seconds > 0.0) std::cout << ", " << std::setprecision(2) << PerFileSeconds / Seconds << "x per-file";
+      std::cout << std::endl;
+
+      ssJson << (iResult ? ",\n" : "\n") << "    {\"method\": " << PHD_JsonString(ssName.str()) << ", \"cache\": " << PHD_JsonString(Cache)
+      << ", \"files\": " << Files << ", \"bytes\": " << PerFileData.size() << ", \"seconds\": " << Seconds << ", \"mb_per_second\": " << MBPerSecond
+      << ", \"files_per_second\": " << FilesPerSecond << "}";
+    }
+  }
+
+  ssJson << "\n  ]\n}\n";
+
+  if(arg_json.length())
+  {
+    std::ofstream Json(arg_json, std::ios::out | std::ios::binary);
+    Json << ssJson.str();
+    if(!Json.good())
+    {
+      std::cerr << "PhragDat bench error: failed writing " << arg_json << std::endl;
+      return 1;
+    }
+    std::cout << arg_json << " written" << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,219 @@
+//====================================
+// PhragDat CRC
+// CRC32C checksums of .dat entries,
+// header only
+//====================================
+// (c) Phragware 2020
+//====================================
+
+#ifndef PHRAGDAT_CRC_H
+#define PHRAGDAT_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+//=======================================================================
+// CRC32C (Castagnoli, reflected polynomial 0x82f63b78, initial value and
+// final xor 0xffffffff), the CRC computed by the SSE4.2 crc32 and ARMv8
+// crc32c instructions:
+//   uint32_t Crc = PHD_Crc32c(0, Data, Size);
+//   Crc = PHD_Crc32c(Crc, More, MoreSize); // same as one call over both
+// x64 checks for SSE4.2 once and otherwise uses a slicing-by-8 table,
+// ARM64 always has the CRC instructions.
+//=======================================================================
+#define PHD_CRC_POLY 0x82f63b78
+
+#if defined(_M_X64) || defined(__x86_64__)
+  #define PHD_CRC_X64 1
+  #include <nmmintrin.h>
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+    #define PHD_CRC_TARGET
+  #else
+    #include <cpuid.h>
+    #define PHD_CRC_TARGET __attribute__((target("sse4.2")))
+  #endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+  #define PHD_CRC_ARM64 1
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+    #define PHD_CRC_TARGET
+  #else
+    #include <arm_acle.h>
+    #define PHD_CRC_TARGET __attribute__((target("+crc")))
+  #endif
+#endif
+
+struct PHD_CrcTable
+{
+  uint32_t Table[8][256]; // [k][b]: CRC of byte b followed by k zero bytes
+};
+
+static inline const PHD_CrcTable *
+PHD_CrcGetTable()
+{
+  static const PHD_CrcTable Table = []
+  {
+    PHD_CrcTable Result;
+    for(uint32_t iByte = 0; iByte < 256; ++iByte)
+    {
+      uint32_t Crc = iByte;
+      for(int iBit = 0; iBit < 8; ++iBit) Crc = (Crc >> 1) ^ ((Crc & 1) ? PHD_CRC_POLY : 0);
+      Result.Table[0][iByte] = Crc;
+    }
+
+    for(int iSlice = 1; iSlice < 8; ++iSlice)
+    {
+      for(uint32_t iByte = 0; iByte < 256; ++iByte)
+      {
+        uint32_t Previous = Result.Table[iSlice-1][iByte];
+        Result.Table[iSlice][iByte] = (Previous >> 8) ^ Result.Table[0][Previous & 0xff];
+      }
+    }
+    return Result;
+  }();
+
+  return &Table;
+}
+
+//====================================
+// Crc32cSoftware
+// slicing-by-8, 8 table lookups per
+// 8 bytes, _Crc is not inverted here
+//====================================
+static inline uint32_t
+PHD_Crc32cSoftware(uint32_t _Crc, const uint8_t *_Data, size_t _Size)
+{
+  const uint32_t (*Table)[256] = PHD_CrcGetTable()->Table;
+
+  for(; _Size >= 8; _Data += 8, _Size -= 8)
+  {
+    uint32_t Low, High;
+    memcpy(&Low, _Data, 4);
+    memcpy(&High, _Data + 4, 4);
+    Low ^= _Crc;
+
+    _Crc = Table[7][Low & 0xff] ^ Table[6][(Low >> 8) & 0xff] ^ Table[5][(Low >> 16) & 0xff] ^ Table[4][Low >> 24] ^
+           Table[3][High & 0xff] ^ Table[2][(High >> 8) & 0xff] ^ Table[1][(High >> 16) & 0xff] ^ Table[0][High >> 24];
+  }
+
+  for(; _Size; --_Size) _Crc = Table[0][(_Crc ^ *_Data++) & 0xff] ^ (_Crc >> 8);
+  return _Crc;
+}
+
+#if defined(PHD_CRC_X64)
+static inline bool
+PHD_CrcHasSse42()
+{
+#if defined(_MSC_VER)
+  int Info[4];
+  __cpuid(Info, 1);
+  return (Info[2] >> 20) & 1;
+#else
+  unsigned int Eax, Ebx, Ecx, Edx;
+  return __get_cpuid(1, &Eax, &Ebx, &Ecx, &Edx) && ((Ecx >> 20) & 1);
+#endif
+}
+
+PHD_CRC_TARGET static inline uint32_t
+PHD_Crc32cHardware(uint32_t _Crc, const uint8_t *_Data, size_t _Size)
+{
+  uint64_t Crc = _Crc;
+  for(; _Size >= 8; _Data += 8, _Size -= 8)
+  {
+    uint64_t Value;
+    memcpy(&Value, _Data, 8);
+    Crc = _mm_crc32_u64(Crc, Value);
+  }
+
+  for(; _Size; --_Size) Crc = _mm_crc32_u8((uint32_t)Crc, *_Data++);
+  return (uint32_t)Crc;
+}
+#elif defined(PHD_CRC_ARM64)
+PHD_CRC_TARGET static inline uint32_t
+PHD_Crc32cHardware(uint32_t _Crc, const uint8_t *_Data, size_t _Size)
+{
+  for(; _Size >= 8; _Data += 8, _Size -= 8)
+  {
+    uint64_t Value;
+    memcpy(&Value, _Data, 8);
+    _Crc = __crc32cd(_Crc, Value);
+  }
+
+  for(; _Size; --_Size) _Crc = __crc32cb(_Crc, *_Data++);
+  return _Crc;
+}
+#endif
+
+//================================
+// Crc32c
+// continues _Crc (0 to start)
+// over _Size bytes of _Data
+//================================
+static inline uint32_t
+PHD_Crc32c(uint32_t _Crc, const void *_Data, size_t _Size)
+{
+  const uint8_t *Data = (const uint8_t*)_Data;
+
+#if defined(PHD_CRC_X64)
+  static const bool HasSse42 = PHD_CrcHasSse42();
+  return ~(HasSse42 ? PHD_Crc32cHardware(~_Crc, Data, _Size) : PHD_Crc32cSoftware(~_Crc, Data, _Size));
+#elif defined(PHD_CRC_ARM64)
+  return ~PHD_Crc32cHardware(~_Crc, Data, _Size);
+#else
+  return ~PHD_Crc32cSoftware(~_Crc, Data, _Size);
+#endif
+}
+
+//=========================================
+// CrcMultiply
+// product of two polynomials modulo the
+// CRC polynomial (bit 31 is x^0)
+//=========================================
+static inline uint32_t
+PHD_CrcMultiply(uint32_t _A, uint32_t _B)
+{
+  uint32_t Product = 0;
+  for(uint32_t Bit = 0x80000000; Bit; Bit >>= 1)
+  {
+    if(_A & Bit) Product ^= _B;
+    _B = (_B & 1) ? (_B >> 1) ^ PHD_CRC_POLY : _B >> 1;
+  }
+  return Product;
+}
+
+//=========================================
+// Crc32cCombine
+// CRC of A followed by B from the CRC of
+// each, B being _LengthB bytes long, so a
+// range can be checked in parallel pieces
+//=========================================
+static inline uint32_t
+PHD_Crc32cCombine(uint32_t _CrcA, uint32_t _CrcB, uint64_t _LengthB)
+{
+  // Powers[k] = x^(2^k) mod P
+  struct PHD_CrcPowers {uint32_t Powers[67];}; // 3 + 64 bits of _LengthB
+  static const PHD_CrcPowers Table = []
+  {
+    PHD_CrcPowers Result;
+    uint32_t Power = 0x40000000; // x^1
+    for(int iPower = 0; iPower < 67; ++iPower)
+    {
+      Result.Powers[iPower] = Power;
+      Power = PHD_CrcMultiply(Power, Power);
+    }
+    return Result;
+  }();
+
+  // shift A past B's _LengthB*8 zero bits, x^(8n) built from the powers of two in n
+  uint32_t Shift = 0x80000000; // x^0
+  for(int iPower = 3; _LengthB; _LengthB >>= 1, ++iPower)
+  {
+    if(_LengthB & 1) Shift = PHD_CrcMultiply(Table.Powers[iPower], Shift);
+  }
+
+  return PHD_CrcMultiply(Shift, _CrcA) ^ _CrcB;
+}
+
+#endif // PHRAGDAT_CRC_H
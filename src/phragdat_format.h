@@ -0,0 +1,213 @@
+//====================================
+// PhragDat .dat format
+// on-disk structures shared by the
+// compiler and readers
+//====================================
+// (c) Phragware 2020
+//====================================
+
+#ifndef PHRAGDAT_FORMAT_H
+#define PHRAGDAT_FORMAT_H
+
+#include <stdint.h>
+#include <string_view>
+
+//=======================================================================
+// .dat layout (all values little endian):
+//   header: "PHRDAT" + uint8 major version + uint8 minor version
+//   file data: every file (as stored, see PHD_METHOD_*) followed by
+//              PHD_PAD_SIZE pad bytes, the files compiled with phragdat -p
+//              first: the hot region, HotOffset/HotLength in the footer
+//   solid blocks: small files packed together, each block followed by
+//                 PHD_PAD_SIZE pad bytes
+//   zero bytes up to the next multiple of 8
+//   table of contents:
+//     PHD_TocEntry[EntryCount]
+//     PHD_TocBlock[BlockCount]
+//     path index, IndexType PHD_INDEX_MPHF:
+//       PHD_TocPartition[IndexCount+1] (the last one only ends the others)
+//       uint8 fingerprints[EntryCount] (PHD_MphfFingerprint), zero padded
+//       to a multiple of 2 bytes
+//       uint16 seeds[last partition's BucketOffset]
+//     or IndexType PHD_INDEX_TABLE:
+//       uint32 hash table[IndexCount] (entry index + 1, 0 = empty slot)
+//     path strings (DatPaths, not 0 terminated, '/' separated)
+//   PHD_TocFooter: the last 104 bytes of the file, version and magic last
+// A path is found by hashing it with PHD_HashPath. With PHD_INDEX_MPHF the
+// entries are in slot order of a partitioned minimal perfect hash (below):
+// the hash picks a partition, its bucket's seed picks the one slot the
+// path can be in, and a fingerprint mismatch rejects most missing paths
+// without touching the entry. PHD_INDEX_TABLE, only written if two paths
+// share a 64-bit hash, probes from slot (Hash & (IndexCount-1)) onwards
+// until an empty slot.
+// A PHD_METHOD_SOLID entry is the Length bytes at Offset inside the
+// decoded Block, every file of a block is served by decoding it once.
+// Checksums are CRC32C (phragdat_crc.h) of the stored bytes of every entry
+// and block, the footer's Checksum covers the table of contents and the
+// footer before it, so through the entry checksums the whole archive.
+//=======================================================================
+#define PHD_HEADER_SIZE 8
+#define PHD_TOC_VERSION 6 // 2: StoredLength + Method added to entries, 3: solid blocks, 4: checksums, 5: MPHF index, 6: hot region
+#define PHD_TOC_ALIGN 8
+
+// how an entry's bytes are stored
+#define PHD_METHOD_STORE 0 // raw, StoredLength == Length
+#define PHD_METHOD_LZ 1 // one phragdat_lz.h block
+#define PHD_METHOD_SOLID 2 // inside a solid block (entries only)
+#define PHD_NO_BLOCK 0xffffffff
+
+// how paths are looked up, PHD_TocFooter IndexType
+#define PHD_INDEX_MPHF 0 // minimal perfect hash, entries in slot order
+#define PHD_INDEX_TABLE 1 // open addressed hash table, at most half full
+
+static const char PHD_HeaderTag[6] = {'P', 'H', 'R', 'D', 'A', 'T'};
+static const char PHD_TocMagic[8] = {'P', 'H', 'D', 'T', 'O', 'C', 0, 0};
+
+struct PHD_TocEntry
+{
+  uint64_t Hash; // PHD_HashPath(DatPath)
+  uint64_t Offset; // address inside .dat
+  uint64_t Length; // file size in bytes
+  uint64_t StoredLength; // bytes at Offset
+  uint32_t PathOffset; // into the path strings
+  uint32_t PathLength;
+  uint32_t Method; // PHD_METHOD_*
+  uint32_t Block; // solid block index or PHD_NO_BLOCK
+  uint32_t Checksum; // CRC32C of the StoredLength bytes at Offset, 0 for PHD_METHOD_SOLID (see the block)
+  uint32_t Reserved; // 0
+};
+
+struct PHD_TocBlock
+{
+  uint64_t Offset; // address inside .dat
+  uint64_t Length; // decoded size in bytes
+  uint64_t StoredLength; // bytes at Offset
+  uint32_t Method; // PHD_METHOD_STORE or PHD_METHOD_LZ
+  uint32_t FileCount;
+  uint32_t Checksum; // CRC32C of the StoredLength bytes at Offset
+  uint32_t Reserved; // 0
+};
+
+struct PHD_TocPartition
+{
+  uint32_t SlotOffset; // first slot (entry) of the partition, the next partition's is its end
+  uint32_t BucketOffset; // first seed of the partition
+};
+
+struct PHD_TocFooter
+{
+  uint64_t EntriesOffset; // address of PHD_TocEntry[EntryCount]
+  uint64_t EntryCount;
+  uint64_t BlocksOffset; // address of PHD_TocBlock[BlockCount]
+  uint64_t BlockCount;
+  uint64_t IndexOffset; // address of the path index
+  uint64_t IndexCount; // PHD_INDEX_MPHF: partitions, PHD_INDEX_TABLE: table slots (power of 2, at least 2x EntryCount)
+  uint64_t StringsOffset; // address of path strings
+  uint64_t StringsLength;
+  uint64_t HotOffset; // address of the hot region (phragdat -p), a range of whole entries
+  uint64_t HotLength; // 0 = no hot region
+  uint32_t Checksum; // CRC32C from EntriesOffset up to this field
+  uint32_t IndexType; // PHD_INDEX_*
+  uint32_t TocVersion; // PHD_TOC_VERSION
+  uint32_t Alignment; // phragdat -aN, entries of at least 4*N stored bytes start on N byte boundaries, 0/1 = packed
+  char Magic[8]; // PHD_TocMagic
+};
+
+static_assert(sizeof(PHD_TocEntry) == 56, "PHD_TocEntry must stay 56 bytes");
+static_assert(sizeof(PHD_TocBlock) == 40, "PHD_TocBlock must stay 40 bytes");
+static_assert(sizeof(PHD_TocPartition) == 8, "PHD_TocPartition must stay 8 bytes");
+static_assert(sizeof(PHD_TocFooter) == 104, "PHD_TocFooter must stay 104 bytes");
+
+//================================
+// HashPath
+// 64-bit FNV-1a of a DatPath
+//================================
+constexpr uint64_t
+PHD_HashPath(std::string_view _Path)
+{
+  uint64_t Hash = 0xcbf29ce484222325ULL;
+  for(size_t iChar = 0; iChar < _Path.length(); ++iChar)
+  {
+    Hash ^= (uint8_t)_Path[iChar];
+    Hash *= 0x100000001b3ULL;
+  }
+  return Hash;
+}
+
+//=======================================================================
+// Minimal perfect hash over the DatPath hashes (hash and displace): keys
+// are split into partitions (PHD_MphfPartition) of about
+// PHD_MPHF_PARTITION_KEYS, each a minimal perfect hash of its own, so they
+// are built in parallel. In a partition every key falls into one of
+// BucketCount buckets and the bucket's uint16 seed, chosen when the .dat is
+// compiled, sends each of its keys to its own slot in [0, SlotCount),
+// SlotCount being the partition's number of keys:
+//   Slot = PHD_MphfSlot(Hash, Seeds[PHD_MphfBucket(Hash, BucketCount)], SlotCount)
+// Any other hash lands on some slot as well, the key stored there tells.
+// A seed is a displacement (low PHD_MPHF_DISPLACEMENT_BITS bits) added to
+// the slot picked by one of the hash functions selected by the high bits,
+// so a bucket is placed by sliding it over the slots still free, the last
+// single key buckets in one step. Buckets hold PHD_MPHF_BUCKET_KEYS keys
+// on average, partitions at most 2^PHD_MPHF_DISPLACEMENT_BITS.
+//=======================================================================
+#define PHD_MPHF_BUCKET_KEYS 3
+#define PHD_MPHF_PARTITION_KEYS 1024
+#define PHD_MPHF_DISPLACEMENT_BITS 11
+#define PHD_MPHF_SELECTORS (1 << (16 - PHD_MPHF_DISPLACEMENT_BITS))
+
+//================================
+// MphfMix
+// splitmix64 finalizer, FNV-1a
+// alone leaves the high bits of
+// similar paths alike
+//================================
+constexpr uint64_t
+PHD_MphfMix(uint64_t _Value)
+{
+  _Value = (_Value ^ (_Value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  _Value = (_Value ^ (_Value >> 27)) * 0x94d049bb133111ebULL;
+  return _Value ^ (_Value >> 31);
+}
+
+// each picks with 32 bits of a mix scaled onto the count, no division
+constexpr uint64_t
+PHD_MphfPartition(uint64_t _Hash, uint64_t _PartitionCount)
+{
+  return ((PHD_MphfMix(_Hash) >> 32) * _PartitionCount) >> 32;
+}
+
+constexpr uint64_t
+PHD_MphfBucket(uint64_t _Hash, uint64_t _BucketCount)
+{
+  return ((PHD_MphfMix(_Hash) & 0xffffffff) * _BucketCount) >> 32;
+}
+
+// the displacement is under _SlotCount for every seed written, damaged ones can land past it
+constexpr uint64_t
+PHD_MphfSlot(uint64_t _Hash, uint16_t _Seed, uint64_t _SlotCount)
+{
+  uint64_t Selector = (uint64_t)(_Seed >> PHD_MPHF_DISPLACEMENT_BITS) + 1;
+  uint64_t Slot = ((PHD_MphfMix(_Hash ^ (0x9e3779b97f4a7c15ULL * Selector)) & 0xffffffff) * _SlotCount) >> 32;
+  Slot += _Seed & ((1 << PHD_MPHF_DISPLACEMENT_BITS)-1);
+  return (Slot >= _SlotCount) ? Slot - _SlotCount : Slot;
+}
+
+constexpr uint8_t
+PHD_MphfFingerprint(uint64_t _Hash)
+{
+  return (uint8_t)((_Hash * 0x9e3779b97f4a7c15ULL) >> 56);
+}
+
+//=======================================================================
+// Access trace (text like the .csv), written by PHD_ArchiveTraceWrite and
+// read by phragdat -l to place the traced files first, in trace order:
+//   "PHRDAT-TRACE",PHD_TRACE_VERSION
+//   "DatPath",microseconds from PHD_ArchiveTraceBegin to the first access
+// one line per path in the order they were first found. phragdat -l also
+// takes hand written lists: the header, the quotes and the time are
+// optional.
+//=======================================================================
+#define PHD_TRACE_TAG "PHRDAT-TRACE"
+#define PHD_TRACE_VERSION 1
+
+#endif // PHRAGDAT_FORMAT_H
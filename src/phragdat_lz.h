@@ -0,0 +1,249 @@
+//====================================
+// PhragDat LZ
+// small LZ77 block codec for .dat
+// entries, header only
+//====================================
+// (c) Phragware 2020
+//====================================
+
+#ifndef PHRAGDAT_LZ_H
+#define PHRAGDAT_LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+//=======================================================================
+// Block format (one block per entry, decoded without any other state):
+//   sequence: token, [literal length bytes], literals, offset, [match length bytes]
+//   token: high 4 bits literal count, low 4 bits match length - PHD_LZ_MIN_MATCH,
+//          a nibble of 15 is continued by bytes added on until one is < 255
+//   offset: uint16 little endian distance back from the current output, 1..65535
+//   the last sequence is literals only and ends the block, the last
+//   PHD_LZ_LAST_LITERALS bytes of a block are always literals
+// Compression is greedy with a single hash table of recent positions,
+// tuned for decompression speed over ratio.
+//=======================================================================
+#define PHD_LZ_MIN_MATCH 4
+#define PHD_LZ_MAX_OFFSET 0xffff
+#define PHD_LZ_LAST_LITERALS 5
+#define PHD_LZ_MATCH_LIMIT 12 // no match may start in the last 12 bytes
+#define PHD_LZ_HASH_BITS 16
+#define PHD_LZ_MAX_INPUT 0x7fffffff // positions are kept in 32 bits
+
+struct PHD_LzState
+{
+  uint32_t Table[1 << PHD_LZ_HASH_BITS]; // position + 1 of the last 4 bytes with this hash, 0 = none
+};
+
+//================================
+// LzCompressBound
+// worst case compressed size
+//================================
+static inline size_t
+PHD_LzCompressBound(size_t _Size)
+{
+  return _Size + _Size/255 + 16;
+}
+
+static inline uint32_t
+PHD_LzRead32(const uint8_t *_Data)
+{
+  uint32_t Value;
+  memcpy(&Value, _Data, 4);
+  return Value;
+}
+
+static inline uint32_t
+PHD_LzHash(uint32_t _Value)
+{
+  return (_Value * 2654435761U) >> (32 - PHD_LZ_HASH_BITS);
+}
+
+//====================================
+// LzEmit
+// writes one sequence, _MatchLength 0
+// for the final literals only one,
+// returns 1 if _Out would overflow
+//====================================
+static inline int
+PHD_LzEmit(uint8_t **_Out, uint8_t *_OutEnd,
+           const uint8_t *_Literals, size_t _LiteralLength,
+           size_t _Offset, size_t _MatchLength)
+{
+  uint8_t *Out = *_Out;
+  size_t Needed = 1 + _LiteralLength/255 + 1 + _LiteralLength + (_MatchLength ? 2 + _MatchLength/255 + 1 : 0);
+  if(Needed > (size_t)(_OutEnd - Out)) return 1;
+
+  size_t MatchCode = _MatchLength ? _MatchLength - PHD_LZ_MIN_MATCH : 0;
+  uint8_t *Token = Out++;
+  *Token = (uint8_t)(((_LiteralLength < 15 ? _LiteralLength : 15) << 4) | (MatchCode < 15 ? MatchCode : 15));
+
+  if(_LiteralLength >= 15)
+  {
+    size_t Rest = _LiteralLength - 15;
+    for(; Rest >= 255; Rest -= 255) *Out++ = 255;
+    *Out++ = (uint8_t)Rest;
+  }
+
+  if(_LiteralLength) memcpy(Out, _Literals, _LiteralLength);
+  Out += _LiteralLength;
+
+  if(_MatchLength)
+  {
+    *Out++ = (uint8_t)(_Offset & 0xff);
+    *Out++ = (uint8_t)(_Offset >> 8);
+
+    if(MatchCode >= 15)
+    {
+      size_t Rest = MatchCode - 15;
+      for(; Rest >= 255; Rest -= 255) *Out++ = 255;
+      *Out++ = (uint8_t)Rest;
+    }
+  }
+
+  *_Out = Out;
+  return 0;
+}
+
+//=============================================
+// LzCompress
+// compresses _Size bytes of _In into _Out,
+// returns the compressed size or 0 if it does
+// not fit in _OutCapacity (store it instead)
+//=============================================
+static inline size_t
+PHD_LzCompress(PHD_LzState *_State,
+               const uint8_t *_In, size_t _Size,
+               uint8_t *_Out, size_t _OutCapacity)
+{
+  if(_Size > PHD_LZ_MAX_INPUT) return 0;
+
+  uint8_t *Out = _Out;
+  uint8_t *OutEnd = _Out + _OutCapacity;
+  size_t Anchor = 0; // start of pending literals
+
+  if(_Size > PHD_LZ_MATCH_LIMIT)
+  {
+    memset(_State->Table, 0, sizeof(_State->Table));
+    size_t MatchStartLimit = _Size - PHD_LZ_MATCH_LIMIT;
+    size_t MatchEndLimit = _Size - PHD_LZ_LAST_LITERALS;
+    size_t Position = 0;
+
+    while(Position < MatchStartLimit)
+    {
+      uint32_t Hash = PHD_LzHash(PHD_LzRead32(_In + Position));
+      size_t Candidate = _State->Table[Hash];
+      _State->Table[Hash] = (uint32_t)(Position + 1);
+
+      if(!Candidate || Position - (Candidate-1) > PHD_LZ_MAX_OFFSET ||
+         PHD_LzRead32(_In + Candidate-1) != PHD_LzRead32(_In + Position))
+      {
+        // step faster through data that keeps missing
+        Position += 1 + ((Position - Anchor) >> 6);
+        continue;
+      }
+
+      size_t Match = Candidate-1;
+
+      // grow the match backwards into the pending literals
+      while(Position > Anchor && Match > 0 && _In[Position-1] == _In[Match-1])
+      {
+        --Position;
+        --Match;
+      }
+
+      size_t MatchLength = PHD_LZ_MIN_MATCH;
+      while(Position + MatchLength < MatchEndLimit && _In[Position + MatchLength] == _In[Match + MatchLength]) ++MatchLength;
+
+      if(PHD_LzEmit(&Out, OutEnd, _In + Anchor, Position - Anchor, Position - Match, MatchLength)) return 0;
+
+      Position += MatchLength;
+      Anchor = Position;
+
+      // seed the table inside the match so back to back matches are found
+      if(Position - 2 < MatchStartLimit) _State->Table[PHD_LzHash(PHD_LzRead32(_In + Position - 2))] = (uint32_t)(Position - 2 + 1);
+    }
+  }
+
+  if(PHD_LzEmit(&Out, OutEnd, _In + Anchor, _Size - Anchor, 0, 0)) return 0;
+  return (size_t)(Out - _Out);
+}
+
+//===========================================
+// LzDecompress
+// decodes a block of _Size bytes into
+// exactly _OutSize bytes, every read and
+// write is bounds checked, returns 0 on
+// success, 1 if the block is damaged
+//===========================================
+static inline int
+PHD_LzDecompress(const uint8_t *_In, size_t _Size,
+                 uint8_t *_Out, size_t _OutSize)
+{
+  const uint8_t *In = _In;
+  const uint8_t *InEnd = _In + _Size;
+  uint8_t *Out = _Out;
+  uint8_t *OutEnd = _Out + _OutSize;
+
+  for(;;)
+  {
+    if(In >= InEnd) return 1;
+    uint8_t Token = *In++;
+
+    size_t LiteralLength = Token >> 4;
+    if(LiteralLength == 15)
+    {
+      uint8_t Byte;
+      do
+      {
+        if(In >= InEnd) return 1;
+        Byte = *In++;
+        LiteralLength += Byte;
+      } while(Byte == 255);
+    }
+
+    if(LiteralLength > (size_t)(InEnd - In) || LiteralLength > (size_t)(OutEnd - Out)) return 1;
+    if(LiteralLength) memcpy(Out, In, LiteralLength);
+    In += LiteralLength;
+    Out += LiteralLength;
+
+    // the last sequence has no match
+    if(In == InEnd) break;
+
+    if(InEnd - In < 2) return 1;
+    size_t Offset = (size_t)In[0] | ((size_t)In[1] << 8);
+    In += 2;
+    if(!Offset || Offset > (size_t)(Out - _Out)) return 1;
+
+    size_t MatchLength = Token & 15;
+    if(MatchLength == 15)
+    {
+      uint8_t Byte;
+      do
+      {
+        if(In >= InEnd) return 1;
+        Byte = *In++;
+        MatchLength += Byte;
+      } while(Byte == 255);
+    }
+    MatchLength += PHD_LZ_MIN_MATCH;
+    if(MatchLength > (size_t)(OutEnd - Out)) return 1;
+
+    const uint8_t *Match = Out - Offset;
+    if(Offset >= MatchLength)
+    {
+      memcpy(Out, Match, MatchLength);
+      Out += MatchLength;
+    }
+    else
+    {
+      // overlapping match repeats the last Offset bytes
+      for(size_t iByte = 0; iByte < MatchLength; ++iByte) *Out++ = Match[iByte];
+    }
+  }
+
+  return (Out == OutEnd) ? 0 : 1;
+}
+
+#endif // PHRAGDAT_LZ_H
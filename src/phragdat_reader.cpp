@@ -0,0 +1,757 @@
+//====================================
+// PhragDat Reader
+// memory mapped, zero copy access to
+// .dat archives
+// C++17 Windows 64-bit
+//====================================
+// (c) Phragware 2020
+//====================================
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "phragdat_reader.h"
+#include "phragdat_lz.h"
+#include "phragdat_crc.h"
+
+//================================
+// PHD_ArchiveTrace (First Finds)
+//================================
+struct PHD_ArchiveTrace
+{
+  std::mutex Lock; // PHD_ArchiveFind records from any thread
+  LARGE_INTEGER Start; // PHD_ArchiveTraceBegin
+  LARGE_INTEGER Frequency;
+  std::vector<uint8_t> Found; // one per entry, set once it is recorded
+  std::vector<std::pair<uint32_t, uint64_t>> Accesses; // entry index, ticks since Start
+};
+
+//=========================================
+// ArchiveLoadToc
+// points the archive at the TOC described
+// by the footer, only the fixed size parts
+// are checked here so opening stays O(1),
+// entries are checked when they are used
+//=========================================
+static int
+PHD_ArchiveLoadToc(PHD_Archive *_Archive)
+{
+  if(_Archive->Size < PHD_HEADER_SIZE + sizeof(PHD_TocFooter)) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  PHD_TocFooter Footer;
+  memcpy(&Footer, _Archive->Base + _Archive->Size - sizeof(PHD_TocFooter), sizeof(Footer));
+
+  uint64_t TocEnd = _Archive->Size - sizeof(PHD_TocFooter);
+
+  if(memcmp(Footer.Magic, PHD_TocMagic, sizeof(Footer.Magic)) || Footer.TocVersion != PHD_TOC_VERSION) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  // every part must fit between the header and the footer (sizes first, so nothing can overflow)
+  if(Footer.EntryCount > TocEnd / sizeof(PHD_TocEntry) ||
+     Footer.BlockCount > TocEnd / sizeof(PHD_TocBlock) ||
+     Footer.IndexCount > TocEnd / sizeof(uint32_t) ||
+     Footer.StringsLength > TocEnd) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  if(Footer.EntriesOffset < PHD_HEADER_SIZE || Footer.EntriesOffset % PHD_TOC_ALIGN ||
+     Footer.EntriesOffset > TocEnd - Footer.EntryCount*sizeof(PHD_TocEntry) ||
+     Footer.BlocksOffset < PHD_HEADER_SIZE || Footer.BlocksOffset % PHD_TOC_ALIGN ||
+     Footer.BlocksOffset > TocEnd - Footer.BlockCount*sizeof(PHD_TocBlock) ||
+     Footer.IndexOffset < PHD_HEADER_SIZE || Footer.IndexOffset % sizeof(uint32_t) ||
+     Footer.StringsOffset < PHD_HEADER_SIZE || Footer.StringsOffset > TocEnd - Footer.StringsLength)
+  {
+    return PHD_ARCHIVE_ERROR_FORMAT;
+  }
+
+  if(Footer.IndexType == PHD_INDEX_MPHF)
+  {
+    // partitions (with the closing one) and fingerprints, the seeds fill what is left up to the
+    // footer and every partition's range is checked against that when it is used
+    uint64_t PartitionsLength = (Footer.IndexCount+1)*sizeof(PHD_TocPartition);
+    if(!Footer.IndexCount || Footer.EntryCount > 0xffffffff ||
+       Footer.IndexOffset > TocEnd - PartitionsLength ||
+       Footer.IndexOffset + PartitionsLength > TocEnd - Footer.EntryCount)
+    {
+      return PHD_ARCHIVE_ERROR_FORMAT;
+    }
+
+    uint64_t SeedsOffset = (Footer.IndexOffset + PartitionsLength + Footer.EntryCount + 1) & ~(uint64_t)1;
+    _Archive->Partitions = (const PHD_TocPartition*)(_Archive->Base + Footer.IndexOffset);
+    _Archive->PartitionCount = Footer.IndexCount;
+    _Archive->Fingerprints = _Archive->Base + Footer.IndexOffset + PartitionsLength;
+    _Archive->Seeds = (const uint16_t*)(_Archive->Base + SeedsOffset);
+    _Archive->SeedCount = (SeedsOffset < TocEnd) ? (TocEnd - SeedsOffset) / sizeof(uint16_t) : 0;
+  }
+
+  else if(Footer.IndexType == PHD_INDEX_TABLE)
+  {
+    // power of 2 with at least one empty slot, so a lookup always ends
+    if(!Footer.IndexCount || (Footer.IndexCount & (Footer.IndexCount-1)) || Footer.EntryCount >= Footer.IndexCount ||
+       Footer.IndexOffset > TocEnd - Footer.IndexCount*sizeof(uint32_t))
+    {
+      return PHD_ARCHIVE_ERROR_FORMAT;
+    }
+
+    _Archive->Table = (const uint32_t*)(_Archive->Base + Footer.IndexOffset);
+    _Archive->TableSlots = Footer.IndexCount;
+  }
+
+  else return PHD_ARCHIVE_ERROR_FORMAT;
+
+  // the hot region is file data, between the header and the table of contents
+  if(Footer.HotLength && (Footer.HotOffset < PHD_HEADER_SIZE || Footer.HotOffset > Footer.EntriesOffset ||
+                          Footer.HotLength > Footer.EntriesOffset - Footer.HotOffset))
+  {
+    return PHD_ARCHIVE_ERROR_FORMAT;
+  }
+
+  _Archive->Entries = (const PHD_TocEntry*)(_Archive->Base + Footer.EntriesOffset);
+  _Archive->EntryCount = Footer.EntryCount;
+  _Archive->Blocks = (const PHD_TocBlock*)(_Archive->Base + Footer.BlocksOffset);
+  _Archive->BlockCount = Footer.BlockCount;
+  _Archive->IndexType = Footer.IndexType;
+  _Archive->Strings = (const char*)(_Archive->Base + Footer.StringsOffset);
+  _Archive->StringsLength = Footer.StringsLength;
+  _Archive->TocOffset = Footer.EntriesOffset;
+  _Archive->TocChecksum = Footer.Checksum;
+  _Archive->Alignment = Footer.Alignment ? Footer.Alignment : 1;
+  _Archive->HotOffset = Footer.HotLength ? Footer.HotOffset : 0;
+  _Archive->HotLength = Footer.HotLength;
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveOpen
+//================================
+int
+PHD_ArchiveOpen(PHD_Archive *_Archive, const char *_Path)
+{
+  *_Archive = {};
+
+  _Archive->File = CreateFileA(_Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+  if(_Archive->File == INVALID_HANDLE_VALUE) return PHD_ARCHIVE_ERROR_OPEN;
+
+  LARGE_INTEGER Size;
+  if(!GetFileSizeEx(_Archive->File, &Size))
+  {
+    PHD_ArchiveClose(_Archive);
+    return PHD_ARCHIVE_ERROR_OPEN;
+  }
+
+  // empty files can not be mapped, and are not archives anyway
+  _Archive->Size = (uint64_t)Size.QuadPart;
+  if(_Archive->Size < PHD_HEADER_SIZE)
+  {
+    PHD_ArchiveClose(_Archive);
+    return PHD_ARCHIVE_ERROR_FORMAT;
+  }
+
+  _Archive->Mapping = CreateFileMappingA(_Archive->File, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(!_Archive->Mapping)
+  {
+    PHD_ArchiveClose(_Archive);
+    return PHD_ARCHIVE_ERROR_MAP;
+  }
+
+  _Archive->Base = (const uint8_t*)MapViewOfFile(_Archive->Mapping, FILE_MAP_READ, 0, 0, 0);
+  if(!_Archive->Base)
+  {
+    PHD_ArchiveClose(_Archive);
+    return PHD_ARCHIVE_ERROR_MAP;
+  }
+
+  if(memcmp(_Archive->Base, PHD_HeaderTag, sizeof(PHD_HeaderTag)))
+  {
+    PHD_ArchiveClose(_Archive);
+    return PHD_ARCHIVE_ERROR_FORMAT;
+  }
+
+  _Archive->VersionMajor = _Archive->Base[6];
+  _Archive->VersionMinor = _Archive->Base[7];
+
+  // v6.0 added the table of contents, older archives are only read by range
+  if(_Archive->VersionMajor >= 6)
+  {
+    int Result = PHD_ArchiveLoadToc(_Archive);
+    if(Result)
+    {
+      PHD_ArchiveClose(_Archive);
+      return Result;
+    }
+  }
+
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveClose
+//================================
+void
+PHD_ArchiveClose(PHD_Archive *_Archive)
+{
+  if(_Archive->Base) UnmapViewOfFile(_Archive->Base);
+  if(_Archive->Mapping) CloseHandle(_Archive->Mapping);
+  if(_Archive->File && _Archive->File != INVALID_HANDLE_VALUE) CloseHandle(_Archive->File);
+  delete _Archive->Trace;
+
+  *_Archive = {};
+  _Archive->File = INVALID_HANDLE_VALUE;
+}
+
+//================================
+// ArchiveRange
+//================================
+std::string_view
+PHD_ArchiveRange(const PHD_Archive *_Archive, uint64_t _Address, uint64_t _Length)
+{
+  if(!_Archive->Base || _Address > _Archive->Size || _Length > _Archive->Size - _Address) return std::string_view();
+  return std::string_view((const char*)_Archive->Base + _Address, (size_t)_Length);
+}
+
+//================================
+// ArchiveEntryData
+//================================
+std::string_view
+PHD_ArchiveEntryData(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry)
+{
+  if(_Entry->Method == PHD_METHOD_SOLID) return std::string_view();
+  return PHD_ArchiveRange(_Archive, _Entry->Offset, _Entry->StoredLength);
+}
+
+//================================
+// ArchiveEntryPath
+//================================
+std::string_view
+PHD_ArchiveEntryPath(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry)
+{
+  if((uint64_t)_Entry->PathOffset + _Entry->PathLength > _Archive->StringsLength) return std::string_view();
+  return std::string_view(_Archive->Strings + _Entry->PathOffset, _Entry->PathLength);
+}
+
+//=======================================
+// ArchiveFind
+// hash, then the one slot the minimal
+// perfect hash gives (or walk the probe
+// sequence of a PHD_INDEX_TABLE archive
+// until the path or an empty slot)
+//=======================================
+static const PHD_TocEntry *
+PHD_ArchiveLookup(const PHD_Archive *_Archive, std::string_view _Path)
+{
+  uint64_t Hash = PHD_HashPath(_Path);
+
+  if(_Archive->Partitions)
+  {
+    const PHD_TocPartition *Partition = &_Archive->Partitions[PHD_MphfPartition(Hash, _Archive->PartitionCount)];
+    uint64_t SlotOffset = Partition[0].SlotOffset, SlotEnd = Partition[1].SlotOffset;
+    uint64_t BucketOffset = Partition[0].BucketOffset, BucketEnd = Partition[1].BucketOffset;
+    if(SlotEnd <= SlotOffset || SlotEnd > _Archive->EntryCount || BucketEnd <= BucketOffset || BucketEnd > _Archive->SeedCount) return NULL; // empty or damaged
+
+    uint16_t Seed = _Archive->Seeds[BucketOffset + PHD_MphfBucket(Hash, BucketEnd - BucketOffset)];
+    uint64_t Slot = PHD_MphfSlot(Hash, Seed, SlotEnd - SlotOffset);
+    if(Slot >= SlotEnd - SlotOffset) return NULL; // damaged seed
+    Slot += SlotOffset;
+    if(_Archive->Fingerprints[Slot] != PHD_MphfFingerprint(Hash)) return NULL;
+
+    const PHD_TocEntry *Entry = &_Archive->Entries[Slot];
+    return (Entry->Hash == Hash && PHD_ArchiveEntryPath(_Archive, Entry) == _Path) ? Entry : NULL;
+  }
+
+  if(!_Archive->TableSlots) return NULL;
+  uint64_t Mask = _Archive->TableSlots-1;
+
+  for(uint64_t Slot = Hash & Mask, Probes = 0; Probes < _Archive->TableSlots; Slot = (Slot+1) & Mask, ++Probes)
+  {
+    uint32_t Index = _Archive->Table[Slot];
+    if(!Index) return NULL;
+    if(Index > _Archive->EntryCount) return NULL; // damaged table
+
+    const PHD_TocEntry *Entry = &_Archive->Entries[Index-1];
+    if(Entry->Hash == Hash && PHD_ArchiveEntryPath(_Archive, Entry) == _Path) return Entry;
+  }
+
+  return NULL;
+}
+
+//=========================================
+// ArchiveTraceRecord
+// first find of _Entry since the trace
+// began, later ones only cost the check
+//=========================================
+static void
+PHD_ArchiveTraceRecord(PHD_ArchiveTrace *_Trace, uint32_t _Index)
+{
+  LARGE_INTEGER Now;
+  QueryPerformanceCounter(&Now);
+
+  std::lock_guard<std::mutex> Guard(_Trace->Lock);
+  if(_Trace->Found[_Index]) return;
+  _Trace->Found[_Index] = 1;
+  _Trace->Accesses.push_back(std::make_pair(_Index, (uint64_t)(Now.QuadPart - _Trace->Start.QuadPart)));
+}
+
+//================================
+// ArchiveFind
+//================================
+const PHD_TocEntry *
+PHD_ArchiveFind(const PHD_Archive *_Archive, std::string_view _Path)
+{
+  const PHD_TocEntry *Entry = PHD_ArchiveLookup(_Archive, _Path);
+  if(Entry && _Archive->Trace) PHD_ArchiveTraceRecord(_Archive->Trace, (uint32_t)(Entry - _Archive->Entries));
+  return Entry;
+}
+
+//================================
+// ArchiveGet
+//================================
+std::string_view
+PHD_ArchiveGet(const PHD_Archive *_Archive, std::string_view _Path)
+{
+  const PHD_TocEntry *Entry = PHD_ArchiveFind(_Archive, _Path);
+  if(!Entry || Entry->Method != PHD_METHOD_STORE || Entry->StoredLength != Entry->Length) return std::string_view();
+  return PHD_ArchiveEntryData(_Archive, Entry);
+}
+
+//=========================================
+// ArchiveDecode
+// _Length bytes stored with _Method at
+// _Stored into _Buffer
+//=========================================
+static int
+PHD_ArchiveDecode(std::string_view _Stored, uint32_t _Method, uint64_t _Length, void *_Buffer)
+{
+  if(!_Stored.data()) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  switch(_Method)
+  {
+    case PHD_METHOD_STORE:
+    {
+      if(_Stored.length() != _Length) return PHD_ARCHIVE_ERROR_FORMAT;
+      memcpy(_Buffer, _Stored.data(), _Stored.length());
+      return PHD_ARCHIVE_OK;
+    }
+
+    case PHD_METHOD_LZ:
+    {
+      if(PHD_LzDecompress((const uint8_t*)_Stored.data(), _Stored.length(), (uint8_t*)_Buffer, (size_t)_Length)) return PHD_ARCHIVE_ERROR_FORMAT;
+      return PHD_ARCHIVE_OK;
+    }
+  }
+
+  return PHD_ARCHIVE_ERROR_FORMAT;
+}
+
+//=========================================
+// ArchiveLoadBlock
+// decodes solid block _Block into _Cache
+// unless it is already there
+//=========================================
+static int
+PHD_ArchiveLoadBlock(const PHD_Archive *_Archive, uint64_t _Block, PHD_BlockCache *_Cache)
+{
+  if(_Cache->Archive == _Archive && _Cache->Block == _Block) return PHD_ARCHIVE_OK;
+  if(_Block >= _Archive->BlockCount) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  // stored bytes outside the .dat or more than LZ can expand them to: damaged, checked before Length
+  // sizes the buffer and divided so a damaged StoredLength can not wrap the bound
+  const PHD_TocBlock *Block = &_Archive->Blocks[_Block];
+  if(!PHD_ArchiveRange(_Archive, Block->Offset, Block->StoredLength).data()) return PHD_ARCHIVE_ERROR_FORMAT;
+  if(Block->Length / 256 > Block->StoredLength) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  _Cache->Block = PHD_NO_BLOCK;
+  _Cache->Data.resize((size_t)Block->Length);
+  if(PHD_ArchiveDecode(PHD_ArchiveRange(_Archive, Block->Offset, Block->StoredLength), Block->Method, Block->Length, _Cache->Data.data()))
+  {
+    return PHD_ARCHIVE_ERROR_FORMAT;
+  }
+
+  _Cache->Archive = _Archive;
+  _Cache->Block = _Block;
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveView
+//================================
+std::string_view
+PHD_ArchiveView(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry, PHD_BlockCache *_Cache)
+{
+  if(_Entry->Method == PHD_METHOD_STORE)
+  {
+    if(_Entry->StoredLength != _Entry->Length) return std::string_view();
+    return PHD_ArchiveEntryData(_Archive, _Entry);
+  }
+
+  if(_Entry->Method != PHD_METHOD_SOLID || PHD_ArchiveLoadBlock(_Archive, _Entry->Block, _Cache)) return std::string_view();
+  if(_Entry->Offset > _Cache->Data.size() || _Entry->Length > _Cache->Data.size() - _Entry->Offset) return std::string_view();
+  return std::string_view((const char*)_Cache->Data.data() + _Entry->Offset, (size_t)_Entry->Length);
+}
+
+//================================
+// ArchiveRead
+//================================
+int
+PHD_ArchiveRead(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry, void *_Buffer)
+{
+  if(_Entry->Method == PHD_METHOD_SOLID)
+  {
+    // a one off read decodes the whole block, keep a PHD_BlockCache to read siblings
+    PHD_BlockCache Cache;
+    std::string_view Data = PHD_ArchiveView(_Archive, _Entry, &Cache);
+    if(!Data.data()) return PHD_ARCHIVE_ERROR_FORMAT;
+    memcpy(_Buffer, Data.data(), Data.length());
+    return PHD_ARCHIVE_OK;
+  }
+
+  return PHD_ArchiveDecode(PHD_ArchiveEntryData(_Archive, _Entry), _Entry->Method, _Entry->Length, _Buffer);
+}
+
+//=========================================
+// ArchiveVerifyToc
+// everything from the first entry to the
+// footer's Checksum field, see the format
+//=========================================
+int
+PHD_ArchiveVerifyToc(const PHD_Archive *_Archive)
+{
+  if(!_Archive->TocOffset) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  uint64_t ChecksumEnd = _Archive->Size - sizeof(PHD_TocFooter) + offsetof(PHD_TocFooter, Checksum);
+  std::string_view Toc = PHD_ArchiveRange(_Archive, _Archive->TocOffset, ChecksumEnd - _Archive->TocOffset);
+  if(!Toc.data() || PHD_Crc32c(0, Toc.data(), Toc.length()) != _Archive->TocChecksum) return PHD_ARCHIVE_ERROR_FORMAT;
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveVerifyBlock
+//================================
+int
+PHD_ArchiveVerifyBlock(const PHD_Archive *_Archive, uint64_t _Block)
+{
+  if(_Block >= _Archive->BlockCount) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  const PHD_TocBlock *Block = &_Archive->Blocks[_Block];
+  std::string_view Stored = PHD_ArchiveRange(_Archive, Block->Offset, Block->StoredLength);
+  if(!Stored.data() || PHD_Crc32c(0, Stored.data(), Stored.length()) != Block->Checksum) return PHD_ARCHIVE_ERROR_FORMAT;
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveVerifyEntry
+//================================
+int
+PHD_ArchiveVerifyEntry(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry)
+{
+  if(_Entry->Method == PHD_METHOD_SOLID) return PHD_ArchiveVerifyBlock(_Archive, _Entry->Block);
+
+  std::string_view Stored = PHD_ArchiveEntryData(_Archive, _Entry);
+  if(!Stored.data() || PHD_Crc32c(0, Stored.data(), Stored.length()) != _Entry->Checksum) return PHD_ARCHIVE_ERROR_FORMAT;
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveTraceBegin
+//================================
+int
+PHD_ArchiveTraceBegin(PHD_Archive *_Archive)
+{
+  if(!_Archive->TocOffset) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  PHD_ArchiveTraceEnd(_Archive);
+  _Archive->Trace = new PHD_ArchiveTrace;
+  _Archive->Trace->Found.resize((size_t)_Archive->EntryCount);
+  QueryPerformanceFrequency(&_Archive->Trace->Frequency);
+  QueryPerformanceCounter(&_Archive->Trace->Start);
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveTraceWrite
+//================================
+int
+PHD_ArchiveTraceWrite(const PHD_Archive *_Archive, const char *_Path)
+{
+  PHD_ArchiveTrace *Trace = _Archive->Trace;
+  if(!Trace) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  FILE *TraceFile = fopen(_Path, "wb");
+  if(!TraceFile) return PHD_ARCHIVE_ERROR_OPEN;
+
+  bool Failed = fprintf(TraceFile, "\"%s\",%d\n", PHD_TRACE_TAG, PHD_TRACE_VERSION) < 0;
+
+  std::lock_guard<std::mutex> Guard(Trace->Lock);
+  uint64_t Frequency = (uint64_t)Trace->Frequency.QuadPart;
+  for(size_t iAccess = 0; iAccess < Trace->Accesses.size() && !Failed; ++iAccess)
+  {
+    // split so ticks*1000000 can not overflow however long the trace runs
+    uint64_t Ticks = Trace->Accesses[iAccess].second;
+    uint64_t Microseconds = (Ticks / Frequency) * 1000000 + (Ticks % Frequency) * 1000000 / Frequency;
+    std::string_view Path = PHD_ArchiveEntryPath(_Archive, &_Archive->Entries[Trace->Accesses[iAccess].first]);
+    Failed = fprintf(TraceFile, "\"%.*s\",%llu\n", (int)Path.length(), Path.data(), (unsigned long long)Microseconds) < 0;
+  }
+
+  if(fclose(TraceFile) || Failed) return PHD_ARCHIVE_ERROR_OPEN;
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveTraceEnd
+//================================
+void
+PHD_ArchiveTraceEnd(PHD_Archive *_Archive)
+{
+  delete _Archive->Trace;
+  _Archive->Trace = NULL;
+}
+
+//==========================================
+// ArchivePreloadHot
+// PrefetchVirtualMemory hands both ranges to
+// the memory manager at once, which reads
+// them in large sequential I/Os, then one
+// byte per page is touched so they are all
+// resident when this returns (a page the
+// prefetch did not bring in faults here)
+//==========================================
+int
+PHD_ArchivePreloadHot(const PHD_Archive *_Archive)
+{
+  if(!_Archive->TocOffset) return PHD_ARCHIVE_ERROR_FORMAT;
+
+  WIN32_MEMORY_RANGE_ENTRY Ranges[2];
+  ULONG_PTR RangeCount = 0;
+  if(_Archive->HotLength)
+  {
+    Ranges[RangeCount].VirtualAddress = (PVOID)(_Archive->Base + _Archive->HotOffset);
+    Ranges[RangeCount].NumberOfBytes = (SIZE_T)_Archive->HotLength;
+    RangeCount++;
+  }
+
+  Ranges[RangeCount].VirtualAddress = (PVOID)(_Archive->Base + _Archive->TocOffset);
+  Ranges[RangeCount].NumberOfBytes = (SIZE_T)(_Archive->Size - _Archive->TocOffset);
+  RangeCount++;
+
+  // only a hint, the touch below loads whatever it did not
+  PrefetchVirtualMemory(GetCurrentProcess(), RangeCount, Ranges, 0);
+
+  SYSTEM_INFO Info;
+  GetSystemInfo(&Info);
+
+  volatile uint8_t Sink = 0;
+  for(ULONG_PTR iRange = 0; iRange < RangeCount; ++iRange)
+  {
+    const uint8_t *Range = (const uint8_t*)Ranges[iRange].VirtualAddress;
+    for(SIZE_T Offset = 0; Offset < Ranges[iRange].NumberOfBytes; Offset += Info.dwPageSize) Sink ^= Range[Offset];
+    Sink ^= Range[Ranges[iRange].NumberOfBytes-1];
+  }
+
+  return PHD_ARCHIVE_OK;
+}
+
+//==================================
+// PHD_BatchSpan (Stored Bytes of
+// One Read of a Batch)
+//==================================
+struct PHD_BatchSpan
+{
+  uint64_t Offset; // the entry's stored bytes, its block's for PHD_METHOD_SOLID
+  uint64_t Length;
+  size_t Read; // index into _Reads
+};
+
+//==================================
+// PHD_BatchRange (One ReadFile)
+//==================================
+struct PHD_BatchRange
+{
+  uint64_t Offset;
+  uint64_t Length;
+  size_t FirstSpan; // spans in the range, sorted by offset
+  size_t SpanCount;
+};
+
+//=========================================
+// ArchiveReadAt
+// _Length bytes at _Offset of the .dat,
+// positioned so threads can share nothing
+// but the file. Unbuffered reads are whole
+// sectors and may run into the end of the
+// file, only the first _Needed bytes must
+// be there
+//=========================================
+static int
+PHD_ArchiveReadAt(HANDLE _File, uint64_t _Offset, uint8_t *_Buffer, uint64_t _Length, uint64_t _Needed)
+{
+  uint64_t Done = 0;
+  while(Done < _Needed)
+  {
+    OVERLAPPED Overlapped = {};
+    Overlapped.Offset = (DWORD)((_Offset + Done) & 0xffffffff);
+    Overlapped.OffsetHigh = (DWORD)((_Offset + Done) >> 32);
+
+    DWORD BytesRead = 0;
+    if(!ReadFile(_File, _Buffer + Done, (DWORD)std::min<uint64_t>(_Length - Done, 0x40000000), &BytesRead, &Overlapped) || !BytesRead) return PHD_ARCHIVE_ERROR_READ;
+    Done += BytesRead;
+  }
+
+  return PHD_ARCHIVE_OK;
+}
+
+//================================
+// ArchiveReadBatch
+//================================
+int
+PHD_ArchiveReadBatch(const PHD_Archive *_Archive, PHD_BatchRead *_Reads, size_t _Count, uint64_t _MaxGap, int _Threads, bool _Unbuffered)
+{
+  // resolve every path to the stored bytes it needs
+  std::vector<PHD_BatchSpan> Spans;
+  Spans.reserve(_Count);
+
+  for(size_t iRead = 0; iRead < _Count; ++iRead)
+  {
+    PHD_BatchRead *Read = &_Reads[iRead];
+    Read->Entry = _Archive->TocOffset ? PHD_ArchiveFind(_Archive, Read->Path) : NULL;
+    Read->Result = PHD_ARCHIVE_OK;
+
+    const PHD_TocEntry *Entry = Read->Entry;
+    if(!Entry) Read->Result = _Archive->TocOffset ? PHD_ARCHIVE_ERROR_MISSING : PHD_ARCHIVE_ERROR_FORMAT;
+    else if(Entry->Length > Read->BufferSize) Read->Result = PHD_ARCHIVE_ERROR_BUFFER;
+    else if(Entry->Method == PHD_METHOD_SOLID && Entry->Block >= _Archive->BlockCount) Read->Result = PHD_ARCHIVE_ERROR_FORMAT;
+    if(Read->Result) continue;
+
+    PHD_BatchSpan Span;
+    Span.Offset = (Entry->Method == PHD_METHOD_SOLID) ? _Archive->Blocks[Entry->Block].Offset : Entry->Offset;
+    Span.Length = (Entry->Method == PHD_METHOD_SOLID) ? _Archive->Blocks[Entry->Block].StoredLength : Entry->StoredLength;
+    Span.Read = iRead;
+
+    if(!PHD_ArchiveRange(_Archive, Span.Offset, Span.Length).data())
+    {
+      Read->Result = PHD_ARCHIVE_ERROR_FORMAT;
+      continue;
+    }
+
+    Spans.push_back(Span);
+  }
+
+  // by offset (then by read, so siblings of a block stay in the caller's order), neighbours share a range
+  std::sort(Spans.begin(), Spans.end(), [](const PHD_BatchSpan &_A, const PHD_BatchSpan &_B)
+  {
+    return (_A.Offset != _B.Offset) ? _A.Offset < _B.Offset : _A.Read < _B.Read;
+  });
+
+  std::vector<PHD_BatchRange> Ranges;
+  for(size_t iSpan = 0; iSpan < Spans.size(); ++iSpan)
+  {
+    const PHD_BatchSpan &Span = Spans[iSpan];
+    if(Ranges.size())
+    {
+      PHD_BatchRange &Range = Ranges.back();
+      uint64_t RangeEnd = Range.Offset + Range.Length;
+      uint64_t End = std::max(RangeEnd, Span.Offset + Span.Length);
+      if((Span.Offset <= RangeEnd || Span.Offset - RangeEnd <= _MaxGap) && End - Range.Offset <= PHD_BATCH_MAX_READ)
+      {
+        Range.Length = End - Range.Offset;
+        Range.SpanCount++;
+        continue;
+      }
+    }
+
+    PHD_BatchRange Range = {Span.Offset, Span.Length, iSpan, 1};
+    Ranges.push_back(Range);
+  }
+
+  std::atomic<size_t> NextRange(0);
+  auto Worker = [&](HANDLE _File)
+  {
+    std::vector<uint8_t> Staging;
+    std::vector<uint8_t> Block; // last solid block decoded, its siblings follow it
+    uint64_t BlockIndex = PHD_NO_BLOCK;
+
+    for(size_t iRange = NextRange++; iRange < Ranges.size(); iRange = NextRange++)
+    {
+      const PHD_BatchRange &Range = Ranges[iRange];
+
+      PHD_BatchRead *Lone = &_Reads[Spans[Range.FirstSpan].Read];
+      if(Range.SpanCount == 1 && Lone->Entry->Method == PHD_METHOD_STORE && !_Unbuffered)
+      {
+        if(Lone->Entry->StoredLength != Lone->Entry->Length) Lone->Result = PHD_ARCHIVE_ERROR_FORMAT;
+        else Lone->Result = PHD_ArchiveReadAt(_File, Range.Offset, (uint8_t*)Lone->Buffer, Range.Length, Range.Length);
+        continue;
+      }
+
+      // unbuffered: the sectors around the range into a sector aligned part of Staging
+      uint64_t Start = _Unbuffered ? Range.Offset & ~(uint64_t)(PHD_BATCH_SECTOR-1) : Range.Offset;
+      uint64_t Needed = Range.Offset + Range.Length - Start;
+      uint64_t Length = _Unbuffered ? (Needed + PHD_BATCH_SECTOR-1) & ~(uint64_t)(PHD_BATCH_SECTOR-1) : Needed;
+      Staging.resize((size_t)Length + (_Unbuffered ? PHD_BATCH_SECTOR : 0));
+
+      uint8_t *Aligned = Staging.data();
+      if(_Unbuffered) Aligned = (uint8_t*)(((uintptr_t)Aligned + PHD_BATCH_SECTOR-1) & ~(uintptr_t)(PHD_BATCH_SECTOR-1));
+      const uint8_t *Data = Aligned + (Range.Offset - Start); // the range's bytes
+
+      int Result = PHD_ArchiveReadAt(_File, Start, Aligned, Length, Needed);
+      if(Result) BlockIndex = PHD_NO_BLOCK;
+
+      for(size_t iSpan = Range.FirstSpan; iSpan < Range.FirstSpan + Range.SpanCount; ++iSpan)
+      {
+        PHD_BatchRead *Read = &_Reads[Spans[iSpan].Read];
+        const PHD_TocEntry *Entry = Read->Entry;
+        std::string_view Stored((const char*)Data + (Spans[iSpan].Offset - Range.Offset), (size_t)Spans[iSpan].Length);
+
+        if(Result) Read->Result = Result;
+        else if(Entry->Method != PHD_METHOD_SOLID) Read->Result = PHD_ArchiveDecode(Stored, Entry->Method, Entry->Length, Read->Buffer);
+        else
+        {
+          // as PHD_ArchiveLoadBlock, from the staging buffer instead of the mapping
+          const PHD_TocBlock *TocBlock = &_Archive->Blocks[Entry->Block];
+          if(BlockIndex != Entry->Block)
+          {
+            BlockIndex = PHD_NO_BLOCK;
+            if(TocBlock->Length / 256 > TocBlock->StoredLength) {Read->Result = PHD_ARCHIVE_ERROR_FORMAT; continue;}
+
+            Block.resize((size_t)TocBlock->Length);
+            if(PHD_ArchiveDecode(Stored, TocBlock->Method, TocBlock->Length, Block.data())) {Read->Result = PHD_ARCHIVE_ERROR_FORMAT; continue;}
+            BlockIndex = Entry->Block;
+          }
+
+          if(Entry->Offset > Block.size() || Entry->Length > Block.size() - Entry->Offset) Read->Result = PHD_ARCHIVE_ERROR_FORMAT;
+          else memcpy(Read->Buffer, Block.data() + Entry->Offset, (size_t)Entry->Length);
+        }
+      }
+    }
+  };
+
+  // reads through one synchronous handle are serialized, every other thread opens its own
+  // (unbuffered, every thread does: the archive's handle goes through the file cache)
+  size_t Threads = std::min<size_t>((size_t)std::max(_Threads, 1), Ranges.size());
+  DWORD Flags = _Unbuffered ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_RANDOM_ACCESS;
+  std::vector<HANDLE> Files;
+  for(size_t iThread = _Unbuffered ? 0 : 1; iThread < Threads; ++iThread)
+  {
+    HANDLE File = ReOpenFile(_Archive->File, GENERIC_READ, FILE_SHARE_READ, Flags);
+    if(File == INVALID_HANDLE_VALUE) break;
+    Files.push_back(File);
+  }
+
+  if(_Unbuffered && Threads && Files.empty())
+  {
+    for(size_t iSpan = 0; iSpan < Spans.size(); ++iSpan) _Reads[Spans[iSpan].Read].Result = PHD_ARCHIVE_ERROR_READ;
+    NextRange = Ranges.size();
+  }
+
+  std::vector<std::thread> Workers;
+  for(size_t iFile = _Unbuffered ? 1 : 0; iFile < Files.size(); ++iFile) Workers.push_back(std::thread(Worker, Files[iFile]));
+
+  Worker((_Unbuffered && Files.size()) ? Files[0] : _Archive->File);
+  for(size_t iWorker = 0; iWorker < Workers.size(); ++iWorker) Workers[iWorker].join();
+  for(size_t iFile = 0; iFile < Files.size(); ++iFile) CloseHandle(Files[iFile]);
+
+  for(size_t iRead = 0; iRead < _Count; ++iRead)
+  {
+    if(_Reads[iRead].Result) return _Reads[iRead].Result;
+  }
+
+  return PHD_ARCHIVE_OK;
+}
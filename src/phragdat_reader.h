@@ -0,0 +1,194 @@
+//====================================
+// PhragDat Reader
+// memory mapped, zero copy access to
+// .dat archives
+// C++17 Windows 64-bit
+//====================================
+// (c) Phragware 2020
+//====================================
+// Usage:
+//   PHD_Archive Archive;
+//   if(PHD_ArchiveOpen(&Archive, "data.dat")) {error}
+//   std::string_view Data = PHD_ArchiveGet(&Archive, "textures/grass.png");
+//   if(Data.data()) {use Data, valid until PHD_ArchiveClose}
+//   PHD_ArchiveClose(&Archive);
+// Entries compressed with phragdat -z have no view into the mapping,
+// PHD_ArchiveRead decodes them (or copies stored ones) into a buffer:
+//   const PHD_TocEntry *Entry = PHD_ArchiveFind(&Archive, "levels/1.map");
+//   std::vector<uint8_t> Buffer(Entry->Length);
+//   if(PHD_ArchiveRead(&Archive, Entry, &Buffer[0])) {damaged}
+// Small files packed with phragdat -s live in solid blocks, a
+// PHD_BlockCache keeps the last decoded block so its siblings are served
+// without another read or decode:
+//   PHD_BlockCache Cache;
+//   std::string_view Data = PHD_ArchiveView(&Archive, Entry, &Cache);
+// Checksums written by phragdat v6.0 are checked on request, not on every read:
+//   if(PHD_ArchiveVerifyToc(&Archive) || PHD_ArchiveVerifyEntry(&Archive, Entry)) {damaged}
+// The order a program first reads its files in can be traced and given
+// to phragdat -l, which writes them first and in that order:
+//   PHD_ArchiveTraceBegin(&Archive);
+//   {startup}
+//   PHD_ArchiveTraceWrite(&Archive, "startup.trace");
+// Nothing is read when an archive is opened, pages are loaded by the OS
+// the first time a view is touched and shared between every process that
+// maps the same .dat. A program that needs the files compiled with
+// phragdat -p before it can start loads them (and the table of contents)
+// up front in a few large reads instead of a page fault per file:
+//   PHD_ArchivePreloadHot(&Archive);
+// Loading many files at once (a level, a scene) is cheaper as one batch,
+// neighbouring files are fetched with one read:
+//   std::vector<PHD_BatchRead> Reads = {{"levels/1.map", Map, MapSize}, {"levels/1.nav", Nav, NavSize}};
+//   if(PHD_ArchiveReadBatch(&Archive, Reads.data(), Reads.size(), PHD_BATCH_GAP, 4, false)) {check each Result}
+//====================================
+
+#ifndef PHRAGDAT_READER_H
+#define PHRAGDAT_READER_H
+
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+#include <windows.h>
+
+#include "phragdat_format.h"
+
+struct PHD_ArchiveTrace; // see PHD_ArchiveTraceBegin
+
+// PHD_ArchiveOpen return codes
+#define PHD_ARCHIVE_OK 0
+#define PHD_ARCHIVE_ERROR_OPEN 1 // file missing or not readable
+#define PHD_ARCHIVE_ERROR_MAP 2 // file mapping failed
+#define PHD_ARCHIVE_ERROR_FORMAT 3 // not a .dat or damaged table of contents
+
+// PHD_BatchRead Result codes, besides the ones above
+#define PHD_ARCHIVE_ERROR_MISSING 4 // path not in the archive
+#define PHD_ARCHIVE_ERROR_BUFFER 5 // BufferSize smaller than the file
+#define PHD_ARCHIVE_ERROR_READ 6 // ReadFile failed
+
+// PHD_ArchiveReadBatch
+#define PHD_BATCH_GAP 0x10000 // suggested _MaxGap, 64KB: reading over it costs less than another request
+#define PHD_BATCH_MAX_READ 0x1000000 // merged reads stop growing at 16MB, a lone larger entry is read on its own
+#define PHD_BATCH_SECTOR 0x1000 // _Unbuffered reads cover whole 4KB sectors (512 byte sector drives too)
+
+//================================
+// PHD_Archive (Open .dat file)
+//================================
+struct PHD_Archive
+{
+  HANDLE File;
+  HANDLE Mapping;
+  const uint8_t *Base; // start of mapped .dat
+  uint64_t Size; // .dat size in bytes
+  uint8_t VersionMajor;
+  uint8_t VersionMinor;
+  uint32_t Alignment; // phragdat -aN the archive was built with, 1 = packed
+
+  // table of contents, all NULL/0 for archives older than v6.0
+  const PHD_TocEntry *Entries;
+  uint64_t EntryCount;
+  const PHD_TocBlock *Blocks;
+  uint64_t BlockCount;
+  uint32_t IndexType; // PHD_INDEX_*
+  const PHD_TocPartition *Partitions; // PHD_INDEX_MPHF: PartitionCount+1
+  uint64_t PartitionCount;
+  const uint8_t *Fingerprints; // one per entry
+  const uint16_t *Seeds;
+  uint64_t SeedCount; // seeds that fit before the footer, partitions are checked against it
+  const uint32_t *Table; // PHD_INDEX_TABLE
+  uint64_t TableSlots;
+  const char *Strings;
+  uint64_t StringsLength;
+  uint64_t TocOffset; // start of the table of contents
+  uint32_t TocChecksum; // footer Checksum
+  uint64_t HotOffset; // hot region (phragdat -p), see PHD_ArchivePreloadHot
+  uint64_t HotLength; // 0 if the archive has none
+  PHD_ArchiveTrace *Trace; // NULL unless PHD_ArchiveTraceBegin was called
+};
+
+//===================================
+// PHD_BlockCache (Decoded Block)
+// one per thread, not shared
+//===================================
+struct PHD_BlockCache
+{
+  const PHD_Archive *Archive = NULL; // archive Block was decoded from
+  uint64_t Block = PHD_NO_BLOCK; // index of the block in Data
+  std::vector<uint8_t> Data;
+};
+
+//======================================
+// PHD_BatchRead (One File of a Batch)
+// see PHD_ArchiveReadBatch
+//======================================
+struct PHD_BatchRead
+{
+  std::string_view Path; // within the .dat
+  void *Buffer; // receives the Entry->Length original bytes
+  uint64_t BufferSize;
+  const PHD_TocEntry *Entry; // set by the batch, NULL if Path is missing
+  int Result; // set by the batch, PHD_ARCHIVE_OK or an error code
+};
+
+// maps _Path read only, returns PHD_ARCHIVE_OK or an error code
+int PHD_ArchiveOpen(PHD_Archive *_Archive, const char *_Path);
+
+// unmaps the archive, every view into it becomes invalid
+void PHD_ArchiveClose(PHD_Archive *_Archive);
+
+// entry for a path within the .dat ('/' separated, as in the .csv), NULL if missing
+const PHD_TocEntry *PHD_ArchiveFind(const PHD_Archive *_Archive, std::string_view _Path);
+
+// contents of a path within the .dat, data() is NULL if missing or compressed
+std::string_view PHD_ArchiveGet(const PHD_Archive *_Archive, std::string_view _Path);
+
+// stored bytes (StoredLength, compressed if Method is PHD_METHOD_LZ, NULL for PHD_METHOD_SOLID) and path of a table of contents entry
+std::string_view PHD_ArchiveEntryData(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry);
+std::string_view PHD_ArchiveEntryPath(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry);
+
+// writes the _Entry->Length original bytes of an entry to _Buffer, returns 0 or
+// PHD_ARCHIVE_ERROR_FORMAT if the entry is damaged or uses an unknown method
+int PHD_ArchiveRead(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry, void *_Buffer);
+
+// contents of an entry without a copy: stored entries point into the mapping, solid entries into
+// _Cache (valid until _Cache decodes another block), data() is NULL for damaged or -z compressed entries
+std::string_view PHD_ArchiveView(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry, PHD_BlockCache *_Cache);
+
+// CRC32C of the table of contents matches the footer, returns 0 or PHD_ARCHIVE_ERROR_FORMAT
+// (also for archives older than v6.0, which have no checksums)
+int PHD_ArchiveVerifyToc(const PHD_Archive *_Archive);
+
+// stored bytes of an entry (its block for PHD_METHOD_SOLID entries) or of solid block _Block
+// match the CRC32C written with them, returns 0 or PHD_ARCHIVE_ERROR_FORMAT
+int PHD_ArchiveVerifyEntry(const PHD_Archive *_Archive, const PHD_TocEntry *_Entry);
+int PHD_ArchiveVerifyBlock(const PHD_Archive *_Archive, uint64_t _Block);
+
+// raw range of the .dat (.csv address/length for pre-v6.0 archives), data() is NULL if out of bounds
+std::string_view PHD_ArchiveRange(const PHD_Archive *_Archive, uint64_t _Address, uint64_t _Length);
+
+// records the first time PHD_ArchiveFind (or PHD_ArchiveGet) finds each path from now on, for phragdat -l,
+// returns 0 or PHD_ARCHIVE_ERROR_FORMAT for archives older than v6.0. Begin, Write and End must not run
+// while another thread uses the archive, Find may be called from any number of threads in between
+int PHD_ArchiveTraceBegin(PHD_Archive *_Archive);
+
+// writes the paths recorded so far to _Path in the order they were first found (see the trace format),
+// returns 0, PHD_ARCHIVE_ERROR_FORMAT if no trace was begun or PHD_ARCHIVE_ERROR_OPEN if _Path can not be written
+int PHD_ArchiveTraceWrite(const PHD_Archive *_Archive, const char *_Path);
+
+// stops recording and frees the trace, PHD_ArchiveClose does too
+void PHD_ArchiveTraceEnd(PHD_Archive *_Archive);
+
+// reads the hot region (phragdat -p) and the table of contents into memory with one prefetch of both
+// ranges and returns once every page of them is resident, views into them are then served from RAM,
+// returns 0 or PHD_ARCHIVE_ERROR_FORMAT for archives older than v6.0 (an archive without a hot region
+// only loads its table of contents)
+int PHD_ArchivePreloadHot(const PHD_Archive *_Archive);
+
+// reads the files of _Count _Reads into their buffers with as few reads of the .dat as it can: the stored
+// ranges (a solid entry's is its block) are sorted by offset, ranges less than _MaxGap bytes apart are merged
+// into reads of up to PHD_BATCH_MAX_READ bytes issued with ReadFile by _Threads threads (each with its own
+// handle), then every file is copied or decoded out of its read into Buffer. A lone stored file is read
+// straight into its buffer. _Unbuffered reads with FILE_FLAG_NO_BUFFERING (whole sectors into an aligned
+// staging buffer), for one-off loads that should not fill the file cache or to time the device.
+// Returns PHD_ARCHIVE_OK if every file was read, else the first failed Result
+int PHD_ArchiveReadBatch(const PHD_Archive *_Archive, PHD_BatchRead *_Reads, size_t _Count, uint64_t _MaxGap, int _Threads, bool _Unbuffered);
+
+#endif // PHRAGDAT_READER_H